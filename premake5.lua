@@ -125,8 +125,13 @@ project "dumprwtree"
 	includedirs { "." }
 	libdirs { Libdir }
 	links { "librw" }
+	filter { "platforms:linux*" }
+		links { "pthread" }
+	filter {}
 
 function findlibs()
+	filter { "platforms:linux*", "platforms:not ps2" }
+		links { "pthread" }
 	filter { "platforms:linux*gl3" }
 		links { "GL" }
 		if _OPTIONS["gfxlib"] == "glfw" then
@@ -222,6 +227,36 @@ project "ska2anm"
 	findlibs()
 	removeplatforms { "*gl3", "*d3d9", "*ps2" }
 
+project "atlas"
+	kind "ConsoleApp"
+	targetdir (Bindir)
+	files { path.join("tools/atlas", "*.cpp") }
+	includedirs { "." }
+	libdirs { Libdir }
+	links { "librw" }
+	findlibs()
+	removeplatforms { "*gl3", "*d3d9", "*ps2" }
+
+project "meshopt"
+	kind "ConsoleApp"
+	targetdir (Bindir)
+	files { path.join("tools/meshopt", "*.cpp") }
+	includedirs { "." }
+	libdirs { Libdir }
+	links { "librw" }
+	findlibs()
+	removeplatforms { "*gl3", "*d3d9", "*ps2" }
+
+project "stripbench"
+	kind "ConsoleApp"
+	targetdir (Bindir)
+	files { path.join("tools/stripbench", "*.cpp") }
+	includedirs { "." }
+	libdirs { Libdir }
+	links { "librw" }
+	findlibs()
+	removeplatforms { "*gl3", "*d3d9", "*ps2" }
+
 project "ps2test"
 	kind "ConsoleApp"
 	targetdir (Bindir)
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -81,12 +82,16 @@ Animation::create(AnimInterpolatorInfo *interpInfo, int32 numFrames,
 	anim->keyframes = data;
 	data += anim->numFrames*interpInfo->animKeyFrameSize;
 	anim->customData = data;
+	anim->nodeMap = nil;
+	anim->nodeKeys = nil;
+	anim->nodeKeyOffsets = nil;
 	return anim;
 }
 
 void
 Animation::destroy(void)
 {
+	rwFree(this->nodeMap);
 	rwFree(this);
 }
 
@@ -101,6 +106,69 @@ Animation::getNumNodes(void)
 	return n;
 }
 
+// The first two keyframes of every node come first,
+// after that a keyframe belongs to the node of its prev frame.
+// Keyframes must not be changed after this was built.
+void
+Animation::buildKeyFrameIndex(int32 numNodes)
+{
+	int32 i;
+	if(this->nodeMap)
+		return;
+	this->nodeMap = rwNewT(int32, this->numFrames*2 + numNodes+1, MEMDUR_EVENT | ID_ANIMANIMATION);
+	this->nodeKeys = this->nodeMap + this->numFrames;
+	this->nodeKeyOffsets = this->nodeKeys + this->numFrames;
+	uint8 *first = (uint8*)this->keyframes;
+	int32 sz = this->interpInfo->animKeyFrameSize;
+	memset(this->nodeKeyOffsets, 0, (numNodes+1)*sizeof(int32));
+	for(i = 0; i < this->numFrames; i++){
+		if(i < numNodes*2)
+			this->nodeMap[i] = i % numNodes;
+		else{
+			int32 prev = ((uint8*)this->getAnimFrame(i)->prev - first)/sz;
+			this->nodeMap[i] = prev >= 0 && prev < i ? this->nodeMap[prev] : 0;
+		}
+		this->nodeKeyOffsets[this->nodeMap[i]+1]++;
+	}
+	for(i = 0; i < numNodes; i++)
+		this->nodeKeyOffsets[i+1] += this->nodeKeyOffsets[i];
+	// keyframes of a node are in time order in the animation too,
+	// filling moves every offset to the next node
+	for(i = 0; i < this->numFrames; i++)
+		this->nodeKeys[this->nodeKeyOffsets[this->nodeMap[i]]++] = i;
+	for(i = numNodes; i > 0; i--)
+		this->nodeKeyOffsets[i] = this->nodeKeyOffsets[i-1];
+	this->nodeKeyOffsets[0] = 0;
+}
+
+// Make every keyframe relative to the pose at time,
+// for adding to other animations with AnimInterpolator::addTogether
+void
+Animation::makeDelta(int32 numNodes, float32 time)
+{
+	int32 i, j;
+	AnimInterpolatorInfo::MulRecipCB mulRecipCB = this->interpInfo->mulRecipCB;
+	int32 sz = this->interpInfo->animKeyFrameSize;
+	if(mulRecipCB == nil){
+		RWERROR((ERR_GENERAL, "animation type can't be made relative"));
+		return;
+	}
+	this->buildKeyFrameIndex(numNodes);
+
+	// the last keyframe of every node up to time, copied
+	// because they are changed too
+	uint8 *start = rwNewT(uint8, numNodes*sz, MEMDUR_FUNCTION | ID_ANIMANIMATION);
+	for(i = 0; i < numNodes; i++){
+		int32 *keys = &this->nodeKeys[this->nodeKeyOffsets[i]];
+		int32 n = this->nodeKeyOffsets[i+1] - this->nodeKeyOffsets[i];
+		for(j = 1; j < n && this->getAnimFrame(keys[j])->time <= time; j++);
+		memcpy(start + i*sz, this->getAnimFrame(keys[j-1]), sz);
+	}
+	for(i = 0; i < this->numFrames; i++)
+		mulRecipCB(this->getAnimFrame(i), start + this->nodeMap[i]*sz);
+	rwFree(start);
+}
+
 Animation*
 Animation::streamRead(Stream *stream)
 {
@@ -205,8 +273,32 @@ AnimInterpolator::create(int32 numNodes, int32 maxFrameSize)
 	interp->maxInterpKeyFrameSize = maxFrameSize;
 	interp->currentInterpKeyFrameSize = maxFrameSize;
 	interp->currentAnimKeyFrameSize = -1;
-	interp->numNodes = numNodes;;
+	interp->numNodes = numNodes;
+	interp->parentInterp = nil;
+	interp->offsetInParent = 0;
+	interp->applyCB = nil;
+	interp->blendCB = nil;
+	interp->interpCB = nil;
+	interp->addCB = nil;
+
+	return interp;
+}
 
+// An interpolator for the nodes startNode to startNode+numNodes-1 of this one.
+// Its results are written into this interpolator's frames, so a different
+// animation can run on a part of the hierarchy.
+AnimInterpolator*
+AnimInterpolator::createSubInterpolator(int32 startNode, int32 numNodes, int32 maxKeyFrameSize)
+{
+	if(startNode < 0 || startNode+numNodes > this->numNodes){
+		RWERROR((ERR_GENERAL, "sub interpolator out of range"));
+		return nil;
+	}
+	AnimInterpolator *interp = AnimInterpolator::create(numNodes, maxKeyFrameSize);
+	if(interp == nil)
+		return nil;
+	interp->parentInterp = this;
+	interp->offsetInParent = startNode;
 	return interp;
 }
 
@@ -226,7 +318,9 @@ AnimInterpolator::setCurrentAnim(Animation *anim)
 	int32 maxkf = this->maxInterpKeyFrameSize;
 	if(sizeof(void*) > 4)	// see above in create()
 		maxkf += 16;
-	if(interpInfo->interpKeyFrameSize > maxkf){
+	if(interpInfo->interpKeyFrameSize > maxkf ||
+	   (this->parentInterp &&
+	    interpInfo->interpKeyFrameSize > this->parentInterp->currentInterpKeyFrameSize)){
 		RWERROR((ERR_GENERAL, "interpolation frame too big"));
 		return 0;
 	}
@@ -249,6 +343,9 @@ AnimInterpolator::setCurrentAnim(Animation *anim)
 			this->interpCB(intf, kf1, kf2, 0.0f, anim->customData);
 	}
 	this->nextFrame = this->getAnimFrame(numNodes*2);
+	anim->buildKeyFrameIndex(numNodes);
+	if(this->parentInterp)
+		this->updateParent();
 	return 1;
 }
 
@@ -259,21 +356,19 @@ AnimInterpolator::addTime(float32 t)
 	if(t <= 0.0f)
 		return;
 	this->currentTime += t;
-	// reset animation
+	// loop, keeping what went past the end
 	if(this->currentTime > this->currentAnim->duration){
-		this->setCurrentAnim(this->currentAnim);
+		this->setCurrentTime(this->currentTime);
 		return;
 	}
 	KeyFrameHeader *last = this->getAnimFrame(this->currentAnim->numFrames);
 	KeyFrameHeader *next = (KeyFrameHeader*)this->nextFrame;
 	InterpFrameHeader *ifrm = nil;
+	int32 *nodeMap = this->currentAnim->nodeMap;
+	int32 nextIdx = ((uint8*)next - (uint8*)this->currentAnim->keyframes)/currentAnimKeyFrameSize;
 	while(next < last && next->prev->time <= this->currentTime){
-		// find next interpolation frame to expire
-		for(i = 0; i < this->numNodes; i++){
-			ifrm = this->getInterpFrame(i);
-			if(ifrm->keyFrame2 == next->prev)
-				break;
-		}
+		// the interpolation frame to expire is the one of next's node
+		ifrm = this->getInterpFrame(nodeMap[nextIdx++]);
 		// advance interpolation frame
 		ifrm->keyFrame1 = ifrm->keyFrame2;
 		ifrm->keyFrame2 = next;
@@ -288,6 +383,126 @@ AnimInterpolator::addTime(float32 t)
 		               this->currentTime,
 		               this->currentAnim->customData);
 	}
+	if(this->parentInterp)
+		this->updateParent();
+}
+
+void
+AnimInterpolator::subTime(float32 t)
+{
+	this->setCurrentTime(this->currentTime - t);
+}
+
+// Jump to any time of the animation, wrapped around its duration
+void
+AnimInterpolator::setCurrentTime(float32 t)
+{
+	int32 i;
+	Animation *anim = this->currentAnim;
+	if(anim->duration > 0.0f){
+		t = fmodf(t, anim->duration);
+		if(t < 0.0f)
+			t += anim->duration;
+	}else
+		t = 0.0f;
+	this->currentTime = t;
+
+	// the last keyframe of every node that starts before t
+	for(i = 0; i < this->numNodes; i++){
+		int32 *keys = &anim->nodeKeys[anim->nodeKeyOffsets[i]];
+		int32 lo = 0;
+		int32 hi = anim->nodeKeyOffsets[i+1] - anim->nodeKeyOffsets[i] - 2;
+		while(lo < hi){
+			int32 mid = (lo + hi + 1)/2;
+			if(this->getAnimFrame(keys[mid])->time <= t)
+				lo = mid;
+			else
+				hi = mid-1;
+		}
+		InterpFrameHeader *ifrm = this->getInterpFrame(i);
+		ifrm->keyFrame1 = this->getAnimFrame(keys[lo]);
+		ifrm->keyFrame2 = this->getAnimFrame(keys[lo+1]);
+		if(this->interpCB)
+			this->interpCB(ifrm, ifrm->keyFrame1, ifrm->keyFrame2,
+			               t, anim->customData);
+	}
+
+	// keyframes are sorted by the time of their prev frame,
+	// the next one is the first that isn't in use yet
+	int32 lo = this->numNodes*2;
+	int32 hi = anim->numFrames;
+	while(lo < hi){
+		int32 mid = (lo + hi)/2;
+		if(this->getAnimFrame(mid)->prev->time <= t)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	this->nextFrame = this->getAnimFrame(lo);
+	if(this->parentInterp)
+		this->updateParent();
+}
+
+// results of blend and addTogether are used like those of in1
+void
+AnimInterpolator::takeCallbacks(AnimInterpolator *src)
+{
+	this->currentInterpKeyFrameSize = src->currentInterpKeyFrameSize;
+	this->applyCB = src->applyCB;
+	this->blendCB = src->blendCB;
+	this->interpCB = src->interpCB;
+	this->addCB = src->addCB;
+}
+
+// this = in1 blended towards in2 by alpha
+bool32
+AnimInterpolator::blend(AnimInterpolator *in1, AnimInterpolator *in2, float32 alpha)
+{
+	if(in1->blendCB == nil || in1->blendCB != in2->blendCB ||
+	   in1->numNodes != this->numNodes || in2->numNodes != this->numNodes ||
+	   in1->currentInterpKeyFrameSize > this->maxInterpKeyFrameSize){
+		RWERROR((ERR_GENERAL, "can't blend interpolators"));
+		return 0;
+	}
+	this->takeCallbacks(in1);
+	for(int32 i = 0; i < this->numNodes; i++)
+		this->blendCB(this->getInterpFrame(i), in1->getInterpFrame(i),
+		        in2->getInterpFrame(i), alpha);
+	if(this->parentInterp)
+		this->updateParent();
+	return 1;
+}
+
+// this = in1 with in2 added on top, in2 usually
+// plays an animation made with Animation::makeDelta
+bool32
+AnimInterpolator::addTogether(AnimInterpolator *in1, AnimInterpolator *in2)
+{
+	if(in1->addCB == nil || in1->addCB != in2->addCB ||
+	   in1->numNodes != this->numNodes || in2->numNodes != this->numNodes ||
+	   in1->currentInterpKeyFrameSize > this->maxInterpKeyFrameSize){
+		RWERROR((ERR_GENERAL, "can't add interpolators"));
+		return 0;
+	}
+	this->takeCallbacks(in1);
+	for(int32 i = 0; i < this->numNodes; i++)
+		this->addCB(this->getInterpFrame(i), in1->getInterpFrame(i),
+		      in2->getInterpFrame(i));
+	if(this->parentInterp)
+		this->updateParent();
+	return 1;
+}
+
+// Copy the interpolated values, not the keyframe pointers
+// which the parent needs for its own animation
+void
+AnimInterpolator::updateParent(void)
+{
+	AnimInterpolator *parent = this->parentInterp;
+	int32 sz = this->currentInterpKeyFrameSize - sizeof(InterpFrameHeader);
+	for(int32 i = 0; i < this->numNodes; i++)
+		memcpy(parent->getInterpFrame(this->offsetInParent+i)+1,
+		       this->getInterpFrame(i)+1, sz);
 }
 
 }
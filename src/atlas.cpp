@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwanim.h"
+#include "rwplugins.h"
+
+#include "stb/stb_rect_pack.h"
+
+#define PLUGIN_ID 0
+
+// Packs the small textures of a clump into atlases.
+//
+// A texture can only go into an atlas if all its texture coordinates
+// are in [0,1], if no vertex is shared with a different texture and if
+// nothing else looks at the texture coordinates (uv animation, matfx).
+// The padding around each texture is filled according to its addressing
+// mode, so filtering at the edges is the same as with the separate texture.
+
+namespace rw {
+
+static AtlasParams defaultAtlasParams = { 1024, 256, 2 };
+
+struct AtlasTex
+{
+	Texture *tex;
+	Image *image;
+	bool32 excluded;
+	int32 atlas;	// -1 if not packed
+	int32 x, y;	// of the texels, padding is around them
+};
+
+struct AtlasGeo
+{
+	Geometry *geo;
+	int32 *owner;	// texture of each vertex, -1 none, -2 unused
+};
+
+struct AtlasBuilder
+{
+	AtlasParams params;
+	AtlasTex *texs;
+	int32 numTexs;
+	AtlasGeo *geos;
+	int32 numGeos;
+	Texture **atlases;
+	int32 numAtlases;
+	TexDictionary *txd;
+};
+
+static int32
+findTex(AtlasBuilder *b, Texture *tex)
+{
+	for(int32 i = 0; i < b->numTexs; i++)
+		if(b->texs[i].tex == tex)
+			return i;
+	return -1;
+}
+
+static void
+exclude(AtlasBuilder *b, int32 t)
+{
+	if(t >= 0)
+		b->texs[t].excluded = 1;
+}
+
+// Does something other than the base texture use the texture coordinates?
+static bool32
+hasUVEffects(Material *mat)
+{
+	if(Material::getPluginOffset(ID_MATFX) >= 0){
+		uint32 fx = MatFX::getEffects(mat);
+		if(fx != MatFX::NOTHING && fx != MatFX::ENVMAP)
+			return 1;
+	}
+	if(Material::getPluginOffset(ID_UVANIMATION) >= 0 && UVAnim::exists(mat))
+		return 1;
+	return 0;
+}
+
+static bool32
+hasPlugins(Material *mat)
+{
+	if(Material::getPluginOffset(ID_MATFX) >= 0 && MatFX::getEffects(mat) != MatFX::NOTHING)
+		return 1;
+	if(Material::getPluginOffset(ID_UVANIMATION) >= 0 && UVAnim::exists(mat))
+		return 1;
+	return 0;
+}
+
+static bool32
+sameMaterial(Material *m1, Material *m2)
+{
+	return m1->texture == m2->texture &&
+		m1->color.red == m2->color.red &&
+		m1->color.green == m2->color.green &&
+		m1->color.blue == m2->color.blue &&
+		m1->color.alpha == m2->color.alpha &&
+		m1->surfaceProps.ambient == m2->surfaceProps.ambient &&
+		m1->surfaceProps.specular == m2->surfaceProps.specular &&
+		m1->surfaceProps.diffuse == m2->surfaceProps.diffuse &&
+		m1->pipeline == m2->pipeline &&
+		!hasPlugins(m1) && !hasPlugins(m2);
+}
+
+static void
+addGeometry(AtlasBuilder *b, Geometry *geo)
+{
+	int32 i;
+	for(i = 0; i < b->numGeos; i++)
+		if(b->geos[i].geo == geo)
+			return;
+	b->geos[b->numGeos].geo = geo;
+	b->geos[b->numGeos].owner = nil;
+	b->numGeos++;
+
+	for(i = 0; i < geo->matList.numMaterials; i++){
+		Texture *tex = geo->matList.materials[i]->texture;
+		if(tex == nil || findTex(b, tex) >= 0)
+			continue;
+		AtlasTex *t = &b->texs[b->numTexs++];
+		t->tex = tex;
+		t->image = nil;
+		t->atlas = -1;
+		t->x = t->y = 0;
+		Raster *r = tex->raster;
+		t->excluded = r == nil ||
+			r->width > b->params.maxTexSize ||
+			r->height > b->params.maxTexSize ||
+			r->width + 2*b->params.padding > b->params.maxSize ||
+			r->height + 2*b->params.padding > b->params.maxSize;
+	}
+}
+
+// Find out which textures can't go into an atlas
+static void
+checkGeometry(AtlasBuilder *b, AtlasGeo *ag)
+{
+	const float32 eps = 0.001f;
+	int32 i, j;
+	Geometry *geo = ag->geo;
+	bool32 index32 = geo->flags & Geometry::INDEX32;
+
+	if(geo->flags & Geometry::NATIVE || geo->numTexCoordSets == 0 ||
+	   geo->numTriangles == 0 ||
+	   (index32 ? (void*)geo->triangles32 : (void*)geo->triangles) == nil){
+		for(i = 0; i < geo->matList.numMaterials; i++)
+			if(geo->matList.materials[i]->texture)
+				exclude(b, findTex(b, geo->matList.materials[i]->texture));
+		return;
+	}
+
+	ag->owner = rwNewT(int32, geo->numVertices, MEMDUR_FUNCTION | ID_TEXTURE);
+	for(i = 0; i < geo->numVertices; i++)
+		ag->owner[i] = -2;
+	TexCoords *tc = geo->texCoords[0];
+	for(i = 0; i < geo->numTriangles; i++){
+		int32 matId = index32 ? geo->triangles32[i].matId : geo->triangles[i].matId;
+		Material *mat = geo->matList.materials[matId];
+		int32 t = mat->texture ? findTex(b, mat->texture) : -1;
+		if(t >= 0 && hasUVEffects(mat))
+			exclude(b, t);
+		for(j = 0; j < 3; j++){
+			int32 v = index32 ? geo->triangles32[i].v[j] : geo->triangles[i].v[j];
+			if(t >= 0 &&
+			   (tc[v].u < -eps || tc[v].u > 1.0f+eps ||
+			    tc[v].v < -eps || tc[v].v > 1.0f+eps))
+				exclude(b, t);
+			// a vertex can only be moved to one place
+			if(ag->owner[v] == -2)
+				ag->owner[v] = t;
+			else if(ag->owner[v] != t){
+				exclude(b, ag->owner[v]);
+				exclude(b, t);
+			}
+		}
+	}
+}
+
+static int32
+addressTexel(int32 i, int32 n, int32 mode)
+{
+	switch(mode){
+	case Texture::WRAP:
+		i %= n;
+		return i < 0 ? i+n : i;
+	case Texture::MIRROR:
+		i %= 2*n;
+		if(i < 0) i += 2*n;
+		return i < n ? i : 2*n-1 - i;
+	default:
+		return i < 0 ? 0 : i >= n ? n-1 : i;
+	}
+}
+
+static void
+blitPadded(Image *dst, AtlasTex *t, int32 pad)
+{
+	Image *src = t->image;
+	int32 addrU = t->tex->getAddressU();
+	int32 addrV = t->tex->getAddressV();
+	for(int32 y = -pad; y < src->height+pad; y++){
+		uint8 *srcrow = src->pixels + addressTexel(y, src->height, addrV)*src->stride;
+		uint8 *dstrow = dst->pixels + (t->y+y)*dst->stride;
+		for(int32 x = -pad; x < src->width+pad; x++)
+			memcpy(&dstrow[(t->x+x)*4], &srcrow[addressTexel(x, src->width, addrU)*4], 4);
+	}
+}
+
+static Texture*
+makeAtlas(AtlasBuilder *b, int32 *members, int32 n, int32 width, int32 height, int32 pad)
+{
+	int32 i;
+	int32 w, h, depth, format, type;
+	char name[32];
+	Texture *first = b->texs[members[0]].tex;
+	int32 filter = first->getFilter();
+
+	Image *img = Image::create(width, height, 32);
+	img->allocate();
+	memset(img->pixels, 0, img->stride*img->height);
+	for(i = 0; i < n; i++)
+		blitPadded(img, &b->texs[members[i]], pad);
+
+	type = Raster::TEXTURE;
+	if(filter >= Texture::MIPNEAREST)
+		type |= Raster::MIPMAP | Raster::AUTOMIPMAP;
+	Raster *raster = nil;
+	if(Raster::imageFindRasterFormat(img, type, &w, &h, &depth, &format, first->raster->platform)){
+		raster = Raster::create(w, h, depth, format, first->raster->platform);
+		if(raster && raster->setFromImage(img, first->raster->platform) == nil){
+			raster->destroy();
+			raster = nil;
+		}
+	}
+	img->destroy();
+	if(raster == nil)
+		return nil;
+
+	Texture *tex = Texture::create(raster);
+	for(i = 0; ; i++){
+		sprintf(name, "atlas%d", b->numAtlases + i);
+		if(b->txd == nil || b->txd->find(name) == nil)
+			break;
+	}
+	strncpy(tex->name, name, 32);
+	tex->setFilter((Texture::FilterMode)filter);
+	tex->setAddressU(Texture::CLAMP);
+	tex->setAddressV(Texture::CLAMP);
+	if(b->txd)
+		b->txd->add(tex);
+	return tex;
+}
+
+static bool32
+inGroup(AtlasTex *t, Texture *ft)
+{
+	return !t->excluded && t->atlas < 0 && t->image &&
+		t->tex->getFilter() == ft->getFilter() &&
+		t->tex->raster->platform == ft->raster->platform;
+}
+
+// Pack all textures with the same filter and platform as texs[first]
+static void
+packGroup(AtlasBuilder *b, int32 first, stbrp_rect *rects, stbrp_node *nodes)
+{
+	int32 i, n, numPacked;
+	Texture *ft = b->texs[first].tex;
+
+	// Mipmapped atlases keep the textures apart down to the level
+	// where the smallest one is a single texel: rectangles are aligned
+	// to that level and the padding is scaled up to it.
+	// Rectangles are packed in units of the alignment.
+	int32 levels = 0;
+	if(ft->getFilter() >= Texture::MIPNEAREST){
+		int32 minDim = 1<<30;
+		for(i = first; i < b->numTexs; i++){
+			AtlasTex *t = &b->texs[i];
+			if(!inGroup(t, ft))
+				continue;
+			if(t->image->width < minDim) minDim = t->image->width;
+			if(t->image->height < minDim) minDim = t->image->height;
+		}
+		while(2<<levels <= minDim)
+			levels++;
+	}
+	int32 align = 1<<levels;
+	int32 pad = b->params.padding<<levels;
+	int32 maxSize = b->params.maxSize/align;
+
+	n = 0;
+	for(i = first; i < b->numTexs; i++){
+		AtlasTex *t = &b->texs[i];
+		if(!inGroup(t, ft))
+			continue;
+		rects[n].id = i;
+		rects[n].w = (t->image->width + 2*pad + align-1)/align;
+		rects[n].h = (t->image->height + 2*pad + align-1)/align;
+		n++;
+	}
+
+	int32 *members = rwNewT(int32, n, MEMDUR_FUNCTION | ID_TEXTURE);
+	while(n > 1){
+		stbrp_context ctx;
+		stbrp_init_target(&ctx, maxSize, maxSize, nodes, maxSize);
+		stbrp_pack_rects(&ctx, rects, n);
+
+		int32 width = 1, height = 1;
+		int32 numLeft = 0;
+		numPacked = 0;
+		for(i = 0; i < n; i++){
+			if(rects[i].was_packed){
+				AtlasTex *t = &b->texs[rects[i].id];
+				t->x = rects[i].x*align + pad;
+				t->y = rects[i].y*align + pad;
+				members[numPacked++] = rects[i].id;
+				while(width < (rects[i].x + rects[i].w)*align) width *= 2;
+				while(height < (rects[i].y + rects[i].h)*align) height *= 2;
+			}else
+				rects[numLeft++] = rects[i];
+		}
+		n = numLeft;
+		if(numPacked == 0)
+			break;
+		// nothing to gain from an atlas of one
+		if(numPacked < 2){
+			for(i = 0; i < numPacked; i++)
+				b->texs[members[i]].excluded = 1;
+			continue;
+		}
+
+		for(i = 0; i < numPacked; i++)
+			b->texs[members[i]].atlas = b->numAtlases;
+		Texture *atlas = makeAtlas(b, members, numPacked, width, height, pad);
+		if(atlas == nil){
+			for(i = 0; i < numPacked; i++){
+				b->texs[members[i]].atlas = -1;
+				b->texs[members[i]].excluded = 1;
+			}
+			continue;
+		}
+		b->atlases[b->numAtlases++] = atlas;
+	}
+	rwFree(members);
+}
+
+static void
+remapGeometry(AtlasBuilder *b, AtlasGeo *ag)
+{
+	int32 i, j;
+	Geometry *geo = ag->geo;
+	bool32 changed = 0;
+
+	if(ag->owner == nil)
+		return;
+
+	// texture coordinates
+	TexCoords *tc = geo->texCoords[0];
+	for(i = 0; i < geo->numVertices; i++){
+		if(ag->owner[i] < 0)
+			continue;
+		AtlasTex *t = &b->texs[ag->owner[i]];
+		if(t->atlas < 0)
+			continue;
+		Raster *ar = b->atlases[t->atlas]->raster;
+		tc[i].u = (t->x + tc[i].u*t->image->width) / ar->width;
+		tc[i].v = (t->y + tc[i].v*t->image->height) / ar->height;
+		changed = 1;
+	}
+	if(!changed)
+		return;
+	geo->lock(Geometry::LOCKTEXCOORDS);
+
+	// materials
+	for(i = 0; i < geo->matList.numMaterials; i++){
+		Material *mat = geo->matList.materials[i];
+		int32 t = mat->texture ? findTex(b, mat->texture) : -1;
+		if(t >= 0 && b->texs[t].atlas >= 0)
+			mat->setTexture(b->atlases[b->texs[t].atlas]);
+	}
+
+	// merge meshes that now have the same material
+	int32 *map = rwNewT(int32, geo->matList.numMaterials, MEMDUR_FUNCTION | ID_TEXTURE);
+	bool32 merge = 0;
+	for(i = 0; i < geo->matList.numMaterials; i++){
+		map[i] = i;
+		for(j = 0; j < i; j++)
+			if(map[j] == j &&
+			   sameMaterial(geo->matList.materials[i], geo->matList.materials[j])){
+				map[i] = j;
+				merge = 1;
+				break;
+			}
+	}
+	if(merge){
+		if(geo->flags & Geometry::INDEX32)
+			for(i = 0; i < geo->numTriangles; i++)
+				geo->triangles32[i].matId = map[geo->triangles32[i].matId];
+		else
+			for(i = 0; i < geo->numTriangles; i++)
+				geo->triangles[i].matId = map[geo->triangles[i].matId];
+		geo->lock(Geometry::LOCKPOLYGONS);
+		geo->unlock();
+		geo->removeUnusedMaterials();
+	}
+	rwFree(map);
+}
+
+int32
+buildAtlases(Clump *clump, TexDictionary *txd, const AtlasParams *params)
+{
+	int32 i, maxTexs, maxGeos;
+	AtlasBuilder b;
+
+	b.params = params ? *params : defaultAtlasParams;
+	b.txd = txd;
+	b.numTexs = 0;
+	b.numGeos = 0;
+	b.numAtlases = 0;
+
+	maxGeos = clump->countAtomics();
+	maxTexs = 0;
+	FORLIST(lnk, clump->atomics){
+		Atomic *a = Atomic::fromClump(lnk);
+		if(a->geometry)
+			maxTexs += a->geometry->matList.numMaterials;
+	}
+	if(maxTexs < 2)
+		return 0;
+	b.geos = rwNewT(AtlasGeo, maxGeos, MEMDUR_FUNCTION | ID_TEXTURE);
+	b.texs = rwNewT(AtlasTex, maxTexs, MEMDUR_FUNCTION | ID_TEXTURE);
+	b.atlases = rwNewT(Texture*, maxTexs, MEMDUR_FUNCTION | ID_TEXTURE);
+
+	FORLIST(lnk, clump->atomics){
+		Atomic *a = Atomic::fromClump(lnk);
+		if(a->geometry)
+			addGeometry(&b, a->geometry);
+	}
+	for(i = 0; i < b.numGeos; i++)
+		checkGeometry(&b, &b.geos[i]);
+
+	for(i = 0; i < b.numTexs; i++){
+		AtlasTex *t = &b.texs[i];
+		if(t->excluded)
+			continue;
+		t->image = t->tex->raster->toImage();
+		if(t->image == nil){
+			t->excluded = 1;
+			continue;
+		}
+		t->image->convertTo32();
+	}
+
+	stbrp_rect *rects = rwNewT(stbrp_rect, b.numTexs, MEMDUR_FUNCTION | ID_TEXTURE);
+	stbrp_node *nodes = rwNewT(stbrp_node, b.params.maxSize, MEMDUR_FUNCTION | ID_TEXTURE);
+	for(i = 0; i < b.numTexs; i++)
+		if(!b.texs[i].excluded && b.texs[i].atlas < 0 && b.texs[i].image)
+			packGroup(&b, i, rects, nodes);
+	rwFree(rects);
+	rwFree(nodes);
+
+	for(i = 0; i < b.numGeos; i++){
+		remapGeometry(&b, &b.geos[i]);
+		rwFree(b.geos[i].owner);
+	}
+
+	for(i = 0; i < b.numTexs; i++)
+		if(b.texs[i].image)
+			b.texs[i].image->destroy();
+	// materials hold the references now
+	if(txd == nil)
+		for(i = 0; i < b.numAtlases; i++)
+			b.atlases[i]->destroy();
+
+	rwFree(b.geos);
+	rwFree(b.texs);
+	rwFree(b.atlases);
+	return b.numAtlases;
+}
+
+}
@@ -37,6 +37,7 @@ int32 build = 0xFFFF;
 	int32 platform = PLATFORM_NULL;
 #endif
 bool32 streamAppendFrames = 0;
+bool32 streamWeldVertices = 0;
 char *debugFile = nil;
 
 static Matrix identMat = {
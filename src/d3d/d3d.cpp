@@ -86,18 +86,21 @@ int vertFormatMap[] = {
 };
 
 void*
-createIndexBuffer(uint32 length, bool dynamic)
+createIndexBuffer(uint32 length, bool dynamic, bool index32)
 {
 #ifdef RW_D3D9
 	IDirect3DIndexBuffer9 *ibuf;
+	D3DFORMAT format = index32 ? D3DFMT_INDEX32 : D3DFMT_INDEX16;
 	if(dynamic)
-		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY|D3DUSAGE_DYNAMIC, D3DFMT_INDEX16, D3DPOOL_DEFAULT, &ibuf, 0);
+		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY|D3DUSAGE_DYNAMIC, format, D3DPOOL_DEFAULT, &ibuf, 0);
 	else
-		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY, D3DFMT_INDEX16, D3DPOOL_MANAGED, &ibuf, 0);
+		d3ddevice->CreateIndexBuffer(length, D3DUSAGE_WRITEONLY, format, D3DPOOL_MANAGED, &ibuf, 0);
 	if(ibuf)
 		d3d9Globals.numIndexBuffers++;
 	return ibuf;
 #else
+	(void)dynamic;
+	(void)index32;
 	return rwNewT(uint8, length, MEMDUR_EVENT | ID_DRIVER);
 #endif
 }
@@ -188,10 +191,9 @@ lockVertices(void *vertexBuffer, uint32 offset, uint32 size, uint32 flags)
 	vertbuf->Lock(offset, size, (void**)&verts, flags);
 	return verts;
 #else
-	(void)offset;
 	(void)size;
 	(void)flags;
-	return (uint8*)vertexBuffer;
+	return (uint8*)vertexBuffer + offset;
 #endif
 }
 
@@ -406,7 +408,13 @@ rasterSetFormat(Raster *raster)
 	natras->hasAlpha = formatInfoRW[(raster->format >> 8) & 0xF].hasAlpha;
 	raster->stride = raster->width*natras->bpp;
 
+#ifdef RW_D3D9
 	natras->autogenMipmap = (raster->format & (Raster::MIPMAP|Raster::AUTOMIPMAP)) == (Raster::MIPMAP|Raster::AUTOMIPMAP);
+#else
+	// No device to generate them, allocate all levels
+	// and let Raster::setFromImage fill them.
+	natras->autogenMipmap = 0;
+#endif
 }
 
 static Raster*
@@ -728,7 +736,7 @@ rasterFromImage(Raster *raster, Image *image)
 	if((raster->type&0xF) != Raster::TEXTURE)
 		return 0;
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	ConvRowFunc conv = nil;
 
 	// Unpalettize image if necessary but don't change original
 	Image *truecolimg = nil;
@@ -744,38 +752,35 @@ rasterFromImage(Raster *raster, Image *image)
 	D3dRaster *natras = GETD3DRASTEREXT(raster);
 	int32 format = raster->format&(Raster::PAL8 | Raster::PAL4 | 0xF00);
 	switch(image->depth){
+	// C888 is X8R8G8B8, alpha just ends up in X
 	case 32:
-		if(format == Raster::C8888)
-			conv = conv_BGRA8888_from_RGBA8888;
-		else if(format == Raster::C888)
-			conv = conv_BGR888_from_RGB888;
+		if(format == Raster::C8888 || format == Raster::C888)
+			conv = findConvRow(PIXEL_BGRA8888, PIXEL_RGBA8888);
 		else
 			goto err;
 		break;
 	case 24:
-		if(format == Raster::C8888)
-			conv = conv_BGRA8888_from_RGB888;
-		else if(format == Raster::C888)
-			conv = conv_BGR888_from_RGB888;
+		if(format == Raster::C8888 || format == Raster::C888)
+			conv = findConvRow(PIXEL_BGRA8888, PIXEL_RGB888);
 		else
 			goto err;
 		break;
 	case 16:
 		if(format == Raster::C1555)
-			conv = conv_ARGB1555_from_ARGB1555;
+			conv = findConvRow(PIXEL_ARGB1555, PIXEL_ARGB1555);
 		else
 			goto err;
 		break;
 	case 8:
 		if(format == (Raster::PAL8 | Raster::C8888))
-			conv = conv_8_from_8;
+			conv = findConvRow(PIXEL_8, PIXEL_8);
 		else
 			goto err;
 		break;
 	case 4:
 		if(format == (Raster::PAL4 | Raster::C8888) ||
 		   format == (Raster::PAL8 | Raster::C8888))
-			conv = conv_8_from_8;
+			conv = findConvRow(PIXEL_8, PIXEL_8);
 		else
 			goto err;
 		break;
@@ -812,17 +817,11 @@ fprintf(stderr, "%d %x\n", image->depth, format); fflush(stdout);
 	assert(pixels);
 	uint8 *imgpixels = image->pixels;
 
-	int x, y;
+	int y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
 	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(rasrow, imgrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
+		conv(pixels, imgpixels, image->width);
 		imgpixels += image->stride;
 		pixels += raster->stride;
 	}
@@ -884,23 +883,23 @@ rasterToImage(Raster *raster)
 		return image;
 	}
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	ConvRowFunc conv = nil;
 	switch(raster->format & 0xF00){
 	case Raster::C1555:
 		depth = 16;
-		conv = conv_ARGB1555_from_ARGB1555;
+		conv = findConvRow(PIXEL_ARGB1555, PIXEL_ARGB1555);
 		break;
 	case Raster::C8888:
 		depth = 32;
-		conv = conv_RGBA8888_from_BGRA8888;
+		conv = findConvRow(PIXEL_RGBA8888, PIXEL_BGRA8888);
 		break;
 	case Raster::C888:
 		depth = 24;
-		conv = conv_RGB888_from_BGR888;
+		conv = findConvRow(PIXEL_RGB888, PIXEL_BGRA8888);
 		break;
 	case Raster::C555:
 		depth = 16;
-		conv = conv_ARGB1555_from_RGB555;
+		conv = findConvRow(PIXEL_ARGB1555, PIXEL_RGB555);
 		break;
 
 	default:
@@ -918,6 +917,8 @@ rasterToImage(Raster *raster)
 		depth = 8;
 		pallength = 256;
 	}
+	if(pallength)
+		conv = findConvRow(PIXEL_8, PIXEL_8);
 
 	uint8 *in, *out;
 	image = Image::create(raster->width, raster->height, depth);
@@ -936,17 +937,11 @@ rasterToImage(Raster *raster)
 	uint8 *imgpixels = image->pixels;
 	uint8 *pixels = raster->pixels;
 
-	int x, y;
+	int y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
 	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(imgrow, rasrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
+		conv(imgpixels, pixels, image->width);
 		imgpixels += image->stride;
 		pixels += raster->stride;
 	}
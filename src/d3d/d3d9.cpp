@@ -120,6 +120,37 @@ getDeclaration(void *declaration, VertexElement *elements)
 #endif
 }
 
+// 32 bit indices are only used when 16 bits aren't enough,
+// this also tells how they're stored in native data.
+static uint32
+indexSize(InstanceDataHeader *header)
+{
+	return header->totalNumVertex > 0x10000 ? 4 : 2;
+}
+
+template <typename D, typename S> static void
+copyIndices(D *dst, S *src, uint32 numIndices, int32 bias)
+{
+	for(uint32 i = 0; i < numIndices; i++)
+		dst[i] = src[i] + bias;
+}
+
+// Copy indices between index buffer and mesh, adding bias
+static void
+copyIndices(void *dst, bool32 dst32, void *src, bool32 src32, uint32 numIndices, int32 bias)
+{
+	if(bias == 0 && dst32 == src32)
+		memcpy(dst, src, numIndices*(src32 ? 4 : 2));
+	else if(dst32 && src32)
+		copyIndices((uint32*)dst, (uint32*)src, numIndices, bias);
+	else if(dst32)
+		copyIndices((uint32*)dst, (uint16*)src, numIndices, bias);
+	else if(src32)
+		copyIndices((uint16*)dst, (uint32*)src, numIndices, bias);
+	else
+		copyIndices((uint16*)dst, (uint16*)src, numIndices, bias);
+}
+
 void
 freeInstanceData(Geometry *geometry)
 {
@@ -201,9 +232,10 @@ readNativeData(Stream *stream, int32, void *object, int32, int32)
 	header->vertexDeclaration = createVertexDeclaration(elements);
 
 	assert(header->indexBuffer == nil);
-	header->indexBuffer = createIndexBuffer(header->totalNumIndex*2, false);
+	header->indexBuffer = createIndexBuffer(header->totalNumIndex*indexSize(header), false,
+		indexSize(header) == 4);
 	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
-	stream->read8(indices, 2*header->totalNumIndex);
+	stream->read8(indices, indexSize(header)*header->totalNumIndex);
 	unlockIndices(header->indexBuffer);
 
 	VertexStream *s;
@@ -287,7 +319,7 @@ writeNativeData(Stream *stream, int32 len, void *object, int32, int32)
 	stream->write8(elements, 8*numElt);
 
 	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
-	stream->write8(indices, 2*header->totalNumIndex);
+	stream->write8(indices, indexSize(header)*header->totalNumIndex);
 	unlockIndices(header->indexBuffer);
 
 	VertexStream *s;
@@ -324,7 +356,7 @@ getSizeNativeData(void *object, int32, int32)
 	int32 size = 12 + 4 + 4 + 64 + header->numMeshes*36;
 	uint32 numElt = getDeclaration(header->vertexDeclaration, nil);
 	size += 4 + numElt*8;
-	size += 2*header->totalNumIndex;
+	size += indexSize(header)*header->totalNumIndex;
 	size += 0x10 + header->vertexStream[0].stride*header->totalNumVertex;
 	size += 0x10 + header->vertexStream[1].stride*header->totalNumVertex;
 	return size;
@@ -357,15 +389,20 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	header->totalNumIndex = meshh->totalIndices;
 	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 
-	header->indexBuffer = createIndexBuffer(header->totalNumIndex*2, false);
+	uint32 size = indexSize(header);
+	header->indexBuffer = createIndexBuffer(header->totalNumIndex*size, false, size == 4);
 
-	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
+	uint8 *indices = (uint8*)lockIndices(header->indexBuffer, 0, 0, 0);
 	InstanceData *inst = header->inst;
 	Mesh *mesh = meshh->getMeshes();
 	uint32 startindex = 0;
 	for(uint32 i = 0; i < header->numMeshes; i++){
-		findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
-		                          &inst->minVert, (int32*)&inst->numVertices);
+		if(meshh->index32)
+			findMinVertAndNumVertices(mesh->indices32, mesh->numIndices,
+			                          &inst->minVert, (int32*)&inst->numVertices);
+		else
+			findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
+			                          &inst->minVert, (int32*)&inst->numVertices);
 		inst->numIndex = mesh->numIndices;
 		inst->material = mesh->material;
 		inst->vertexAlpha = 0;
@@ -373,11 +410,8 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 		inst->baseIndex = inst->minVert;
 		inst->startIndex = startindex;
 		inst->numPrimitives = header->primType == D3DPT_TRIANGLESTRIP ? inst->numIndex-2 : inst->numIndex/3;
-		if(inst->minVert == 0)
-			memcpy(&indices[inst->startIndex], mesh->indices, inst->numIndex*2);
-		else
-			for(uint32 j = 0; j < inst->numIndex; j++)
-				indices[inst->startIndex+j] = mesh->indices[j] - inst->minVert;
+		copyIndices(indices + inst->startIndex*size, size == 4,
+			mesh->indices, meshh->index32, inst->numIndex, -(int32)inst->minVert);
 		startindex += inst->numIndex;
 		mesh++;
 		inst++;
@@ -429,18 +463,17 @@ uninstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
 	assert(geo->instData->platform == PLATFORM_D3D9);
 	geo->numTriangles = geo->meshHeader->guessNumTriangles();
 	geo->allocateData();
-	geo->allocateMeshes(geo->meshHeader->numMeshes, geo->meshHeader->totalIndices, 0);
+	geo->allocateMeshes(geo->meshHeader->numMeshes, geo->meshHeader->totalIndices, 0,
+		geo->flags & Geometry::INDEX32);
 
 	InstanceDataHeader *header = (InstanceDataHeader*)geo->instData;
-	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
+	uint32 size = indexSize(header);
+	uint8 *indices = (uint8*)lockIndices(header->indexBuffer, 0, 0, 0);
 	InstanceData *inst = header->inst;
 	Mesh *mesh = geo->meshHeader->getMeshes();
 	for(uint32 i = 0; i < header->numMeshes; i++){
-		if(inst->minVert == 0)
-			memcpy(mesh->indices, &indices[inst->startIndex], inst->numIndex*2);
-		else
-			for(uint32 j = 0; j < inst->numIndex; j++)
-				mesh->indices[j] = indices[inst->startIndex+j] + inst->minVert;
+		copyIndices(mesh->indices, geo->meshHeader->index32,
+			indices + inst->startIndex*size, size == 4, inst->numIndex, inst->minVert);
 		mesh++;
 		inst++;
 	}
@@ -582,56 +615,73 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	}else
 		getDeclaration(header->vertexDeclaration, dcl);
 
-	uint8 *verts = lockVertices(s->vertexBuffer, 0, 0, D3DLOCK_NOSYSLOCK);
+	// Only lock the vertices that changed
+	int32 lockFirst, first, n;
+	int32 numLocked = getInstanceRange(geo, Geometry::LOCKALL, reinstance, header->totalNumVertex, &lockFirst);
+	if(numLocked == 0)
+		return;
+	uint8 *verts = lockVertices(s->vertexBuffer, lockFirst*s->stride, numLocked*s->stride, D3DLOCK_NOSYSLOCK);
 
 	// Instance vertices
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	n = getInstanceRange(geo, Geometry::LOCKVERTICES, reinstance, header->totalNumVertex, &first);
+	if(n){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_POSITION || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset + (first-lockFirst)*s->stride,
+			geo->morphTargets[0].vertices + first,
+			n, s->stride);
 	}
 
 	// Instance prelight colors
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	n = getInstanceRange(geo, Geometry::LOCKPRELIGHT, reinstance, header->totalNumVertex, &first);
+	if(isPrelit && n){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_COLOR || dcl[i].usageIndex != 0; i++)
 			;
+		int32 end = first + n;
 		InstanceData *inst = header->inst;
-		uint32 n = header->numMeshes;
-		while(n--){
-			uint32 stride = header->vertexStream[dcl[i].stream].stride;
-			inst->vertexAlpha = instColor(vertFormatMap[dcl[i].type],
-				verts + dcl[i].offset + stride*inst->minVert,
-				geo->colors + inst->minVert,
-				inst->numVertices,
-				stride);
+		uint32 m = header->numMeshes;
+		while(m--){
+			// only the part of the mesh that changed
+			int32 vs = first > (int32)inst->minVert ? first : inst->minVert;
+			int32 ve = end < (int32)(inst->minVert+inst->numVertices) ? end : inst->minVert+inst->numVertices;
+			if(vs < ve){
+				bool32 alpha = instColor(vertFormatMap[dcl[i].type],
+					verts + dcl[i].offset + (vs-lockFirst)*s->stride,
+					geo->colors + vs,
+					ve - vs,
+					s->stride);
+				// can't know about the rest after a partial update
+				if(ve - vs == (int32)inst->numVertices)
+					inst->vertexAlpha = alpha;
+				else
+					inst->vertexAlpha |= alpha;
+			}
 			inst++;
 		}
 	}
 
 	// Instance tex coords
-	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != n; i++)
+	for(int32 t = 0; t < geo->numTexCoordSets; t++){
+		n = getInstanceRange(geo, Geometry::LOCKTEXCOORDS<<t, reinstance, header->totalNumVertex, &first);
+		if(n){
+			for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != t; i++)
 				;
-			instTexCoords(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-				geo->texCoords[n],
-				header->totalNumVertex,
-				header->vertexStream[dcl[i].stream].stride);
+			instTexCoords(vertFormatMap[dcl[i].type], verts + dcl[i].offset + (first-lockFirst)*s->stride,
+				geo->texCoords[t] + first,
+				n, s->stride);
 		}
 	}
 
 	// Instance normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	n = getInstanceRange(geo, Geometry::LOCKNORMALS, reinstance, header->totalNumVertex, &first);
+	if(hasNormals && n){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_NORMAL || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset + (first-lockFirst)*s->stride,
+			geo->morphTargets[0].normals + first,
+			n, s->stride);
 	}
+
 	unlockVertices(s->vertexBuffer);
 }
 
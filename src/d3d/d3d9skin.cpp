@@ -149,55 +149,71 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		getDeclaration(header->vertexDeclaration, dcl);
 
 	Skin *skin = Skin::get(geo);
-	uint8 *verts = lockVertices(s->vertexBuffer, 0, 0, D3DLOCK_NOSYSLOCK);
+	// Only lock the vertices that changed
+	int32 lockFirst, first, n;
+	int32 numLocked = getInstanceRange(geo, Geometry::LOCKALL, reinstance, header->totalNumVertex, &lockFirst);
+	if(numLocked == 0)
+		return;
+	uint8 *verts = lockVertices(s->vertexBuffer, lockFirst*s->stride, numLocked*s->stride, D3DLOCK_NOSYSLOCK);
 
 	// Instance vertices
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	n = getInstanceRange(geo, Geometry::LOCKVERTICES, reinstance, header->totalNumVertex, &first);
+	if(n){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_POSITION || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset + (first-lockFirst)*s->stride,
+			geo->morphTargets[0].vertices + first,
+			n, s->stride);
 	}
 
 	// Instance prelight colors
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	n = getInstanceRange(geo, Geometry::LOCKPRELIGHT, reinstance, header->totalNumVertex, &first);
+	if(isPrelit && n){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_COLOR || dcl[i].usageIndex != 0; i++)
 			;
+		int32 end = first + n;
 		InstanceData *inst = header->inst;
-		uint32 n = header->numMeshes;
-		while(n--){
-			uint32 stride = header->vertexStream[dcl[i].stream].stride;
-			inst->vertexAlpha = instColor(vertFormatMap[dcl[i].type],
-				verts + dcl[i].offset + stride*inst->minVert,
-				geo->colors + inst->minVert,
-				inst->numVertices,
-				stride);
+		uint32 m = header->numMeshes;
+		while(m--){
+			// only the part of the mesh that changed
+			int32 vs = first > (int32)inst->minVert ? first : inst->minVert;
+			int32 ve = end < (int32)(inst->minVert+inst->numVertices) ? end : inst->minVert+inst->numVertices;
+			if(vs < ve){
+				bool32 alpha = instColor(vertFormatMap[dcl[i].type],
+					verts + dcl[i].offset + (vs-lockFirst)*s->stride,
+					geo->colors + vs,
+					ve - vs,
+					s->stride);
+				// can't know about the rest after a partial update
+				if(ve - vs == (int32)inst->numVertices)
+					inst->vertexAlpha = alpha;
+				else
+					inst->vertexAlpha |= alpha;
+			}
 			inst++;
 		}
 	}
 
 	// Instance tex coords
-	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != n; i++)
+	for(int32 t = 0; t < geo->numTexCoordSets; t++){
+		n = getInstanceRange(geo, Geometry::LOCKTEXCOORDS<<t, reinstance, header->totalNumVertex, &first);
+		if(n){
+			for(i = 0; dcl[i].usage != D3DDECLUSAGE_TEXCOORD || dcl[i].usageIndex != t; i++)
 				;
-			instTexCoords(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-				geo->texCoords[n],
-				header->totalNumVertex,
-				header->vertexStream[dcl[i].stream].stride);
+			instTexCoords(vertFormatMap[dcl[i].type], verts + dcl[i].offset + (first-lockFirst)*s->stride,
+				geo->texCoords[t] + first,
+				n, s->stride);
 		}
 	}
 
 	// Instance normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	n = getInstanceRange(geo, Geometry::LOCKNORMALS, reinstance, header->totalNumVertex, &first);
+	if(hasNormals && n){
 		for(i = 0; dcl[i].usage != D3DDECLUSAGE_NORMAL || dcl[i].usageIndex != 0; i++)
 			;
-		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex,
-			header->vertexStream[dcl[i].stream].stride);
+		instV3d(vertFormatMap[dcl[i].type], verts + dcl[i].offset + (first-lockFirst)*s->stride,
+			geo->morphTargets[0].normals + first,
+			n, s->stride);
 	}
 
 	// Instance skin weights
@@ -237,30 +253,12 @@ uploadSkinMatrices(Atomic *a)
 	int i;
 	Skin *skin = Skin::get(a->geometry);
 	float *m = skinMatrices;
-	HAnimHierarchy *hier = Skin::getHierarchy(a);
-
-	if(hier){
-		Matrix *invMats = (Matrix*)skin->inverseMatrices;
-		Matrix tmp, tmp2;
-
-		assert(skin->numBones == hier->numNodes);
-		if(hier->flags & HAnimHierarchy::LOCALSPACEMATRICES){
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(&tmp, &invMats[i], &hier->matrices[i]);
-				RawMatrix::transpose((RawMatrix*)m, (RawMatrix*)&tmp);
-				m += 12;
-			}
-		}else{
-			Matrix invAtmMat;
-			Matrix::invert(&invAtmMat, a->getFrame()->getLTM());
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(&tmp, &hier->matrices[i], &invAtmMat);
-				Matrix::mult(&tmp2, &invMats[i], &tmp);
-				RawMatrix::transpose((RawMatrix*)m, (RawMatrix*)&tmp2);
-				m += 12;
-			}
+	Matrix *palette = Skin::getPalette(a);
+
+	if(palette){
+		for(i = 0; i < skin->numBones; i++){
+			RawMatrix::transpose((RawMatrix*)m, (RawMatrix*)&palette[i]);
+			m += 12;
 		}
 	}else{
 		for(i = 0; i < skin->numBones; i++){
@@ -246,7 +246,7 @@ enum {
 
 extern int vertFormatMap[];
 
-void *createIndexBuffer(uint32 length, bool dynamic);
+void *createIndexBuffer(uint32 length, bool dynamic, bool index32 = false);
 void destroyIndexBuffer(void *indexBuffer);
 uint16 *lockIndices(void *indexBuffer, uint32 offset, uint32 size, uint32 flags);
 void unlockIndices(void *indexBuffer);
@@ -657,6 +657,64 @@ rasterNumLevels(Raster *raster)
 	return levels->numlevels;
 }
 
+struct UnswizzleJob
+{
+	uint8 *dst;
+	uint8 *src;
+	int32 w, h;
+	int32 bpp;
+	uint32 *utab;	// swizzled offsets of each column
+	uint32 *vtab;	// and of each row
+};
+
+enum { UNSWIZZLE_ROWS = 32 };
+
+static void
+unswizzleRows(int32 n, void *data)
+{
+	UnswizzleJob *job = (UnswizzleJob*)data;
+	int32 x, y;
+	int32 w = job->w;
+	int32 y0 = n*UNSWIZZLE_ROWS;
+	int32 y1 = y0+UNSWIZZLE_ROWS;
+	if(y1 > job->h)
+		y1 = job->h;
+	uint32 *utab = job->utab;
+	for(y = y0; y < y1; y++){
+		uint32 v = job->vtab[y];
+		switch(job->bpp){
+		case 1: {
+			uint8 *d = job->dst + y*w;
+			uint8 *s = job->src;
+			for(x = 0; x < w; x++)
+				d[x] = s[utab[x]|v];
+			break;
+		}
+		case 2: {
+			uint16 *d = (uint16*)job->dst + y*w;
+			uint16 *s = (uint16*)job->src;
+			for(x = 0; x < w; x++)
+				d[x] = s[utab[x]|v];
+			break;
+		}
+		case 4: {
+			uint32 *d = (uint32*)job->dst + y*w;
+			uint32 *s = (uint32*)job->src;
+			for(x = 0; x < w; x++)
+				d[x] = s[utab[x]|v];
+			break;
+		}
+		default: {
+			int32 bpp = job->bpp;
+			uint8 *d = job->dst + y*w*bpp;
+			for(x = 0; x < w; x++)
+				memcpy(&d[x*bpp], &job->src[(utab[x]|v)*bpp], bpp);
+			break;
+		}
+		}
+	}
+}
+
 static void
 unswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp)
 {
@@ -679,16 +737,35 @@ unswizzle(uint8 *dst, uint8 *src, int32 w, int32 h, int32 bpp)
 		}
 		i <<= 1;
 	}while(c);
-	int32 x, y, u, v;
-	v = 0;
-	for(y = 0; y < h; y++){
-		u = 0;
-		for(x = 0; x < w; x++){
-			memcpy(&dst[(y*w + x)*bpp], &src[(u|v)*bpp], bpp);
-			u = (u - maskU) & maskU;
-		}
+
+	// The interleaved offsets of rows and columns are independent,
+	// so compute them once and OR them together per pixel.
+	UnswizzleJob job;
+	job.dst = dst;
+	job.src = src;
+	job.w = w;
+	job.h = h;
+	job.bpp = bpp;
+	job.utab = rwNewT(uint32, w+h, MEMDUR_FUNCTION | ID_RASTERXBOX);
+	job.vtab = job.utab + w;
+	uint32 u = 0;
+	for(i = 0; i < w; i++){
+		job.utab[i] = u;
+		u = (u - maskU) & maskU;
+	}
+	uint32 v = 0;
+	for(i = 0; i < h; i++){
+		job.vtab[i] = v;
 		v = (v - maskV) & maskV;
 	}
+
+	int32 numJobs = (h + UNSWIZZLE_ROWS-1)/UNSWIZZLE_ROWS;
+	if(w*h >= 256*256)
+		runJobs(unswizzleRows, numJobs, &job);
+	else
+		for(i = 0; i < numJobs; i++)
+			unswizzleRows(i, &job);
+	rwFree(job.utab);
 }
 
 Image*
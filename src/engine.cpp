@@ -343,6 +343,7 @@ Engine::close(void)
 		return;
 	}
 
+	closeJobs();
 	engine->device.system(DEVICECLOSE, nil, 0);
 	for(uint i = 0; i < NUM_PLATFORMS; i++)
 		rwFree(rw::engine->driver[i]);
@@ -6,7 +6,12 @@
 
 namespace rw {
 
+// every thread has its own, jobs may run into errors too
+#ifdef RW_PS2
 static Error error;
+#else
+static thread_local Error error;
+#endif
 
 void
 setError(Error *e)
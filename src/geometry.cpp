@@ -11,6 +11,13 @@
 #include "rwobjects.h"
 #include "rwengine.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
 #define PLUGIN_ID ID_GEOMETRY
 
 namespace rw {
@@ -46,18 +53,20 @@ Geometry::create(int32 numVerts, int32 numTris, uint32 flags)
 	for(int32 i = 0; i < 8; i++)
 		geo->texCoords[i] = nil;
 	geo->triangles = nil;
+	geo->triangles32 = nil;
 	// Allocate all attributes at once. The triangle pointer
 	// will hold the first address (even when there are no triangles)
 	// so we can free easily.
 	if(!(geo->flags & NATIVE)){
-		int32 sz = geo->numTriangles*sizeof(Triangle);
+		int32 numTris16 = geo->flags & INDEX32 ? 0 : geo->numTriangles;
+		int32 sz = numTris16*sizeof(Triangle);
 		if(geo->flags & PRELIT)
 			sz += geo->numVertices*sizeof(RGBA);
 		sz += geo->numTexCoordSets*geo->numVertices*sizeof(TexCoords);
 
 		uint8 *data = (uint8*)rwNew(sz, MEMDUR_EVENT | ID_GEOMETRY);
 		geo->triangles = (Triangle*)data;
-		data += geo->numTriangles*sizeof(Triangle);
+		data += numTris16*sizeof(Triangle);
 		if(geo->flags & PRELIT && geo->numVertices){
 			geo->colors = (RGBA*)data;
 			data += geo->numVertices*sizeof(RGBA);
@@ -69,8 +78,13 @@ Geometry::create(int32 numVerts, int32 numTris, uint32 flags)
 			}
 
 		// init triangles
-		for(int32 i = 0; i < geo->numTriangles; i++)
+		for(int32 i = 0; i < numTris16; i++)
 			geo->triangles[i].matId = 0xFFFF;
+		if(geo->flags & INDEX32){
+			geo->triangles32 = rwNewT(Triangle32, geo->numTriangles, MEMDUR_EVENT | ID_GEOMETRY);
+			for(int32 i = 0; i < geo->numTriangles; i++)
+				geo->triangles32[i].matId = 0xFFFF;
+		}
 	}
 	geo->numMorphTargets = 0;
 	geo->morphTargets = nil;
@@ -94,6 +108,7 @@ Geometry::destroy(void)
 		s_plglist.destruct(this);
 		// Also frees colors and tex coords
 		rwFree(this->triangles);
+		rwFree(this->triangles32);
 		// Also frees their data
 		rwFree(this->morphTargets);
 		// Also frees indices
@@ -107,13 +122,56 @@ Geometry::destroy(void)
 void
 Geometry::lock(int32 lockFlags)
 {
-	lockedSinceInst |= lockFlags;
+	this->lockRange(lockFlags, 0, this->numVertices);
+}
+
+// Lock only vertices [first, first+num) of the vertex attributes,
+// so reinstancing only has to update those. Polygons are always
+// locked as a whole.
+void
+Geometry::lockRange(int32 lockFlags, int32 first, int32 num)
+{
+	int32 end = first + num;
+	for(int32 i = 1; i < 12; i++){
+		if((lockFlags & (1<<i)) == 0)
+			continue;
+		LockedRange *r = &this->lockedRanges[i];
+		if(this->lockedSinceInst & (1<<i)){
+			if(first < r->first) r->first = first;
+			if(end > r->end) r->end = end;
+		}else{
+			r->first = first;
+			r->end = end;
+		}
+	}
+	this->lockedSinceInst |= lockFlags;
 	if(lockFlags & LOCKPOLYGONS){
 		rwFree(this->meshHeader);
 		this->meshHeader = nil;
 	}
 }
 
+// Union of the vertex ranges of the attributes in lockFlags
+// locked since instancing, returns the number of vertices.
+int32
+Geometry::getLockedRange(int32 lockFlags, int32 *first)
+{
+	int32 start = this->numVertices;
+	int32 end = 0;
+	lockFlags &= this->lockedSinceInst;
+	for(int32 i = 1; i < 12; i++)
+		if(lockFlags & (1<<i)){
+			if(this->lockedRanges[i].first < start)
+				start = this->lockedRanges[i].first;
+			if(this->lockedRanges[i].end > end)
+				end = this->lockedRanges[i].end;
+		}
+	if(start < 0) start = 0;
+	if(end > this->numVertices) end = this->numVertices;
+	*first = start;
+	return end > start ? end - start : 0;
+}
+
 void
 Geometry::unlock(void)
 {
@@ -144,6 +202,8 @@ Geometry::streamRead(Stream *stream)
 		return nil;
 	}
 	stream->read32(&buf, sizeof(buf));
+	// only the Index32 plugin can set this
+	buf.flags &= ~INDEX32;
 	Geometry *geo = Geometry::create(buf.numVertices,
 	                                 buf.numTriangles, buf.flags);
 	if(geo == nil)
@@ -191,8 +251,11 @@ Geometry::streamRead(Stream *stream)
 		defaultSurfaceProps = reset;
 	if(ret == nil)
 		goto fail;
-	if(s_plglist.streamRead(stream, geo))
+	if(s_plglist.streamRead(stream, geo)){
+		if(streamWeldVertices)
+			geo->weldVertices();
 		return geo;
+	}
 
 fail:
 	geo->destroy();
@@ -211,7 +274,8 @@ geoStructSize(Geometry *geo)
 			size += 4*geo->numVertices;
 		for(int32 i = 0; i < geo->numTexCoordSets; i++)
 			size += 2*geo->numVertices*4;
-		size += 4*geo->numTriangles*2;
+		if(!(geo->flags & Geometry::INDEX32))
+			size += 4*geo->numTriangles*2;
 	}
 	for(int32 i = 0; i < geo->numMorphTargets; i++){
 		MorphTarget *m = &geo->morphTargets[i];
@@ -235,8 +299,9 @@ Geometry::streamWrite(Stream *stream)
 	writeChunkHeader(stream, ID_GEOMETRY, this->streamGetSize());
 	writeChunkHeader(stream, ID_STRUCT, geoStructSize(this));
 
-	buf.flags = this->flags | this->numTexCoordSets << 16;
-	buf.numTriangles = this->numTriangles;
+	buf.flags = (this->flags & ~INDEX32) | this->numTexCoordSets << 16;
+	// INDEX32 triangles are written by the Index32 plugin
+	buf.numTriangles = this->flags & INDEX32 ? 0 : this->numTriangles;
 	buf.numVertices = this->numVertices;
 	buf.numMorphTargets = this->numMorphTargets;
 	stream->write32(&buf, sizeof(buf));
@@ -249,7 +314,7 @@ Geometry::streamWrite(Stream *stream)
 		for(int32 i = 0; i < this->numTexCoordSets; i++)
 			stream->write32(this->texCoords[i],
 				    2*this->numVertices*4);
-		for(int32 i = 0; i < this->numTriangles; i++){
+		for(int32 i = 0; i < buf.numTriangles; i++){
 			uint32 tribuf[2];
 			tribuf[0] = this->triangles[i].v[0] << 16 |
 			            this->triangles[i].v[1];
@@ -376,16 +441,23 @@ Geometry::allocateData(void)
 {
 	// Geometry data
 	// Pretty much copy pasted from ::create above
-	int32 sz = this->numTriangles*sizeof(Triangle);
+	int32 numTris16 = this->flags & INDEX32 ? 0 : this->numTriangles;
+	int32 sz = numTris16*sizeof(Triangle);
 	if(this->flags & PRELIT)
 		sz += this->numVertices*sizeof(RGBA);
 	sz += this->numTexCoordSets*this->numVertices*sizeof(TexCoords);
 
 	uint8 *data = (uint8*)rwNew(sz, MEMDUR_EVENT | ID_GEOMETRY);
 	this->triangles = (Triangle*)data;
-	data += this->numTriangles*sizeof(Triangle);
-	for(int32 i = 0; i < this->numTriangles; i++)
+	data += numTris16*sizeof(Triangle);
+	for(int32 i = 0; i < numTris16; i++)
 		this->triangles[i].matId = 0xFFFF;
+	if(this->flags & INDEX32){
+		rwFree(this->triangles32);
+		this->triangles32 = rwNewT(Triangle32, this->numTriangles, MEMDUR_EVENT | ID_GEOMETRY);
+		for(int32 i = 0; i < this->numTriangles; i++)
+			this->triangles32[i].matId = 0xFFFF;
+	}
 	if(this->flags & PRELIT){
 		this->colors = (RGBA*)data;
 		data += this->numVertices*sizeof(RGBA);
@@ -421,12 +493,55 @@ Geometry::allocateData(void)
 	}
 }
 
+static uint32
+getIndex(MeshHeader *header, Mesh *m, uint32 j)
+{
+	return header->index32 ? m->indices32[j] : m->indices[j];
+}
+
 static int
-isDegenerate(uint16 *idx)
+isDegenerate(MeshHeader *header, Mesh *m, uint32 j)
 {
-	return idx[0] == idx[1] ||
-	       idx[0] == idx[2] ||
-	       idx[1] == idx[2];
+	uint32 a = getIndex(header, m, j);
+	uint32 b = getIndex(header, m, j+1);
+	uint32 c = getIndex(header, m, j+2);
+	return a == b || a == c || b == c;
+}
+
+template <typename T> static void
+fillTriangles(MeshHeader *header, MaterialList *matList, T *tri, int8 *adc)
+{
+	Mesh *m = header->getMeshes();
+	int8 *adcbits = adc;
+	for(uint32 i = 0; i < header->numMeshes; i++){
+		if(m->numIndices < 3){
+			adcbits += m->numIndices;
+			m++;
+			continue;
+		}
+		int32 matid = matList->findIndex(m->material);
+		if(header->flags == MeshHeader::TRISTRIP)
+			for(uint32 j = 0; j < m->numIndices-2; j++){
+				if((adc && adcbits[j+2]) ||
+				   isDegenerate(header, m, j))
+					continue;
+				tri->v[0] = getIndex(header, m, j+0);
+				tri->v[1] = getIndex(header, m, j+1 + (j%2));
+				tri->v[2] = getIndex(header, m, j+2 - (j%2));
+				tri->matId = matid;
+				tri++;
+			}
+		else
+			for(uint32 j = 0; j < m->numIndices-2; j+=3){
+				tri->v[0] = getIndex(header, m, j+0);
+				tri->v[1] = getIndex(header, m, j+1);
+				tri->v[2] = getIndex(header, m, j+2);
+				tri->matId = matid;
+				tri++;
+			}
+		adcbits += m->numIndices;
+		m++;
+	}
 }
 
 // This functions assumes there is enough space allocated
@@ -451,7 +566,7 @@ Geometry::generateTriangles(int8 *adc)
 		if(header->flags == MeshHeader::TRISTRIP){
 			for(uint32 j = 0; j < m->numIndices-2; j++){
 				if(!(adc && adcbits[j+2]) &&
-				   !isDegenerate(&m->indices[j]))
+				   !isDegenerate(header, m, j))
 					this->numTriangles++;
 			}
 		}else
@@ -460,38 +575,10 @@ Geometry::generateTriangles(int8 *adc)
 		m++;
 	}
 
-	Triangle *tri = this->triangles;
-	m = header->getMeshes();
-	adcbits = adc;
-	for(uint32 i = 0; i < header->numMeshes; i++){
-		if(m->numIndices < 3){
-			adcbits += m->numIndices;
-			m++;
-			continue;
-		}
-		int32 matid = this->matList.findIndex(m->material);
-		if(header->flags == MeshHeader::TRISTRIP)
-			for(uint32 j = 0; j < m->numIndices-2; j++){
-				if((adc && adcbits[j+2]) ||
-				   isDegenerate(&m->indices[j]))
-					continue;
-				tri->v[0] = m->indices[j+0];
-				tri->v[1] = m->indices[j+1 + (j%2)];
-				tri->v[2] = m->indices[j+2 - (j%2)];
-				tri->matId = matid;
-				tri++;
-			}
-		else
-			for(uint32 j = 0; j < m->numIndices-2; j+=3){
-				tri->v[0] = m->indices[j+0];
-				tri->v[1] = m->indices[j+1];
-				tri->v[2] = m->indices[j+2];
-				tri->matId = matid;
-				tri++;
-			}
-		adcbits += m->numIndices;
-		m++;
-	}
+	if(this->flags & INDEX32)
+		fillTriangles(header, &this->matList, this->triangles32, adc);
+	else
+		fillTriangles(header, &this->matList, this->triangles, adc);
 }
 
 static void
@@ -510,10 +597,40 @@ dumpMesh(Mesh *m)
 				m->indices[i+2]);
 }
 
+template <typename T, typename I> static void
+fillMeshes(Mesh *mesh, int32 numMeshes, T *tri, int32 numTris, I *indices)
+{
+	for(int32 i = 0; i < numMeshes; i++){
+		mesh[i].indices = (uint16*)indices;
+		indices += mesh[i].numIndices;
+		mesh[i].numIndices = 0;
+	}
+	for(int32 i = 0; i < numTris; i++){
+		Mesh *m = &mesh[tri->matId];
+		I *ind = (I*)m->indices + m->numIndices;
+		ind[0] = tri->v[0];
+		ind[1] = tri->v[1];
+		ind[2] = tri->v[2];
+		m->numIndices += 3;
+		tri++;
+	}
+}
+
+template <typename T> static void
+countIndices(int32 *numIndices, int32 numMeshes, T *tri, int32 numTris)
+{
+	memset(numIndices, 0, numMeshes*sizeof(int32));
+	for(int32 i = 0; i < numTris; i++){
+		assert(tri->matId < numMeshes);
+		numIndices[tri->matId] += 3;
+		tri++;
+	}
+}
+
+// INDEX32 geometries always get triangle lists
 void
 Geometry::buildMeshes(void)
 {
-	Triangle *tri;
 	Mesh *mesh;
 
 	if(this->flags & Geometry::NATIVE){
@@ -524,40 +641,35 @@ Geometry::buildMeshes(void)
 	rwFree(this->meshHeader);
 	this->meshHeader = nil;
 	int32 numMeshes = this->matList.numMaterials;
-	if((this->flags & Geometry::TRISTRIP) == 0){
+	bool32 index32 = this->flags & Geometry::INDEX32;
+	if((this->flags & Geometry::TRISTRIP) == 0 || index32){
+		if(buildMeshesCacheSize > 0)
+			this->optimizeTriangleOrder(buildMeshesCacheSize, buildMeshesOverdraw);
+
+		// count indices per mesh
 		int32 *numIndices = rwNewT(int32, numMeshes,
 			MEMDUR_FUNCTION | ID_GEOMETRY);
-		memset(numIndices, 0, numMeshes*sizeof(int32));
+		if(index32)
+			countIndices(numIndices, numMeshes, this->triangles32, this->numTriangles);
+		else
+			countIndices(numIndices, numMeshes, this->triangles, this->numTriangles);
 
-		// count indices per mesh
-		tri = this->triangles;
-		for(int32 i = 0; i < this->numTriangles; i++){
-			assert(tri->matId < numMeshes);
-			numIndices[tri->matId] += 3;
-			tri++;
-		}
 		// setup meshes
-		this->allocateMeshes(numMeshes, this->numTriangles*3, 0);
+		this->allocateMeshes(numMeshes, this->numTriangles*3, 0, index32);
 		mesh = this->meshHeader->getMeshes();
 		for(int32 i = 0; i < numMeshes; i++){
 			mesh[i].material = this->matList.materials[i];
 			mesh[i].numIndices = numIndices[i];
 		}
-		this->meshHeader->setupIndices();
 		rwFree(numIndices);
 
 		// now fill in the indices
-		for(int32 i = 0; i < numMeshes; i++)
-			mesh[i].numIndices = 0;
-		tri = this->triangles;
-		for(int32 i = 0; i < this->numTriangles; i++){
-			uint32 idx = mesh[tri->matId].numIndices;
-			mesh[tri->matId].indices[idx++] = tri->v[0];
-			mesh[tri->matId].indices[idx++] = tri->v[1];
-			mesh[tri->matId].indices[idx++] = tri->v[2];
-			mesh[tri->matId].numIndices = idx;
-			tri++;
-		}
+		if(index32)
+			fillMeshes(mesh, numMeshes, this->triangles32, this->numTriangles,
+				(uint32*)&mesh[numMeshes]);
+		else
+			fillMeshes(mesh, numMeshes, this->triangles, this->numTriangles,
+				(uint16*)&mesh[numMeshes]);
 	}else
 		this->buildTristrips();
 }
@@ -570,7 +682,7 @@ Geometry::correctTristripWinding(void)
 {
 	MeshHeader *header = this->meshHeader;
 	if(this->flags & NATIVE || header == nil ||
-	   header->flags != MeshHeader::TRISTRIP)
+	   header->flags != MeshHeader::TRISTRIP || header->index32)
 		return;
 	this->meshHeader = nil;
 	// Allocate no indices, we realloc later
@@ -655,7 +767,7 @@ Geometry::removeUnusedMaterials(void)
 
 	/* Build new meshes */
 	this->meshHeader = nil;
-	MeshHeader *newmh = this->allocateMeshes(numMaterials, mh->totalIndices, 0);
+	MeshHeader *newmh = this->allocateMeshes(numMaterials, mh->totalIndices, 0, mh->index32);
 	newmh->flags = mh->flags;
 	Mesh *newm = newmh->getMeshes();
 	for(uint32 i = 0; i < mh->numMeshes; i++){
@@ -672,36 +784,209 @@ Geometry::removeUnusedMaterials(void)
 		if(m[i].numIndices <= 0)
 			continue;
 		memcpy(newm->indices, m[i].indices,
-		       m[i].numIndices*sizeof(*m[i].indices));
+		       m[i].numIndices*mh->indexSize());
 		newm++;
 	}
 	rwFree(mh);
 
 	/* Remap triangle material IDs */
-	for(int32 i = 0; i < this->numTriangles; i++)
-		this->triangles[i].matId = map[this->triangles[i].matId];
+	if(this->flags & INDEX32)
+		for(int32 i = 0; i < this->numTriangles; i++)
+			this->triangles32[i].matId = map[this->triangles32[i].matId];
+	else
+		for(int32 i = 0; i < this->numTriangles; i++)
+			this->triangles[i].matId = map[this->triangles[i].matId];
 	rwFree(map);
 }
 
+// Index of the point farthest from c, its squared distance in maxDist2
+static int32
+findFarthest(const V3d *v, int32 n, V3d c, float32 *maxDist2)
+{
+	int32 i = 0;
+	int32 best = 0;
+	float32 bestDist2 = -1.0f;
+#if defined(RW_SSE2)
+	if(n >= 4){
+		RWALIGN(16) float32 dists[4];
+		RWALIGN(16) int32 indices[4];
+		__m128 cx = _mm_set1_ps(c.x);
+		__m128 cy = _mm_set1_ps(c.y);
+		__m128 cz = _mm_set1_ps(c.z);
+		__m128 bestv = _mm_set1_ps(-1.0f);
+		__m128i besti = _mm_setzero_si128();
+		__m128i idx = _mm_set_epi32(3, 2, 1, 0);
+		const __m128i four = _mm_set1_epi32(4);
+		for(; i+4 <= n; i += 4){
+			// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+			const float32 *p = &v[i].x;
+			__m128 a = _mm_loadu_ps(p);
+			__m128 b = _mm_loadu_ps(p+4);
+			__m128 d = _mm_loadu_ps(p+8);
+			__m128 t = _mm_shuffle_ps(b, d, _MM_SHUFFLE(0, 1, 0, 2));
+			__m128 x = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 3, 0));
+			__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1)),
+				_mm_shuffle_ps(b, d, _MM_SHUFFLE(0, 2, 0, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 1, 0, 2)),
+				_mm_shuffle_ps(d, d, _MM_SHUFFLE(0, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+			x = _mm_sub_ps(x, cx);
+			y = _mm_sub_ps(y, cy);
+			z = _mm_sub_ps(z, cz);
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+			__m128i gt = _mm_castps_si128(_mm_cmpgt_ps(d2, bestv));
+			bestv = _mm_max_ps(d2, bestv);
+			besti = _mm_or_si128(_mm_and_si128(gt, idx), _mm_andnot_si128(gt, besti));
+			idx = _mm_add_epi32(idx, four);
+		}
+		_mm_store_ps(dists, bestv);
+		_mm_store_si128((__m128i*)indices, besti);
+		for(int32 j = 0; j < 4; j++)
+			if(dists[j] > bestDist2 || (dists[j] == bestDist2 && indices[j] < best)){
+				bestDist2 = dists[j];
+				best = indices[j];
+			}
+	}
+#elif defined(RW_NEON)
+	if(n >= 4){
+		float32 dists[4];
+		uint32 indices[4];
+		float32x4_t cx = vdupq_n_f32(c.x);
+		float32x4_t cy = vdupq_n_f32(c.y);
+		float32x4_t cz = vdupq_n_f32(c.z);
+		float32x4_t bestv = vdupq_n_f32(-1.0f);
+		uint32x4_t besti = vdupq_n_u32(0);
+		const uint32 start[4] = { 0, 1, 2, 3 };
+		uint32x4_t idx = vld1q_u32(start);
+		const uint32x4_t four = vdupq_n_u32(4);
+		for(; i+4 <= n; i += 4){
+			float32x4x3_t p = vld3q_f32(&v[i].x);
+			float32x4_t x = vsubq_f32(p.val[0], cx);
+			float32x4_t y = vsubq_f32(p.val[1], cy);
+			float32x4_t z = vsubq_f32(p.val[2], cz);
+			float32x4_t d2 = vmlaq_f32(vmlaq_f32(vmulq_f32(x, x), y, y), z, z);
+			uint32x4_t gt = vcgtq_f32(d2, bestv);
+			bestv = vmaxq_f32(d2, bestv);
+			besti = vbslq_u32(gt, idx, besti);
+			idx = vaddq_u32(idx, four);
+		}
+		vst1q_f32(dists, bestv);
+		vst1q_u32(indices, besti);
+		for(int32 j = 0; j < 4; j++)
+			if(dists[j] > bestDist2 || (dists[j] == bestDist2 && (int32)indices[j] < best)){
+				bestDist2 = dists[j];
+				best = indices[j];
+			}
+	}
+#endif
+	for(; i < n; i++){
+		V3d d = sub(v[i], c);
+		float32 d2 = dot(d, d);
+		if(d2 > bestDist2){
+			bestDist2 = d2;
+			best = i;
+		}
+	}
+	*maxDist2 = bestDist2;
+	return best;
+}
+
+static void
+growSphere(Sphere *s, V3d p)
+{
+	V3d d = sub(p, s->center);
+	float32 dist = length(d);
+	if(dist <= s->radius)
+		return;
+	float32 r = (s->radius + dist)*0.5f;
+	s->center = add(s->center, scale(d, (r - s->radius)/dist));
+	s->radius = r;
+}
+
+// Ritter's bounding sphere. Most points are inside the initial
+// sphere, so test four at a time and only grow when one isn't.
+static Sphere
+ritterSphere(const V3d *v, int32 n)
+{
+	Sphere s;
+	float32 d2;
+	int32 a = findFarthest(v, n, v[0], &d2);
+	int32 b = findFarthest(v, n, v[a], &d2);
+	s.center = scale(add(v[a], v[b]), 0.5f);
+	s.radius = sqrtf(d2)*0.5f;
+
+	int32 i = 0;
+#if defined(RW_SSE2)
+	for(; i+4 <= n; i += 4){
+		const float32 *p = &v[i].x;
+		__m128 a = _mm_loadu_ps(p);
+		__m128 b = _mm_loadu_ps(p+4);
+		__m128 d = _mm_loadu_ps(p+8);
+		__m128 t = _mm_shuffle_ps(b, d, _MM_SHUFFLE(0, 1, 0, 2));
+		__m128 x = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 3, 0));
+		__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 0, 1)),
+			_mm_shuffle_ps(b, d, _MM_SHUFFLE(0, 2, 0, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 1, 0, 2)),
+			_mm_shuffle_ps(d, d, _MM_SHUFFLE(0, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+		x = _mm_sub_ps(x, _mm_set1_ps(s.center.x));
+		y = _mm_sub_ps(y, _mm_set1_ps(s.center.y));
+		z = _mm_sub_ps(z, _mm_set1_ps(s.center.z));
+		__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+		if(_mm_movemask_ps(_mm_cmpgt_ps(d2, _mm_set1_ps(s.radius*s.radius))))
+			for(int32 j = 0; j < 4; j++)
+				growSphere(&s, v[i+j]);
+	}
+#elif defined(RW_NEON)
+	for(; i+4 <= n; i += 4){
+		float32x4x3_t p = vld3q_f32(&v[i].x);
+		float32x4_t x = vsubq_f32(p.val[0], vdupq_n_f32(s.center.x));
+		float32x4_t y = vsubq_f32(p.val[1], vdupq_n_f32(s.center.y));
+		float32x4_t z = vsubq_f32(p.val[2], vdupq_n_f32(s.center.z));
+		float32x4_t d2 = vmlaq_f32(vmlaq_f32(vmulq_f32(x, x), y, y), z, z);
+		uint32x4_t out = vcgtq_f32(d2, vdupq_n_f32(s.radius*s.radius));
+		uint32x2_t o = vorr_u32(vget_low_u32(out), vget_high_u32(out));
+		if(vget_lane_u32(vpmax_u32(o, o), 0))
+			for(int32 j = 0; j < 4; j++)
+				growSphere(&s, v[i+j]);
+	}
+#endif
+	for(; i < n; i++)
+		growSphere(&s, v[i]);
+	return s;
+}
+
+// Ritter's sphere is within about 5-20% of the minimal one.
+// Refine it by moving the center towards the farthest point
+// with shrinking steps (Badoiu-Clarkson), the radius is
+// always the distance of the farthest point so the sphere
+// stays exact and we only keep improvements.
 Sphere
-MorphTarget::calculateBoundingSphere(void) const
+MorphTarget::calculateBoundingSphere(int32 refineSteps) const
 {
 	Sphere sphere;
-	V3d min = {  1000000.0f,  1000000.0f,  1000000.0f };
-	V3d max = { -1000000.0f, -1000000.0f, -1000000.0f };
-	V3d *v = this->vertices;
-	for(int32 j = 0; j < this->parent->numVertices; j++){
-		if(v->x > max.x) max.x = v->x;
-		if(v->x < min.x) min.x = v->x;
-		if(v->y > max.y) max.y = v->y;
-		if(v->y < min.y) min.y = v->y;
-		if(v->z > max.z) max.z = v->z;
-		if(v->z < min.z) min.z = v->z;
-		v++;
+	int32 n = this->parent->numVertices;
+	if(this->vertices == nil || n == 0){
+		sphere.center.x = 0.0f;
+		sphere.center.y = 0.0f;
+		sphere.center.z = 0.0f;
+		sphere.radius = 0.0f;
+		return sphere;
+	}
+	const V3d *v = this->vertices;
+	sphere = ritterSphere(v, n);
+
+	float32 d2;
+	V3d c = sphere.center;
+	for(int32 i = 0; i < refineSteps; i++){
+		V3d far = v[findFarthest(v, n, c, &d2)];
+		float32 r = sqrtf(d2);
+		if(r < sphere.radius){
+			sphere.center = c;
+			sphere.radius = r;
+		}
+		c = add(c, scale(sub(far, c), 1.0f/(i+4)));
 	}
-	sphere.center = scale(add(min, max), 1/2.0f);
-	max = sub(max, sphere.center);
-	sphere.radius = length(max);
+	// float error can leave the farthest point just outside
+	sphere.radius *= 1.0f + 1e-6f;
 	return sphere;
 }
 
@@ -30,17 +30,17 @@ static uint16 nextSerialNum = 1;
 // Allocate a mesh header, meshes and optionally indices.
 // If existing meshes already exist, retain their information.
 MeshHeader*
-Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices)
+Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices, bool32 index32)
 {
 	uint32 sz;
 	MeshHeader *mh;
 	Mesh *m;
-	uint16 *indices;
+	uint8 *indices;
 	int32 oldNumMeshes;
 	int32 i;
 	sz = sizeof(MeshHeader) + numMeshes*sizeof(Mesh);
 	if(!noIndices)
-		sz += numIndices*sizeof(uint16);
+		sz += numIndices*(index32 ? sizeof(uint32) : sizeof(uint16));
 	if(this->meshHeader){
 		oldNumMeshes = this->meshHeader->numMeshes;
 		mh = (MeshHeader*)rwResize(this->meshHeader, sz, MEMDUR_EVENT | ID_GEOMETRY);
@@ -54,8 +54,9 @@ Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices)
 	mh->numMeshes = numMeshes;
 	mh->serialNum = nextSerialNum++;
 	mh->totalIndices = numIndices;
+	mh->index32 = !!index32;
 	m = mh->getMeshes();
-	indices = (uint16*)&m[numMeshes];
+	indices = (uint8*)&m[numMeshes];
 	for(i = 0; i < mh->numMeshes; i++){
 		// keep these
 		if(i >= oldNumMeshes){
@@ -66,8 +67,8 @@ Geometry::allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices)
 		if(noIndices)
 			m->indices = nil;
 		else{
-			m->indices = indices;
-			indices += m->numIndices;
+			m->indices = (uint16*)indices;
+			indices += m->numIndices*mh->indexSize();
 		}
 		m++;
 	}
@@ -78,16 +79,16 @@ void
 MeshHeader::setupIndices(void)
 {
 	int32 i;
-	uint16 *indices;
+	uint8 *indices;
 	Mesh *m;
 	m = this->getMeshes();
-	indices = m->indices;
+	indices = (uint8*)m->indices;
 	// return if native
 	if(indices == nil)
 		return;
 	for(i = 0; i < this->numMeshes; i++){
-		m->indices = indices;
-		indices += m->numIndices;
+		m->indices = (uint16*)indices;
+		indices += m->numIndices*this->indexSize();
 		m++;
 	}
 }
@@ -121,8 +122,12 @@ readMesh(Stream *stream, int32 len, void *object, int32, int32)
 	bool32 hasData = len > int32(sizeof(MeshHeaderStream)+mhs.numMeshes*sizeof(MeshStream));
 	assert(geo->meshHeader == nil);
 	geo->meshHeader = nil;
+	// The Index32 plugin might not have been read yet
+	// so we can't rely on the geometry flag alone.
+	bool32 index32 = !(geo->flags & Geometry::NATIVE) &&
+		(geo->flags & Geometry::INDEX32 || geo->numVertices > 0x10000);
 	mh = geo->allocateMeshes(mhs.numMeshes, mhs.totalIndices, 
-		geo->flags & Geometry::NATIVE && !hasData);
+		geo->flags & Geometry::NATIVE && !hasData, index32);
 	mh->flags = mhs.flags;
 
 	mesh = mh->getMeshes();
@@ -139,6 +144,10 @@ readMesh(Stream *stream, int32 len, void *object, int32, int32)
 				stream->read16(mesh->indices,
 				            mesh->numIndices*2);
 			}
+		}else if(index32){
+			mesh->indices32 = (uint32*)indices;
+			indices += mesh->numIndices*2;
+			stream->read32(mesh->indices32, mesh->numIndices*4);
 		}else{
 			mesh->indices = indices;
 			indices += mesh->numIndices;
@@ -178,6 +187,8 @@ writeMesh(Stream *stream, int32, void *object, int32, int32)
 			if(geo->instData->platform == PLATFORM_WDGL)
 				stream->write16(mesh->indices,
 				            mesh->numIndices*2);
+		}else if(geo->meshHeader->index32){
+			stream->write32(mesh->indices32, mesh->numIndices*4);
 		}else{
 			uint16 *ind = mesh->indices;
 			int32 numIndices = mesh->numIndices;
@@ -218,6 +229,68 @@ registerMeshPlugin(void)
 	Geometry::registerPluginStream(ID_MESH, readMesh, writeMesh, getSizeMesh);
 }
 
+// Index32
+// The stock triangle list of INDEX32 geometries is empty,
+// their triangles are written here instead.
+
+static Stream*
+readIndex32(Stream *stream, int32, void *object, int32, int32)
+{
+	uint32 tribuf[4];
+	Geometry *geo = (Geometry*)object;
+	int32 numTris = stream->readI32();
+	geo->flags |= Geometry::INDEX32;
+	geo->numTriangles = numTris;
+	if(geo->flags & Geometry::NATIVE)
+		return stream;
+	rwFree(geo->triangles32);
+	geo->triangles32 = rwNewT(Triangle32, numTris, MEMDUR_EVENT | ID_GEOMETRY);
+	for(int32 i = 0; i < numTris; i++){
+		stream->read32(tribuf, 16);
+		geo->triangles32[i].v[0]  = tribuf[0];
+		geo->triangles32[i].v[1]  = tribuf[1];
+		geo->triangles32[i].v[2]  = tribuf[2];
+		geo->triangles32[i].matId = tribuf[3];
+	}
+	return stream;
+}
+
+static Stream*
+writeIndex32(Stream *stream, int32, void *object, int32, int32)
+{
+	uint32 tribuf[4];
+	Geometry *geo = (Geometry*)object;
+	stream->writeI32(geo->numTriangles);
+	if(geo->flags & Geometry::NATIVE)
+		return stream;
+	for(int32 i = 0; i < geo->numTriangles; i++){
+		tribuf[0] = geo->triangles32[i].v[0];
+		tribuf[1] = geo->triangles32[i].v[1];
+		tribuf[2] = geo->triangles32[i].v[2];
+		tribuf[3] = geo->triangles32[i].matId;
+		stream->write32(tribuf, 16);
+	}
+	return stream;
+}
+
+static int32
+getSizeIndex32(void *object, int32, int32)
+{
+	Geometry *geo = (Geometry*)object;
+	if(!(geo->flags & Geometry::INDEX32))
+		return -1;
+	if(geo->flags & Geometry::NATIVE)
+		return 4;
+	return 4 + geo->numTriangles*16;
+}
+
+void
+registerIndex32Plugin(void)
+{
+	Geometry::registerPlugin(0, ID_INDEX32, nil, nil, nil);
+	Geometry::registerPluginStream(ID_INDEX32, readIndex32, writeIndex32, getSizeIndex32);
+}
+
 // Returns the maximum number of triangles. Just so
 // we can allocate enough before instancing. This does not
 // take into account degerate triangles or ADC bits as
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
+
+#include "rwgl3.h"
+#include "rwgl3shader.h"
+#include "rwgl3plg.h"
+
+#include "rwgl3impl.h"
+
+namespace rw {
+namespace gl3 {
+
+#ifdef RW_OPENGL
+
+static Shader *morphShader;
+static int32 u_morphParams;
+
+// The positions and normals of all morph targets follow the
+// interleaved vertices in the vertex buffer, so any two of them
+// can be blended in the vertex shader.
+
+static uint32
+morphTargetStride(Geometry *geo)
+{
+	return geo->flags & Geometry::NORMALS ? 24 : 12;
+}
+
+void
+morphInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
+{
+	defaultInstanceCB(geo, header, reinstance);
+	if(geo->numMorphTargets < 2)
+		return;
+
+	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
+	uint32 size = header->totalNumVertex*header->attribDesc[0].stride;
+	uint32 stride = morphTargetStride(geo);
+	uint32 targetSize = header->totalNumVertex*stride;
+
+	if(!reinstance){
+		uint8 *buf = rwNewT(uint8, size + geo->numMorphTargets*targetSize, MEMDUR_EVENT | ID_GEOMETRY);
+		memcpy(buf, header->vertexBuffer, size);
+		rwFree(header->vertexBuffer);
+		header->vertexBuffer = buf;
+	}
+
+	int32 first, n;
+	n = getInstanceRange(geo, Geometry::LOCKVERTICES|Geometry::LOCKNORMALS, reinstance,
+		header->totalNumVertex, &first);
+	if(n == 0)
+		return;
+	for(int32 i = 0; i < geo->numMorphTargets; i++){
+		MorphTarget *mt = &geo->morphTargets[i];
+		uint8 *verts = header->vertexBuffer + size + i*targetSize + first*stride;
+		instV3d(VERT_FLOAT3, verts, mt->vertices + first, n, stride);
+		if(hasNormals)
+			instV3d(VERT_FLOAT3, verts + 12, mt->normals + first, n, stride);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
+	if(!reinstance)
+		// the default callback only uploaded the interleaved part
+		glBufferData(GL_ARRAY_BUFFER, size + geo->numMorphTargets*targetSize,
+		             header->vertexBuffer, GL_STATIC_DRAW);
+	else
+		for(int32 i = 0; i < geo->numMorphTargets; i++){
+			uint32 offset = size + i*targetSize + first*stride;
+			glBufferSubData(GL_ARRAY_BUFFER, offset, n*stride,
+			                header->vertexBuffer + offset);
+		}
+}
+
+static void
+setMorphAttribPointers(Atomic *atomic, InstanceDataHeader *header)
+{
+	Geometry *geo = atomic->geometry;
+	Morph *morph = Morph::get(atomic);
+	uint32 stride = morphTargetStride(geo);
+	uint32 targetSize = header->totalNumVertex*stride;
+	uintptr start = header->totalNumVertex*header->attribDesc[0].stride;
+	uintptr end = start + morph->getEndTarget(geo)*targetSize;
+	start += morph->getStartTarget(geo)*targetSize;
+
+	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
+	glVertexAttribPointer(ATTRIB_POS, 3, GL_FLOAT, GL_FALSE, stride, (void*)start);
+	glEnableVertexAttribArray(ATTRIB_POS2);
+	glVertexAttribPointer(ATTRIB_POS2, 3, GL_FLOAT, GL_FALSE, stride, (void*)end);
+	if(geo->flags & Geometry::NORMALS){
+		glVertexAttribPointer(ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, stride, (void*)(start+12));
+		glEnableVertexAttribArray(ATTRIB_NORMAL2);
+		glVertexAttribPointer(ATTRIB_NORMAL2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(end+12));
+	}
+}
+
+static void
+resetMorphAttribPointers(InstanceDataHeader *header)
+{
+	glDisableVertexAttribArray(ATTRIB_POS2);
+	glDisableVertexAttribArray(ATTRIB_NORMAL2);
+#ifdef RW_GL_USE_VAOS
+	// other pipelines expect the interleaved vertices
+	setAttribPointers(header->attribDesc, header->numAttribs);
+#endif
+}
+
+void
+morphRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	Material *m;
+
+	Geometry *geo = atomic->geometry;
+	if(geo->numMorphTargets < 2){
+		defaultRenderCB(atomic, header);
+		return;
+	}
+
+	uint32 flags = geo->flags;
+	setWorldMatrix(atomic->getFrame()->getLTM());
+	lightingCB(atomic);
+
+	setupVertexInput(header);
+	setMorphAttribPointers(atomic, header);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+
+	morphShader->use();
+
+	float morphParams[4];
+	morphParams[0] = Morph::get(atomic)->factor;
+	morphParams[1] = morphParams[2] = morphParams[3] = 0.0f;
+	setUniform(u_morphParams, morphParams);
+
+	while(n--){
+		m = inst->material;
+
+		setMaterial(flags, m->color, m->surfaceProps);
+
+		setTexture(0, m->texture);
+
+		rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
+
+		drawInst(header, inst);
+		inst++;
+	}
+	resetMorphAttribPointers(header);
+	teardownVertexInput(header);
+}
+
+static void*
+morphOpen(void *o, int32, int32)
+{
+	morphGlobals.pipelines[PLATFORM_GL3] = makeMorphPipeline();
+
+#include "shaders/simple_fs_gl.inc"
+#include "shaders/morph_gl.inc"
+	const char *vs[] = { shaderDecl, header_vert_src, morph_vert_src, nil };
+	const char *fs[] = { shaderDecl, header_frag_src, simple_frag_src, nil };
+	morphShader = Shader::create(vs, fs);
+	assert(morphShader);
+
+	return o;
+}
+
+static void*
+morphClose(void *o, int32, int32)
+{
+	((ObjPipeline*)morphGlobals.pipelines[PLATFORM_GL3])->destroy();
+	morphGlobals.pipelines[PLATFORM_GL3] = nil;
+
+	morphShader->destroy();
+	morphShader = nil;
+
+	return o;
+}
+
+void
+initMorph(void)
+{
+	u_morphParams = registerUniform("u_morphParams", UNIFORM_VEC4);
+
+	Driver::registerPlugin(PLATFORM_GL3, 0, ID_MORPH,
+	                       morphOpen, morphClose);
+}
+
+ObjPipeline*
+makeMorphPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = morphInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = morphRenderCB;
+	pipe->pluginID = ID_MORPH;
+	pipe->pluginData = 0;
+	return pipe;
+}
+
+#else
+
+void initMorph(void) { }
+
+#endif
+
+}
+}
@@ -62,13 +62,19 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	header->totalNumIndex = meshh->totalIndices;
 	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 
-	header->indexBuffer = rwNewT(uint16, header->totalNumIndex, MEMDUR_EVENT | ID_GEOMETRY);
+	uint32 indexSize = meshh->indexSize();
+	header->indexType = meshh->index32 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+	header->indexBuffer = rwNewT(uint8, header->totalNumIndex*indexSize, MEMDUR_EVENT | ID_GEOMETRY);
 	InstanceData *inst = header->inst;
 	Mesh *mesh = meshh->getMeshes();
 	uint32 offset = 0;
 	for(uint32 i = 0; i < header->numMeshes; i++){
-		findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
-		                          &inst->minVert, &inst->numVertices);
+		if(meshh->index32)
+			findMinVertAndNumVertices(mesh->indices32, mesh->numIndices,
+			                          &inst->minVert, &inst->numVertices);
+		else
+			findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
+			                          &inst->minVert, &inst->numVertices);
 		assert(inst->minVert != 0xFFFFFFFF);
 		inst->numIndex = mesh->numIndices;
 		inst->material = mesh->material;
@@ -76,8 +82,8 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 		inst->program = 0;
 		inst->offset = offset;
 		memcpy((uint8*)header->indexBuffer + inst->offset,
-		       mesh->indices, inst->numIndex*2);
-		offset += inst->numIndex*2;
+		       mesh->indices, inst->numIndex*indexSize);
+		offset += inst->numIndex*indexSize;
 		mesh++;
 		inst++;
 	}
@@ -94,7 +100,7 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 #endif
 	glGenBuffers(1, &header->ibo);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->totalNumIndex*2,
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->totalNumIndex*indexSize,
 			header->indexBuffer, GL_STATIC_DRAW);
 
 	return header;
@@ -167,6 +173,16 @@ ObjPipeline::create(void)
 	return pipe;
 }
 
+bool32 packedVertices;
+
+bool32
+usePackedVertices(void)
+{
+	if(!packedVertices)
+		return 0;
+	return gl3Caps.gles ? gl3Caps.glversion >= 30 : gl3Caps.glversion >= 33;
+}
+
 void
 defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 {
@@ -176,6 +192,7 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
 
 	if(!reinstance){
+		bool packed = !!usePackedVertices();
 		AttribDesc tmpAttribs[12];
 		uint32 stride;
 
@@ -195,14 +212,21 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		a++;
 
 		// Normals
-		// TODO: compress
 		if(hasNormals){
 			a->index = ATTRIB_NORMAL;
-			a->size = 3;
-			a->type = GL_FLOAT;
-			a->normalized = GL_FALSE;
-			a->offset = stride;
-			stride += 12;
+			if(packed){
+				a->size = 4;
+				a->type = GL_INT_2_10_10_10_REV;
+				a->normalized = GL_TRUE;
+				a->offset = stride;
+				stride += 4;
+			}else{
+				a->size = 3;
+				a->type = GL_FLOAT;
+				a->normalized = GL_FALSE;
+				a->offset = stride;
+				stride += 12;
+			}
 			a++;
 		}
 
@@ -221,10 +245,10 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			a->index = ATTRIB_TEXCOORDS0+n;
 			a->size = 2;
-			a->type = GL_FLOAT;
+			a->type = packed ? GL_HALF_FLOAT : GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 8;
+			stride += packed ? 4 : 8;
 			a++;
 		}
 
@@ -250,49 +274,65 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	//
 
 	uint8 *verts = header->vertexBuffer;
+	int32 first, n;
 
 	// Positions
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	n = getInstanceRange(geo, Geometry::LOCKVERTICES, reinstance, header->totalNumVertex, &first);
+	if(n){
 		for(a = attribs; a->index != ATTRIB_POS; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex, a->stride);
+		instV3d(VERT_FLOAT3, verts + a->offset + first*a->stride,
+			geo->morphTargets[0].vertices + first,
+			n, a->stride);
 	}
 
 	// Normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	n = getInstanceRange(geo, Geometry::LOCKNORMALS, reinstance, header->totalNumVertex, &first);
+	if(hasNormals && n){
 		for(a = attribs; a->index != ATTRIB_NORMAL; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex, a->stride);
+		instV3d(a->type == GL_FLOAT ? VERT_FLOAT3 : VERT_PACKEDNORM, verts + a->offset + first*a->stride,
+			geo->morphTargets[0].normals + first,
+			n, a->stride);
 	}
 
 	// Prelighting
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	n = getInstanceRange(geo, Geometry::LOCKPRELIGHT, reinstance, header->totalNumVertex, &first);
+	if(isPrelit && n){
 		for(a = attribs; a->index != ATTRIB_COLOR; a++)
 			;
-		int n = header->numMeshes;
+		int32 end = first + n;
+		int m = header->numMeshes;
 		InstanceData *inst = header->inst;
-		while(n--){
+		while(m--){
 			assert(inst->minVert != 0xFFFFFFFF);
-			inst->vertexAlpha = instColor(VERT_RGBA,
-				verts + a->offset + a->stride*inst->minVert,
-				geo->colors + inst->minVert,
-				inst->numVertices, a->stride);
+			// only the part of the mesh that changed
+			int32 s = first > (int32)inst->minVert ? first : inst->minVert;
+			int32 e = end < (int32)(inst->minVert+inst->numVertices) ? end : inst->minVert+inst->numVertices;
+			if(s < e){
+				bool32 alpha = instColor(VERT_RGBA,
+					verts + a->offset + a->stride*s,
+					geo->colors + s,
+					e - s, a->stride);
+				// can't know about the rest after a partial update
+				if(e - s == (int32)inst->numVertices)
+					inst->vertexAlpha = alpha;
+				else
+					inst->vertexAlpha |= alpha;
+			}
 			inst++;
 		}
 	}
 
 	// Texture coordinates
-	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+n; a++)
+	for(int32 t = 0; t < geo->numTexCoordSets; t++){
+		n = getInstanceRange(geo, Geometry::LOCKTEXCOORDS<<t, reinstance, header->totalNumVertex, &first);
+		if(n){
+			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+t; a++)
 				;
-			instTexCoords(VERT_FLOAT2, verts + a->offset,
-				geo->texCoords[n],
-				header->totalNumVertex, a->stride);
+			instTexCoords(a->type == GL_FLOAT ? VERT_FLOAT2 : VERT_HALF2, verts + a->offset + first*a->stride,
+				geo->texCoords[t] + first,
+				n, a->stride);
 		}
 	}
 
@@ -301,8 +341,16 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
 #endif
 	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
-	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
-	             header->vertexBuffer, GL_STATIC_DRAW);
+	if(!reinstance)
+		glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
+		             header->vertexBuffer, GL_STATIC_DRAW);
+	else{
+		// only upload the vertices that changed
+		n = getInstanceRange(geo, Geometry::LOCKALL, reinstance, header->totalNumVertex, &first);
+		if(n)
+			glBufferSubData(GL_ARRAY_BUFFER, first*attribs[0].stride, n*attribs[0].stride,
+			                header->vertexBuffer + first*attribs[0].stride);
+	}
 #ifdef RW_GL_USE_VAOS
 	setAttribPointers(header->attribDesc, header->numAttribs);
 	glBindVertexArray(0);
@@ -641,7 +641,7 @@ rasterFromImage(Raster *raster, Image *image)
 	if((raster->type&0xF) != Raster::TEXTURE)
 		return 0;
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	ConvRowFunc conv = nil;
 
 	// Unpalettize image if necessary but don't change original
 	Image *truecolimg = nil;
@@ -660,29 +660,29 @@ rasterFromImage(Raster *raster, Image *image)
 	switch(image->depth){
 	case 32:
 		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_RGBA8888;
+			conv = findConvRow(PIXEL_RGBA8888, PIXEL_RGBA8888);
 		else if(format == Raster::C8888)
-			conv = conv_RGBA8888_from_RGBA8888;
+			conv = findConvRow(PIXEL_RGBA8888, PIXEL_RGBA8888);
 		else if(format == Raster::C888)
-			conv = conv_RGB888_from_RGB888;
+			conv = findConvRow(PIXEL_RGB888, PIXEL_RGBA8888);
 		else
 			goto err;
 		break;
 	case 24:
 		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_RGB888;
+			conv = findConvRow(PIXEL_RGBA8888, PIXEL_RGB888);
 		else if(format == Raster::C8888)
-			conv = conv_RGBA8888_from_RGB888;
+			conv = findConvRow(PIXEL_RGBA8888, PIXEL_RGB888);
 		else if(format == Raster::C888)
-			conv = conv_RGB888_from_RGB888;
+			conv = findConvRow(PIXEL_RGB888, PIXEL_RGB888);
 		else
 			goto err;
 		break;
 	case 16:
 		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_ARGB1555;
+			conv = findConvRow(PIXEL_RGBA8888, PIXEL_ARGB1555);
 		else if(format == Raster::C1555)
-			conv = conv_RGBA5551_from_ARGB1555;
+			conv = findConvRow(PIXEL_RGBA5551, PIXEL_ARGB1555);
 		else
 			goto err;
 		break;
@@ -707,17 +707,11 @@ rasterFromImage(Raster *raster, Image *image)
 	assert(pixels);
 	uint8 *imgpixels = image->pixels + (image->height-1)*image->stride;
 
-	int x, y;
+	int y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
 	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(rasrow, imgrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
+		conv(pixels, imgpixels, image->width);
 		imgpixels -= image->stride;
 		pixels += raster->stride;
 	}
@@ -749,19 +743,20 @@ rasterToImage(Raster *raster)
 		return nil;
 	}
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	// GLES rasters are always RGBA8888 in memory
+	ConvRowFunc conv = nil;
 	switch(raster->format & 0xF00){
 	case Raster::C1555:
 		depth = 16;
-		conv = conv_ARGB1555_from_RGBA5551;
+		conv = findConvRow(PIXEL_ARGB1555, natras->bpp == 4 ? PIXEL_RGBA8888 : PIXEL_RGBA5551);
 		break;
 	case Raster::C8888:
 		depth = 32;
-		conv = conv_RGBA8888_from_RGBA8888;
+		conv = findConvRow(PIXEL_RGBA8888, PIXEL_RGBA8888);
 		break;
 	case Raster::C888:
 		depth = 24;
-		conv = conv_RGB888_from_RGB888;
+		conv = findConvRow(PIXEL_RGB888, natras->bpp == 4 ? PIXEL_RGBA8888 : PIXEL_RGB888);
 		break;
 
 	default:
@@ -786,17 +781,11 @@ rasterToImage(Raster *raster)
 	uint8 *imgpixels = image->pixels + (image->height-1)*image->stride;
 	uint8 *pixels = raster->pixels;
 
-	int x, y;
+	int y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
 	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(imgrow, rasrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
+		conv(imgpixels, pixels, image->width);
 		imgpixels -= image->stride;
 		pixels += raster->stride;
 	}
@@ -25,7 +25,7 @@ drawInst_simple(InstanceDataHeader *header, InstanceData *inst)
 {
 	flushCache();
 	glDrawElements(header->primType, inst->numIndex,
-	               GL_UNSIGNED_SHORT, (void*)(uintptr)inst->offset);
+	               header->indexType, (void*)(uintptr)inst->offset);
 }
 
 // Emulate PS2 GS alpha test FB_ONLY case: failed alpha writes to frame- but not to depth buffer
@@ -214,6 +214,8 @@ linkprogram(GLint vs, GLint fs, GLuint *program)
 		glBindAttribLocation(prog, ATTRIB_INDICES, "in_indices");
 		glBindAttribLocation(prog, ATTRIB_TEXCOORDS0, "in_tex0");
 		glBindAttribLocation(prog, ATTRIB_TEXCOORDS1, "in_tex1");
+		glBindAttribLocation(prog, ATTRIB_POS2, "in_pos2");
+		glBindAttribLocation(prog, ATTRIB_NORMAL2, "in_normal2");
 	}
 
 	glAttachShader(prog, vs);
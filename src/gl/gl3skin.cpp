@@ -36,6 +36,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
 
 	if(!reinstance){
+		bool packed = !!usePackedVertices();
 		AttribDesc tmpAttribs[14];
 		uint32 stride;
 
@@ -55,14 +56,21 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		a++;
 
 		// Normals
-		// TODO: compress
 		if(hasNormals){
 			a->index = ATTRIB_NORMAL;
-			a->size = 3;
-			a->type = GL_FLOAT;
-			a->normalized = GL_FALSE;
-			a->offset = stride;
-			stride += 12;
+			if(packed){
+				a->size = 4;
+				a->type = GL_INT_2_10_10_10_REV;
+				a->normalized = GL_TRUE;
+				a->offset = stride;
+				stride += 4;
+			}else{
+				a->size = 3;
+				a->type = GL_FLOAT;
+				a->normalized = GL_FALSE;
+				a->offset = stride;
+				stride += 12;
+			}
 			a++;
 		}
 
@@ -81,20 +89,27 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(int32 n = 0; n < geo->numTexCoordSets; n++){
 			a->index = ATTRIB_TEXCOORDS0+n;
 			a->size = 2;
-			a->type = GL_FLOAT;
+			a->type = packed ? GL_HALF_FLOAT : GL_FLOAT;
 			a->normalized = GL_FALSE;
 			a->offset = stride;
-			stride += 8;
+			stride += packed ? 4 : 8;
 			a++;
 		}
 
 		// Weights
 		a->index = ATTRIB_WEIGHTS;
 		a->size = 4;
-		a->type = GL_FLOAT;
-		a->normalized = GL_FALSE;
-		a->offset = stride;
-		stride += 16;
+		if(packed){
+			a->type = GL_UNSIGNED_BYTE;
+			a->normalized = GL_TRUE;
+			a->offset = stride;
+			stride += 4;
+		}else{
+			a->type = GL_FLOAT;
+			a->normalized = GL_FALSE;
+			a->offset = stride;
+			stride += 16;
+		}
 		a++;
 
 		// Indices
@@ -129,42 +144,47 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	//
 
 	uint8 *verts = header->vertexBuffer;
+	int32 first, n;
 
 	// Positions
-	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
+	n = getInstanceRange(geo, Geometry::LOCKVERTICES, reinstance, header->totalNumVertex, &first);
+	if(n){
 		for(a = attribs; a->index != ATTRIB_POS; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].vertices,
-			header->totalNumVertex, a->stride);
+		instV3d(VERT_FLOAT3, verts + a->offset + first*a->stride,
+			geo->morphTargets[0].vertices + first,
+			n, a->stride);
 	}
 
 	// Normals
-	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS)){
+	n = getInstanceRange(geo, Geometry::LOCKNORMALS, reinstance, header->totalNumVertex, &first);
+	if(hasNormals && n){
 		for(a = attribs; a->index != ATTRIB_NORMAL; a++)
 			;
-		instV3d(VERT_FLOAT3, verts + a->offset,
-			geo->morphTargets[0].normals,
-			header->totalNumVertex, a->stride);
+		instV3d(a->type == GL_FLOAT ? VERT_FLOAT3 : VERT_PACKEDNORM, verts + a->offset + first*a->stride,
+			geo->morphTargets[0].normals + first,
+			n, a->stride);
 	}
 
 	// Prelighting
-	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+	n = getInstanceRange(geo, Geometry::LOCKPRELIGHT, reinstance, header->totalNumVertex, &first);
+	if(isPrelit && n){
 		for(a = attribs; a->index != ATTRIB_COLOR; a++)
 			;
-		instColor(VERT_RGBA, verts + a->offset,
-			  geo->colors,
-			  header->totalNumVertex, a->stride);
+		instColor(VERT_RGBA, verts + a->offset + first*a->stride,
+			  geo->colors + first,
+			  n, a->stride);
 	}
 
 	// Texture coordinates
-	for(int32 n = 0; n < geo->numTexCoordSets; n++){
-		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n)){
-			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+n; a++)
+	for(int32 t = 0; t < geo->numTexCoordSets; t++){
+		n = getInstanceRange(geo, Geometry::LOCKTEXCOORDS<<t, reinstance, header->totalNumVertex, &first);
+		if(n){
+			for(a = attribs; a->index != ATTRIB_TEXCOORDS0+t; a++)
 				;
-			instTexCoords(VERT_FLOAT2, verts + a->offset,
-				geo->texCoords[n],
-				header->totalNumVertex, a->stride);
+			instTexCoords(a->type == GL_FLOAT ? VERT_FLOAT2 : VERT_HALF2, verts + a->offset + first*a->stride,
+				geo->texCoords[t] + first,
+				n, a->stride);
 		}
 	}
 
@@ -173,7 +193,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		for(a = attribs; a->index != ATTRIB_WEIGHTS; a++)
 			;
 		float *w = skin->weights;
-		instV4d(VERT_FLOAT4, verts + a->offset,
+		instV4d(a->type == GL_FLOAT ? VERT_FLOAT4 : VERT_NORMUBYTE4, verts + a->offset,
 			(V4d*)w,
 			header->totalNumVertex, a->stride);
 	}
@@ -193,8 +213,16 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
 #endif
 	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
-	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
-	             header->vertexBuffer, GL_STATIC_DRAW);
+	if(!reinstance)
+		glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
+		             header->vertexBuffer, GL_STATIC_DRAW);
+	else{
+		// only upload the vertices that changed
+		n = getInstanceRange(geo, Geometry::LOCKALL, reinstance, header->totalNumVertex, &first);
+		if(n)
+			glBufferSubData(GL_ARRAY_BUFFER, first*attribs[0].stride, n*attribs[0].stride,
+			                header->vertexBuffer + first*attribs[0].stride);
+	}
 #ifdef RW_GL_USE_VAOS
 	setAttribPointers(header->attribDesc, header->numAttribs);
 	glBindVertexArray(0);
@@ -215,30 +243,11 @@ uploadSkinMatrices(Atomic *a)
 	int i;
 	Skin *skin = Skin::get(a->geometry);
 	Matrix *m = (Matrix*)skinMatrices;
-	HAnimHierarchy *hier = Skin::getHierarchy(a);
-
-	if(hier){
-		Matrix *invMats = (Matrix*)skin->inverseMatrices;
-		Matrix tmp;
-
-		assert(skin->numBones == hier->numNodes);
-		if(hier->flags & HAnimHierarchy::LOCALSPACEMATRICES){
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(m, &invMats[i], &hier->matrices[i]);
-				m++;
-			}
-		}else{
-			Matrix invAtmMat;
-			Matrix::invert(&invAtmMat, a->getFrame()->getLTM());
-			for(i = 0; i < hier->numNodes; i++){
-				invMats[i].flags = 0;
-				Matrix::mult(&tmp, &hier->matrices[i], &invAtmMat);
-				Matrix::mult(m, &invMats[i], &tmp);
-				m++;
-			}
-		}
-	}else{
+	Matrix *palette = Skin::getPalette(a);
+
+	if(palette)
+		memcpy(m, palette, skin->numBones*sizeof(Matrix));
+	else{
 		for(i = 0; i < skin->numBones; i++){
 			m->setIdentity();
 			m++;
@@ -55,6 +55,8 @@ enum AttribIndices
 	ATTRIB_TEXCOORDS5,
 	ATTRIB_TEXCOORDS6,
 	ATTRIB_TEXCOORDS7,
+	ATTRIB_POS2,	// second morph target
+	ATTRIB_NORMAL2,
 };
 
 // default uniform indices
@@ -76,7 +78,8 @@ struct InstanceDataHeader : rw::InstanceDataHeader
 {
 	uint32      serialNumber;
 	uint32      numMeshes;
-	uint16     *indexBuffer;
+	void       *indexBuffer;
+	uint32      indexType;	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
 	uint32      primType;
 	uint8      *vertexBuffer;
 	int32       numAttribs;
@@ -272,6 +275,12 @@ extern Gl3Caps gl3Caps;
 // In most cases that's not an issue, but when it is,
 // this has to be set before the texture is filled:
 extern bool32 needToReadBackTextures;
+// Instance normals, texture coordinates and skin weights
+// in packed formats to save memory and bandwidth.
+// Needs GL 3.3 or GLES 3, ignored otherwise.
+// Only affects geometry instanced afterwards.
+extern bool32 packedVertices;
+bool32 usePackedVertices(void);
 
 void allocateDXT(Raster *raster, int32 dxt, int32 numLevels, bool32 hasAlpha);
 
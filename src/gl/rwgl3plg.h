@@ -11,6 +11,11 @@ void skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance
 void skinRenderCB(Atomic *atomic, InstanceDataHeader *header);
 void uploadSkinMatrices(Atomic *atomic);
 
+void initMorph(void);
+ObjPipeline *makeMorphPipeline(void);
+void morphInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
+void morphRenderCB(Atomic *atomic, InstanceDataHeader *header);
+
 
 }
 }
@@ -10,6 +10,8 @@
 #define ATTRIB_INDICES	4
 #define ATTRIB_TEXCOORDS0	5
 #define ATTRIB_TEXCOORDS1	6
+#define ATTRIB_POS2	13
+#define ATTRIB_NORMAL2	14
 
 
 VSIN(ATTRIB_NORMAL)	vec3 in_normal;
@@ -0,0 +1,30 @@
+uniform vec4 u_morphParams;	// factor
+
+VSIN(ATTRIB_POS)	vec3 in_pos;
+VSIN(ATTRIB_POS2)	vec3 in_pos2;
+VSIN(ATTRIB_NORMAL2)	vec3 in_normal2;
+
+VSOUT vec4 v_color;
+VSOUT vec2 v_tex0;
+VSOUT float v_fog;
+
+void
+main(void)
+{
+	vec3 MorphVertex = mix(in_pos, in_pos2, u_morphParams.x);
+	vec3 MorphNormal = mix(in_normal, in_normal2, u_morphParams.x);
+
+	vec4 Vertex = u_world * vec4(MorphVertex, 1.0);
+	gl_Position = u_proj * u_view * Vertex;
+	vec3 Normal = mat3(u_world) * MorphNormal;
+
+	v_tex0 = in_tex0;
+
+	v_color = in_color;
+	v_color.rgb += u_ambLight.rgb*surfAmbient;
+	v_color.rgb += DoDynamicLight(Vertex.xyz, Normal)*surfDiffuse;
+	v_color = clamp(v_color, 0.0, 1.0);
+	v_color *= u_matColor;
+
+	v_fog = DoFog(gl_Position.w);
+}
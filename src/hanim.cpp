@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -19,6 +20,13 @@
 #include "gl/rwwdgl.h"
 #include "gl/rwgl3.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
 #define PLUGIN_ID ID_HANIM
 
 namespace rw {
@@ -41,6 +49,10 @@ HAnimHierarchy::create(int32 numNodes, int32 *nodeFlags, int32 *nodeIDs,
 	hier->flags = flags;
 	hier->parentFrame = nil;
 	hier->parentHierarchy = hier;
+	hier->serial = 0;
+	hier->idMap = nil;
+	hier->palette = nil;
+	hier->invalidatePalette();
 	if(hier->flags & NOMATRICES){
 		hier->matrices = nil;
 		hier->matricesUnaligned = nil;
@@ -69,6 +81,8 @@ void
 HAnimHierarchy::destroy(void)
 {
 	this->interpolator->destroy();
+	rwFree(this->palette);
+	rwFree(this->idMap);
 	rwFree(this->matricesUnaligned);
 	rwFree(this->nodeInfo);
 	rwFree(this);
@@ -106,26 +120,125 @@ HAnimHierarchy::attachByIndex(int32 idx)
 		this->nodeInfo[idx].frame = f;
 }
 
+static uint32
+hashId(int32 id)
+{
+	return (uint32)id * 0x9E3779B1u;
+}
+
+static uint32
+getIdMapSize(int32 n)
+{
+	uint32 size = 8;
+	while(size < (uint32)n*2)
+		size *= 2;
+	return size;
+}
+
+// frames with an id in the order findUnattachedById visits them
+static int32
+collectNodeFrames(Frame *f, Frame **frames, int32 n)
+{
+	if(f == nil) return n;
+	if(HAnimData::get(f)->id >= 0){
+		if(frames)
+			frames[n] = f;
+		n++;
+	}
+	n = collectNodeFrames(f->next, frames, n);
+	return collectNodeFrames(f->child, frames, n);
+}
+
+// Same as attachByIndex for every node, but finds the
+// frames of all ids in one walk over the hierarchy
 void
 HAnimHierarchy::attach(void)
 {
-	for(int32 i = 0; i < this->numNodes; i++)
-		this->attachByIndex(i);
+	int32 i;
+	int32 numFrames = collectNodeFrames(this->parentFrame, nil, 0);
+	if(numFrames == 0)
+		return;
+	uint32 size = getIdMapSize(numFrames);
+	uint32 mask = size-1;
+	Frame **frames = rwNewT(Frame*, numFrames, MEMDUR_FUNCTION | ID_HANIM);
+	int32 *map = rwNewT(int32, size + numFrames, MEMDUR_FUNCTION | ID_HANIM);
+	int32 *next = map + size;	// next frame with the same id
+	collectNodeFrames(this->parentFrame, frames, 0);
+
+	// every id maps to its first frame, the others are chained in order
+	memset(map, 0xFF, size*sizeof(int32));
+	for(i = numFrames-1; i >= 0; i--){
+		int32 id = HAnimData::get(frames[i])->id;
+		uint32 h = hashId(id) & mask;
+		while(map[h] >= 0 && HAnimData::get(frames[map[h]])->id != id)
+			h = (h+1) & mask;
+		next[i] = map[h];
+		map[h] = i;
+	}
+
+	for(i = 0; i < this->numNodes; i++){
+		int32 id = this->nodeInfo[i].id;
+		uint32 h = hashId(id) & mask;
+		while(map[h] >= 0 && HAnimData::get(frames[map[h]])->id != id)
+			h = (h+1) & mask;
+		// take the first frame no earlier node has
+		if(map[h] >= 0){
+			this->nodeInfo[i].frame = frames[map[h]];
+			map[h] = next[map[h]];
+		}
+	}
+	rwFree(frames);
+	rwFree(map);
+}
+
+// Index of every node id. Ids can be changed any time,
+// so it is only a guess and rebuilt when it turns out wrong.
+void
+HAnimHierarchy::buildIdMap(void)
+{
+	uint32 size = getIdMapSize(this->numNodes);
+	if(this->idMap == nil)
+		this->idMap = rwNewT(int32, size, MEMDUR_EVENT | ID_HANIM);
+	memset(this->idMap, 0xFF, size*sizeof(int32));
+	for(int32 i = 0; i < this->numNodes; i++){
+		int32 id = this->nodeInfo[i].id;
+		uint32 h = hashId(id) & (size-1);
+		while(this->idMap[h] >= 0 && this->nodeInfo[this->idMap[h]].id != id)
+			h = (h+1) & (size-1);
+		// keep the first node with an id
+		if(this->idMap[h] < 0)
+			this->idMap[h] = i;
+	}
 }
 
 int32
 HAnimHierarchy::getIndex(int32 id)
 {
-	for(int32 i = 0; i < this->numNodes; i++)
-		if(this->nodeInfo[i].id == id)
+	int32 i;
+	if(this->idMap){
+		uint32 mask = getIdMapSize(this->numNodes)-1;
+		for(uint32 h = hashId(id) & mask; this->idMap[h] >= 0; h = (h+1) & mask){
+			i = this->idMap[h];
+			if(this->nodeInfo[i].id == id)
+				return i;
+		}
+	}
+	for(i = 0; i < this->numNodes; i++)
+		if(this->nodeInfo[i].id == id){
+			this->buildIdMap();
 			return i;
+		}
 	return -1;
 }
 
 int32
 HAnimHierarchy::getIndex(Frame *f)
 {
-	for(int32 i = 0; i < this->numNodes; i++)
+	// try the node of f's id first
+	int32 i = this->getIndex(HAnimData::get(f)->id);
+	if(i >= 0 && this->nodeInfo[i].frame == f)
+		return i;
+	for(i = 0; i < this->numNodes; i++)
 		if(this->nodeInfo[i].frame == f)
 			return i;
 	return -1;
@@ -148,23 +261,48 @@ HAnimHierarchy::find(Frame *f)
 	return HAnimHierarchy::find(f->child);
 }
 
+// The LTM of a node frame was set, mark it clean, sync its objects
+// and the frames hanging off it that aren't nodes, like props.
+static void
+syncNodeFrame(Frame *f)
+{
+	f->object.privateFlags &= ~Frame::SUBTREESYNCLTM;
+	FORLIST(lnk, f->objectList)
+		ObjectWithFrame::fromFrame(lnk)->sync();
+	for(Frame *child = f->child; child; child = child->next)
+		if(HAnimData::get(child)->id < 0){
+			Matrix::mult(&child->ltm, &child->matrix, &f->ltm);
+			syncNodeFrame(child);
+		}
+}
+
 void
 HAnimHierarchy::updateMatrices(void)
 {
-	// TODO: handle more (all!) cases
-
 	Matrix rootMat, animMat;
 	Matrix *curMat, *parentMat;
 	Matrix **sp, *stack[64];
 	Frame *frm, *parfrm;
 	int32 i;
 	AnimInterpolator *anim = this->interpolator;
+	Matrix *tmpMatrices = nil;
+
+	if(this->matrices == nil){
+		if((this->flags & (UPDATEMODELLINGMATRICES|UPDATELTMS)) == 0)
+			return;
+		tmpMatrices = rwNewT(Matrix, this->numNodes, MEMDUR_FUNCTION | ID_HANIM);
+	}
 
 	sp = stack;
-	curMat = this->matrices;
+	curMat = tmpMatrices ? tmpMatrices : this->matrices;
 
 	frm = this->parentFrame;
-	if(frm && (parfrm = frm->getParent()) && !(this->flags&LOCALSPACEMATRICES))
+	parfrm = frm ? frm->getParent() : nil;
+	// bring the frame hierarchy's LTMs up to date first, so a later
+	// sync doesn't recompute the ones set here from the frame matrices
+	if(frm && this->flags & UPDATELTMS)
+		frm->getLTM();
+	if(parfrm && !(this->flags&LOCALSPACEMATRICES))
 		rootMat = *parfrm->getLTM();
 	else
 		rootMat.setIdentity();
@@ -174,11 +312,20 @@ HAnimHierarchy::updateMatrices(void)
 	for(i = 0; i < this->numNodes; i++){
 		anim->applyCB(&animMat, anim->getInterpFrame(i));
 
-		// TODO: here we could update local matrices
+		Frame *f = node->frame;
+		if(f && this->flags & UPDATEMODELLINGMATRICES)
+			f->matrix = animMat;
 
 		Matrix::mult(curMat, &animMat, parentMat);
 
-		// TODO: here we could update LTM
+		// Frames of the hierarchy don't have to be synced after this
+		if(f && this->flags & UPDATELTMS){
+			if(parfrm && this->flags & LOCALSPACEMATRICES)
+				Matrix::mult(&f->ltm, curMat, parfrm->getLTM());
+			else
+				f->ltm = *curMat;
+			syncNodeFrame(f);
+		}
 
 		if(node->flags & PUSH)
 			*sp++ = parentMat;
@@ -191,6 +338,44 @@ HAnimHierarchy::updateMatrices(void)
 		node++;
 		curMat++;
 	}
+	rwFree(tmpMatrices);
+	this->serial++;
+}
+
+struct HAnimBatch
+{
+	HAnimHierarchy **hierarchies;
+	float32 *times;
+};
+
+static void
+updateHierarchyJob(int32 i, void *data)
+{
+	HAnimBatch *batch = (HAnimBatch*)data;
+	HAnimHierarchy *hier = batch->hierarchies[i];
+	if(batch->times && hier->interpolator->currentAnim)
+		hier->interpolator->addTime(batch->times[i]);
+	hier->updateMatrices();
+}
+
+// Advance the animations of n hierarchies by times (which may be nil)
+// and update their matrices, spread over the job threads.
+// Hierarchies that update their frames must not share any.
+void
+HAnimHierarchy::updateBatch(HAnimHierarchy **hierarchies, float32 *times, int32 n)
+{
+	int32 i;
+	// Syncing frames isn't thread safe, so get all LTMs
+	// the hierarchies depend on up to date first.
+	for(i = 0; i < n; i++){
+		Frame *f = hierarchies[i]->parentFrame;
+		if(f && f->getParent())
+			f->getParent()->getLTM();
+	}
+	HAnimBatch batch;
+	batch.hierarchies = hierarchies;
+	batch.times = times;
+	runJobs(updateHierarchyJob, n, &batch);
 }
 
 HAnimData*
@@ -345,10 +530,6 @@ hAnimFrameGetSize(Animation *anim)
 	return anim->numFrames*(4 + 4*4 + 3*4 + 4);
 }
 
-//void hanimBlendCB(void *out, void *in1, void *in2, float32 a);
-//void hanimAddCB(void *out, void *in1, void *in2);
-//void hanimMulRecipCB(void *frame, void *start);
-
 static void
 hanimApplyCB(void *result, void *frame)
 {
@@ -370,6 +551,378 @@ assert(t >= in1->time && t <= in2->time);
 	out->q = slerp(in1->q, in2->q, a);
 }
 
+static void
+hanimBlendCB(void *vout, void *vin1, void *vin2, float32 a)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimInterpFrame *in1 = (HAnimInterpFrame*)vin1;
+	HAnimInterpFrame *in2 = (HAnimInterpFrame*)vin2;
+	out->t = lerp(in1->t, in2->t, a);
+	out->q = slerp(in1->q, in2->q, a);
+}
+
+// in2 is relative to in1
+static void
+hanimAddCB(void *vout, void *vin1, void *vin2)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimInterpFrame *in1 = (HAnimInterpFrame*)vin1;
+	HAnimInterpFrame *in2 = (HAnimInterpFrame*)vin2;
+	out->t = add(in1->t, in2->t);
+	out->q = mult(in1->q, in2->q);
+}
+
+// make frame relative to start
+static void
+hanimMulRecipCB(void *vframe, void *vstart)
+{
+	HAnimKeyFrame *frame = (HAnimKeyFrame*)vframe;
+	HAnimKeyFrame *start = (HAnimKeyFrame*)vstart;
+	frame->t = sub(frame->t, start->t);
+	frame->q = mult(conj(start->q), frame->q);
+}
+
+//
+// Compressed keyframes
+//
+
+#define SQRT1_2 0.70710678f
+// 15 bits for every component of the smallest three
+#define QUATSCALE (SQRT1_2*2.0f/32767.0f)
+
+static void
+compressQuat(uint16 *dst, Quat q)
+{
+	float32 *c = (float32*)&q;
+	int32 i, j, largest = 0;
+	for(i = 1; i < 4; i++)
+		if(fabsf(c[i]) > fabsf(c[largest]))
+			largest = i;
+	// q and -q are the same rotation, so the largest is always positive
+	float32 sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+	for(i = 0, j = 0; i < 4; i++){
+		if(i == largest)
+			continue;
+		int32 v = (c[i]*sign + SQRT1_2)/QUATSCALE + 0.5f;
+		dst[j++] = v < 0 ? 0 : v > 0x7FFF ? 0x7FFF : v;
+	}
+	dst[0] |= (largest & 1) << 15;
+	dst[1] |= (largest >> 1) << 15;
+}
+
+static void
+compressTrans(uint16 *dst, const V3d &t, HAnimCompressedCustomData *cust)
+{
+	const float32 *c = &t.x;
+	const float32 *off = &cust->offset.x;
+	const float32 *scl = &cust->scale.x;
+	for(int32 i = 0; i < 3; i++){
+		int32 v = scl[i] > 0.0f ? (c[i] - off[i])/scl[i] + 0.5f : 0;
+		dst[i] = v < 0 ? 0 : v > 0xFFFF ? 0xFFFF : v;
+	}
+}
+
+// the three quaternion components and the translation
+static void
+decompressComponents(float32 *q, float32 *t, HAnimCompressedKeyFrame *kf, HAnimCompressedCustomData *cust)
+{
+#if defined(RW_SSE2)
+	// q[0] q[1] q[2] t[0] | t[1] t[2]
+	int32 t12;
+	memcpy(&t12, &kf->t[1], 4);
+	__m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((__m128i*)kf->q),
+		_mm_cvtsi32_si128(t12));
+	__m128i lo = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+	__m128i hi = _mm_unpackhi_epi16(v, _mm_setzero_si128());
+	lo = _mm_and_si128(lo, _mm_set_epi32(0xFFFF, 0x7FFF, 0x7FFF, 0x7FFF));
+	__m128 flo = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo),
+			_mm_set_ps(cust->scale.x, QUATSCALE, QUATSCALE, QUATSCALE)),
+		_mm_set_ps(cust->offset.x, -SQRT1_2, -SQRT1_2, -SQRT1_2));
+	__m128 fhi = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi),
+			_mm_set_ps(0.0f, 0.0f, cust->scale.z, cust->scale.y)),
+		_mm_set_ps(0.0f, 0.0f, cust->offset.z, cust->offset.y));
+	float32 f[8];
+	_mm_storeu_ps(f, flo);
+	_mm_storeu_ps(f+4, fhi);
+	q[0] = f[0]; q[1] = f[1]; q[2] = f[2];
+	t[0] = f[3]; t[1] = f[4]; t[2] = f[5];
+#elif defined(RW_NEON)
+	// q[0] q[1] q[2] t[0]
+	static const uint32 mask[4] = { 0x7FFF, 0x7FFF, 0x7FFF, 0xFFFF };
+	float32 scl[4] = { QUATSCALE, QUATSCALE, QUATSCALE, cust->scale.x };
+	float32 off[4] = { -SQRT1_2, -SQRT1_2, -SQRT1_2, cust->offset.x };
+	uint32x4_t lo = vandq_u32(vmovl_u16(vld1_u16(kf->q)), vld1q_u32(mask));
+	float32x4_t flo = vmlaq_f32(vld1q_f32(off), vcvtq_f32_u32(lo), vld1q_f32(scl));
+	float32 f[4];
+	vst1q_f32(f, flo);
+	q[0] = f[0]; q[1] = f[1]; q[2] = f[2];
+	t[0] = f[3];
+	t[1] = kf->t[1]*cust->scale.y + cust->offset.y;
+	t[2] = kf->t[2]*cust->scale.z + cust->offset.z;
+#else
+	for(int32 i = 0; i < 3; i++)
+		q[i] = (kf->q[i] & 0x7FFF)*QUATSCALE - SQRT1_2;
+	t[0] = kf->t[0]*cust->scale.x + cust->offset.x;
+	t[1] = kf->t[1]*cust->scale.y + cust->offset.y;
+	t[2] = kf->t[2]*cust->scale.z + cust->offset.z;
+#endif
+}
+
+static void
+decompressKeyFrame(Quat *q, V3d *t, HAnimCompressedKeyFrame *kf, HAnimCompressedCustomData *cust)
+{
+	float32 c[3];
+	decompressComponents(c, &t->x, kf, cust);
+	int32 largest = kf->q[0]>>15 | (kf->q[1]>>15)<<1;
+	float32 w = 1.0f - c[0]*c[0] - c[1]*c[1] - c[2]*c[2];
+	float32 *dst = (float32*)q;
+	for(int32 i = 0, j = 0; i < 4; i++)
+		dst[i] = i == largest ? (w > 0.0f ? sqrtf(w) : 0.0f) : c[j++];
+}
+
+static void
+hanimCompressedInterpCB(void *vout, void *vin1, void *vin2, float32 t, void *custom)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimCompressedKeyFrame *in1 = (HAnimCompressedKeyFrame*)vin1;
+	HAnimCompressedKeyFrame *in2 = (HAnimCompressedKeyFrame*)vin2;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)custom;
+	Quat q1, q2;
+	V3d t1, t2;
+	decompressKeyFrame(&q1, &t1, in1, cust);
+	decompressKeyFrame(&q2, &t2, in2, cust);
+	float32 a = in2->time > in1->time ? (t - in1->time)/(in2->time - in1->time) : 0.0f;
+	out->t = lerp(t1, t2, a);
+	out->q = slerp(q1, q2, a);
+}
+
+// time is stored as 16 bit fraction of the duration
+static void
+hAnimCompressedFrameRead(Stream *stream, Animation *anim)
+{
+	HAnimCompressedKeyFrame *frames = (HAnimCompressedKeyFrame*)anim->keyframes;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)anim->customData;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		frames[i].time = stream->readU16()*anim->duration/0xFFFF;
+		stream->read16(frames[i].q, 3*2);
+		stream->read16(frames[i].t, 3*2);
+		frames[i].prev = &frames[stream->readI32()];
+	}
+	stream->read32(&cust->offset, 3*4);
+	stream->read32(&cust->scale, 3*4);
+}
+
+static void
+hAnimCompressedFrameWrite(Stream *stream, Animation *anim)
+{
+	HAnimCompressedKeyFrame *frames = (HAnimCompressedKeyFrame*)anim->keyframes;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)anim->customData;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		stream->writeU16(anim->duration > 0.0f ?
+			(uint16)(frames[i].time/anim->duration*0xFFFF + 0.5f) : 0);
+		stream->write16(frames[i].q, 3*2);
+		stream->write16(frames[i].t, 3*2);
+		stream->writeI32(frames[i].prev - frames);
+	}
+	stream->write32(&cust->offset, 3*4);
+	stream->write32(&cust->scale, 3*4);
+}
+
+static uint32
+hAnimCompressedFrameGetSize(Animation *anim)
+{
+	return anim->numFrames*(2 + 3*2 + 3*2 + 4) + 2*3*4;
+}
+
+// Returns a compressed copy of an HAnim animation
+Animation*
+compressHAnimAnimation(Animation *anim)
+{
+	int32 i;
+	assert(anim->interpInfo->id == 1);
+	AnimInterpolatorInfo *info = AnimInterpolatorInfo::find(HAnimCompressedKeyFrame::ANIMTYPE);
+	Animation *comp = Animation::create(info, anim->numFrames, anim->flags, anim->duration);
+	if(comp == nil)
+		return nil;
+	HAnimKeyFrame *src = (HAnimKeyFrame*)anim->keyframes;
+	HAnimCompressedKeyFrame *dst = (HAnimCompressedKeyFrame*)comp->keyframes;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)comp->customData;
+
+	V3d min, max;
+	min = max = anim->numFrames > 0 ? src[0].t : makeV3d(0.0f, 0.0f, 0.0f);
+	for(i = 1; i < anim->numFrames; i++){
+		if(src[i].t.x < min.x) min.x = src[i].t.x;
+		if(src[i].t.y < min.y) min.y = src[i].t.y;
+		if(src[i].t.z < min.z) min.z = src[i].t.z;
+		if(src[i].t.x > max.x) max.x = src[i].t.x;
+		if(src[i].t.y > max.y) max.y = src[i].t.y;
+		if(src[i].t.z > max.z) max.z = src[i].t.z;
+	}
+	cust->offset = min;
+	cust->scale = scale(sub(max, min), 1.0f/0xFFFF);
+
+	for(i = 0; i < anim->numFrames; i++){
+		// same time as after streaming
+		dst[i].time = anim->duration > 0.0f ?
+			(uint16)(src[i].time/anim->duration*0xFFFF + 0.5f)*anim->duration/0xFFFF : 0.0f;
+		dst[i].prev = &dst[src[i].prev - src];
+		compressQuat(dst[i].q, src[i].q);
+		compressTrans(dst[i].t, src[i].t, cust);
+	}
+	return comp;
+}
+
+Animation*
+decompressHAnimAnimation(Animation *anim)
+{
+	assert(anim->interpInfo->id == HAnimCompressedKeyFrame::ANIMTYPE);
+	AnimInterpolatorInfo *info = AnimInterpolatorInfo::find(1);
+	Animation *decomp = Animation::create(info, anim->numFrames, anim->flags, anim->duration);
+	if(decomp == nil)
+		return nil;
+	HAnimCompressedKeyFrame *src = (HAnimCompressedKeyFrame*)anim->keyframes;
+	HAnimKeyFrame *dst = (HAnimKeyFrame*)decomp->keyframes;
+	HAnimCompressedCustomData *cust = (HAnimCompressedCustomData*)anim->customData;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		dst[i].time = src[i].time;
+		dst[i].prev = &dst[src[i].prev - src];
+		decompressKeyFrame(&dst[i].q, &dst[i].t, &src[i], cust);
+	}
+	return decomp;
+}
+
+//
+// Baked keyframes
+//
+
+// first and last sample are at 0 and duration
+static float32
+getBakedSampleTime(Animation *anim, int32 s)
+{
+	HAnimBakedCustomData *cust = (HAnimBakedCustomData*)anim->customData;
+	return (float32)s/(cust->numSamples-1)*anim->duration;
+}
+
+static void
+setBakedKeyFrameLinks(Animation *anim)
+{
+	HAnimBakedCustomData *cust = (HAnimBakedCustomData*)anim->customData;
+	HAnimBakedKeyFrame *frames = (HAnimBakedKeyFrame*)anim->keyframes;
+	for(int32 s = 0; s < cust->numSamples; s++)
+		for(int32 n = 0; n < cust->numNodes; n++){
+			HAnimBakedKeyFrame *kf = &frames[s*cust->numNodes + n];
+			kf->time = getBakedSampleTime(anim, s);
+			kf->prev = s > 0 ? kf - cust->numNodes : nil;
+		}
+}
+
+// in2 and the time of in1 are only used to find the node,
+// the interpolator may not have advanced them for this time
+static void
+hanimBakedInterpCB(void *vout, void *vin1, void*, float32 t, void *custom)
+{
+	HAnimInterpFrame *out = (HAnimInterpFrame*)vout;
+	HAnimBakedKeyFrame *in1 = (HAnimBakedKeyFrame*)vin1;
+	HAnimBakedCustomData *cust = (HAnimBakedCustomData*)custom;
+	float32 f = t*cust->rate;
+	int32 s = (int32)f;
+	if(s > cust->numSamples-2) s = cust->numSamples-2;
+	if(s < 0) s = 0;
+	float32 a = f - s;
+	if(a < 0.0f) a = 0.0f;
+	if(a > 1.0f) a = 1.0f;
+	int32 s1 = (int32)(in1->time*cust->rate + 0.5f);
+	HAnimBakedKeyFrame *kf1 = in1 + (s - s1)*cust->numNodes;
+	HAnimBakedKeyFrame *kf2 = kf1 + cust->numNodes;
+	out->t = lerp(kf1->t, kf2->t, a);
+	// samples are in the same hemisphere and close enough not to slerp
+	out->q = normalize(add(kf1->q, scale(sub(kf2->q, kf1->q), a)));
+}
+
+// time and prev of the keyframes are not stored
+static void
+hAnimBakedFrameRead(Stream *stream, Animation *anim)
+{
+	HAnimBakedKeyFrame *frames = (HAnimBakedKeyFrame*)anim->keyframes;
+	HAnimBakedCustomData *cust = (HAnimBakedCustomData*)anim->customData;
+	cust->rate = stream->readF32();
+	cust->numNodes = stream->readI32();
+	cust->numSamples = stream->readI32();
+	for(int32 i = 0; i < anim->numFrames; i++){
+		stream->read32(&frames[i].q, 4*4);
+		stream->read32(&frames[i].t, 3*4);
+	}
+	setBakedKeyFrameLinks(anim);
+}
+
+static void
+hAnimBakedFrameWrite(Stream *stream, Animation *anim)
+{
+	HAnimBakedKeyFrame *frames = (HAnimBakedKeyFrame*)anim->keyframes;
+	HAnimBakedCustomData *cust = (HAnimBakedCustomData*)anim->customData;
+	stream->writeF32(cust->rate);
+	stream->writeI32(cust->numNodes);
+	stream->writeI32(cust->numSamples);
+	for(int32 i = 0; i < anim->numFrames; i++){
+		stream->write32(&frames[i].q, 4*4);
+		stream->write32(&frames[i].t, 3*4);
+	}
+}
+
+static uint32
+hAnimBakedFrameGetSize(Animation *anim)
+{
+	return 4 + 4 + 4 + anim->numFrames*(4*4 + 3*4);
+}
+
+// Returns a copy of an HAnim animation of any type sampled
+// rate times per second, which costs more memory but
+// interpolates without following the keyframes.
+Animation*
+bakeHAnimAnimation(Animation *anim, float32 rate)
+{
+	int32 s, n;
+	if(anim->interpInfo->applyCB != hanimApplyCB){
+		RWERROR((ERR_GENERAL, "not an HAnim animation"));
+		return nil;
+	}
+	int32 numNodes = anim->getNumNodes();
+	int32 numSamples = (int32)ceilf(anim->duration*rate) + 1;
+	if(numSamples < 2)
+		numSamples = 2;
+	AnimInterpolatorInfo *info = AnimInterpolatorInfo::find(HAnimBakedKeyFrame::ANIMTYPE);
+	Animation *baked = Animation::create(info, numNodes*numSamples, anim->flags, anim->duration);
+	if(baked == nil)
+		return nil;
+	HAnimBakedCustomData *cust = (HAnimBakedCustomData*)baked->customData;
+	cust->rate = anim->duration > 0.0f ? (numSamples-1)/anim->duration : 0.0f;
+	cust->numNodes = numNodes;
+	cust->numSamples = numSamples;
+	setBakedKeyFrameLinks(baked);
+
+	AnimInterpolator *interp = AnimInterpolator::create(numNodes, sizeof(HAnimInterpFrame));
+	if(interp == nil){
+		baked->destroy();
+		return nil;
+	}
+	interp->setCurrentAnim(anim);
+	HAnimBakedKeyFrame *dst = (HAnimBakedKeyFrame*)baked->keyframes;
+	for(s = 0; s < numSamples; s++){
+		// exact, so the last sample is at duration and doesn't wrap
+		interp->addTime(getBakedSampleTime(baked, s) - interp->currentTime);
+		for(n = 0; n < numNodes; n++){
+			HAnimInterpFrame *f = (HAnimInterpFrame*)interp->getInterpFrame(n);
+			dst->q = f->q;
+			if(s > 0 && dot(dst->q, dst[-numNodes].q) < 0.0f)
+				dst->q = negate(dst->q);
+			dst->t = f->t;
+			dst++;
+		}
+	}
+	interp->destroy();
+	return baked;
+}
+
 static void*
 hanimOpen(void *object, int32 offset, int32 size)
 {
@@ -379,14 +932,44 @@ hanimOpen(void *object, int32 offset, int32 size)
 	info->animKeyFrameSize = sizeof(HAnimKeyFrame);
 	info->customDataSize = 0;
 	info->applyCB = hanimApplyCB;
-	info->blendCB = nil;
+	info->blendCB = hanimBlendCB;
 	info->interpCB = hanimInterpCB;
-	info->addCB = nil;
-	info->mulRecipCB = nil;
+	info->addCB = hanimAddCB;
+	info->mulRecipCB = hanimMulRecipCB;
 	info->streamRead = hAnimFrameRead;
 	info->streamWrite = hAnimFrameWrite;
 	info->streamGetSize = hAnimFrameGetSize;
 	AnimInterpolatorInfo::registerInterp(info);
+
+	info = rwNewT(AnimInterpolatorInfo, 1, MEMDUR_GLOBAL | ID_HANIM);
+	info->id = HAnimCompressedKeyFrame::ANIMTYPE;
+	info->interpKeyFrameSize = sizeof(HAnimInterpFrame);
+	info->animKeyFrameSize = sizeof(HAnimCompressedKeyFrame);
+	info->customDataSize = sizeof(HAnimCompressedCustomData);
+	info->applyCB = hanimApplyCB;
+	info->blendCB = hanimBlendCB;
+	info->interpCB = hanimCompressedInterpCB;
+	info->addCB = hanimAddCB;
+	info->mulRecipCB = nil;
+	info->streamRead = hAnimCompressedFrameRead;
+	info->streamWrite = hAnimCompressedFrameWrite;
+	info->streamGetSize = hAnimCompressedFrameGetSize;
+	AnimInterpolatorInfo::registerInterp(info);
+
+	info = rwNewT(AnimInterpolatorInfo, 1, MEMDUR_GLOBAL | ID_HANIM);
+	info->id = HAnimBakedKeyFrame::ANIMTYPE;
+	info->interpKeyFrameSize = sizeof(HAnimInterpFrame);
+	info->animKeyFrameSize = sizeof(HAnimBakedKeyFrame);
+	info->customDataSize = sizeof(HAnimBakedCustomData);
+	info->applyCB = hanimApplyCB;
+	info->blendCB = hanimBlendCB;
+	info->interpCB = hanimBakedInterpCB;
+	info->addCB = hanimAddCB;
+	info->mulRecipCB = hanimMulRecipCB;
+	info->streamRead = hAnimBakedFrameRead;
+	info->streamWrite = hAnimBakedFrameWrite;
+	info->streamGetSize = hAnimBakedFrameGetSize;
+	AnimInterpolatorInfo::registerInterp(info);
 	return object;
 }
 
@@ -394,6 +977,8 @@ static void*
 hanimClose(void *object, int32 offset, int32 size)
 {
 	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(1));
+	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(HAnimCompressedKeyFrame::ANIMTYPE));
+	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(HAnimBakedKeyFrame::ANIMTYPE));
 	return object;
 }
 
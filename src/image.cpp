@@ -15,11 +15,22 @@
 #include "d3d/rwd3d8.h"
 #include "d3d/rwd3d9.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+
 #define PLUGIN_ID ID_IMAGE
 
 namespace rw {
 
 int32 Image::numAllocated;
+// Images are counted here while decoding on the job threads,
+// readBatch adds them to numAllocated afterwards.
+#ifdef RW_PS2
+static int32 *jobNumAllocated;	// jobs run serially
+#else
+static thread_local int32 *jobNumAllocated;
+#endif
 
 struct FileAssociation
 {
@@ -55,7 +66,10 @@ Image::create(int32 width, int32 height, int32 depth)
 		RWERROR((ERR_ALLOC, sizeof(Image)));
 		return nil;
 	}
-	numAllocated++;
+	if(jobNumAllocated)
+		(*jobNumAllocated)++;
+	else
+		numAllocated++;
 	img->flags = 0;
 	img->width = width;
 	img->height = height;
@@ -72,7 +86,10 @@ Image::destroy(void)
 {
 	this->free();
 	rwFree(this);
-	numAllocated--;
+	if(jobNumAllocated)
+		(*jobNumAllocated)--;
+	else
+		numAllocated--;
 }
 
 void
@@ -630,7 +647,7 @@ Image::convertTo32(void)
 	int32 newstride = this->width*4;
 	uint8 *newpixels;
 
-	void (*fun)(uint8 *out, uint8 *in) = nil;
+	int32 layout;
 	switch(this->depth){
 	case 4:
 	case 8:
@@ -638,10 +655,10 @@ Image::convertTo32(void)
 		this->unpalettize(true);
 		return;
 	case 16:
-		fun = conv_RGBA8888_from_ARGB1555;
+		layout = PIXEL_ARGB1555;
 		break;
 	case 24:
-		fun = conv_RGBA8888_from_RGB888;
+		layout = PIXEL_RGB888;
 		break;
 	default:
 		return;
@@ -649,17 +666,8 @@ Image::convertTo32(void)
 
 	newpixels = rwNewT(uint8, newstride*this->height, MEMDUR_EVENT | ID_IMAGE);
 	uint8 *pixels32 = newpixels;
-	for(int y = 0; y < this->height; y++){
-		uint8 *line = pixels;
-		uint8 *newline = newpixels;
-		for(int x = 0; x < this->width; x++){
-			fun(newline, line);
-			line += this->bpp;
-			newline += 4;
-		}
-		pixels += this->stride;
-		newpixels += newstride;
-	}
+	convertPixels(newpixels, newstride, PIXEL_RGBA8888,
+		pixels, this->stride, layout, this->width, this->height);
 
 	this->free();
 	this->depth = 32;
@@ -894,6 +902,159 @@ Image::extractMask(void)
 	return img;
 }
 
+/*
+ * Mipmap generation
+ */
+
+// Color channels are averaged in linear space, alpha is linear already.
+static float32 srgbToLinear[256];
+static uint8 linearToSrgb[4096];
+static bool mipTablesDone;
+
+static void
+initMipTables(void)
+{
+	int32 i;
+	float32 c;
+	if(mipTablesDone)
+		return;
+	for(i = 0; i < 256; i++){
+		c = i/255.0f;
+		srgbToLinear[i] = c <= 0.04045f ? c/12.92f : powf((c+0.055f)/1.055f, 2.4f);
+	}
+	for(i = 0; i < 4096; i++){
+		c = i/4095.0f;
+		c = c <= 0.0031308f ? c*12.92f : 1.055f*powf(c, 1.0f/2.4f) - 0.055f;
+		linearToSrgb[i] = (uint8)(c*255.0f + 0.5f);
+	}
+	mipTablesDone = true;
+}
+
+// 2x2 box filter of one destination row.
+// s0 and s1 are the source rows, x1 the rightmost source pixel.
+static void
+downsampleRow(uint8 *dst, uint8 *s0, uint8 *s1, int32 w, int32 x1)
+{
+	int32 x, a, b;
+#ifdef RW_SSE2
+	const __m128 scl = _mm_set_ps(255.0f*0.25f, 4095.0f*0.25f, 4095.0f*0.25f, 4095.0f*0.25f);
+	RWALIGN(16) int32 res[4];
+	for(x = 0; x < w; x++){
+		a = 2*x*4;
+		b = (2*x+1 > x1 ? x1 : 2*x+1)*4;
+		__m128 sum = _mm_set_ps(s0[a+3], srgbToLinear[s0[a+2]], srgbToLinear[s0[a+1]], srgbToLinear[s0[a]]);
+		sum = _mm_add_ps(sum, _mm_set_ps(s0[b+3], srgbToLinear[s0[b+2]], srgbToLinear[s0[b+1]], srgbToLinear[s0[b]]));
+		sum = _mm_add_ps(sum, _mm_set_ps(s1[a+3], srgbToLinear[s1[a+2]], srgbToLinear[s1[a+1]], srgbToLinear[s1[a]]));
+		sum = _mm_add_ps(sum, _mm_set_ps(s1[b+3], srgbToLinear[s1[b+2]], srgbToLinear[s1[b+1]], srgbToLinear[s1[b]]));
+		// alpha is summed as 0-255, colors as 0-1
+		sum = _mm_mul_ps(sum, _mm_set_ps(1.0f/255.0f, 1.0f, 1.0f, 1.0f));
+		_mm_store_si128((__m128i*)res, _mm_cvtps_epi32(_mm_mul_ps(sum, scl)));
+		dst[0] = linearToSrgb[res[0]];
+		dst[1] = linearToSrgb[res[1]];
+		dst[2] = linearToSrgb[res[2]];
+		dst[3] = (uint8)res[3];
+		dst += 4;
+	}
+#else
+	int32 i;
+	float32 c;
+	for(x = 0; x < w; x++){
+		a = 2*x*4;
+		b = (2*x+1 > x1 ? x1 : 2*x+1)*4;
+		for(i = 0; i < 3; i++){
+			c = srgbToLinear[s0[a+i]] + srgbToLinear[s0[b+i]] +
+			    srgbToLinear[s1[a+i]] + srgbToLinear[s1[b+i]];
+			dst[i] = linearToSrgb[(int32)(c*4095.0f*0.25f + 0.5f)];
+		}
+		dst[3] = (s0[a+3] + s0[b+3] + s1[a+3] + s1[b+3] + 2)/4;
+		dst += 4;
+	}
+#endif
+}
+
+Image*
+Image::createMipmap(void)
+{
+	assert(this->depth == 32);
+	initMipTables();
+
+	int32 w = this->width > 1 ? this->width/2 : 1;
+	int32 h = this->height > 1 ? this->height/2 : 1;
+	Image *mip = Image::create(w, h, 32);
+	if(mip == nil)
+		return nil;
+	mip->allocate();
+
+	for(int32 y = 0; y < h; y++){
+		uint8 *s0 = this->pixels + 2*y*this->stride;
+		uint8 *s1 = 2*y+1 < this->height ? s0 + this->stride : s0;
+		downsampleRow(mip->pixels + y*mip->stride, s0, s1, w, this->width-1);
+	}
+	return mip;
+}
+
+// fraction of pixels that pass an alpha test with alphaRef
+float32
+Image::getAlphaCoverage(int32 alphaRef)
+{
+	assert(this->depth == 32);
+	int32 n = 0;
+	uint8 *line = this->pixels;
+	for(int32 y = 0; y < this->height; y++){
+		for(int32 x = 0; x < this->width; x++)
+			if(line[x*4+3] >= alphaRef)
+				n++;
+		line += this->stride;
+	}
+	return (float32)n/(this->width*this->height);
+}
+
+// Scale alpha so that alpha testing covers about the same area as
+// on the base level. Otherwise cutouts fade away in the distance.
+void
+Image::scaleAlphaToCoverage(float32 coverage, int32 alphaRef)
+{
+	assert(this->depth == 32);
+	int32 x, y, i;
+	int32 hist[256];
+	uint8 *line;
+
+	memset(hist, 0, sizeof(hist));
+	line = this->pixels;
+	for(y = 0; y < this->height; y++){
+		for(x = 0; x < this->width; x++)
+			hist[line[x*4+3]]++;
+		line += this->stride;
+	}
+
+	// binary search for the scale on the alpha histogram
+	float32 lo = 0.0f, hi = 4.0f, scale = 1.0f;
+	float32 n = (float32)(this->width*this->height);
+	for(i = 0; i < 10; i++){
+		int32 pass = 0;
+		for(x = 1; x < 256; x++)
+			if(x*scale >= alphaRef)
+				pass += hist[x];
+		if(pass/n < coverage)
+			lo = scale;
+		else
+			hi = scale;
+		scale = (lo + hi)*0.5f;
+	}
+
+	uint8 map[256];
+	for(x = 0; x < 256; x++){
+		float32 a = x*scale + 0.5f;
+		map[x] = a > 255.0f ? 255 : (uint8)a;
+	}
+	line = this->pixels;
+	for(y = 0; y < this->height; y++){
+		for(x = 0; x < this->width; x++)
+			line[x*4+3] = map[line[x*4+3]];
+		line += this->stride;
+	}
+}
+
 void
 Image::setSearchPath(const char *path)
 {
@@ -1021,6 +1182,56 @@ Image::read(const char *imageName)
 	return nil;
 }
 
+struct ImageBatch
+{
+	const char **names;
+	Image **images;
+	int32 *numAllocated;	// per job
+	Error *errors;	// per job
+};
+
+static void
+readBatchJob(int32 i, void *data)
+{
+	ImageBatch *batch = (ImageBatch*)data;
+	Error e;
+	getError(&e);	// clear what earlier jobs on this thread left
+	batch->numAllocated[i] = 0;
+	jobNumAllocated = &batch->numAllocated[i];
+	batch->images[i] = batch->names[i] ? Image::read(batch->names[i]) : nil;
+	jobNumAllocated = nil;
+	getError(&batch->errors[i]);
+}
+
+// Read and decode a number of images on the job threads.
+// images[i] is nil for images that couldn't be read.
+// The error of the last image that had one is set afterwards.
+// Returns the number of images read.
+int32
+Image::readBatch(const char **imageNames, int32 n, Image **images)
+{
+	ImageBatch batch;
+	int32 i, numRead;
+
+	batch.names = imageNames;
+	batch.images = images;
+	batch.numAllocated = rwNewT(int32, n, MEMDUR_FUNCTION | ID_IMAGE);
+	batch.errors = rwNewT(Error, n, MEMDUR_FUNCTION | ID_IMAGE);
+	runJobs(readBatchJob, n, &batch);
+
+	numRead = 0;
+	for(i = 0; i < n; i++){
+		numAllocated += batch.numAllocated[i];
+		if(batch.errors[i].code)
+			setError(&batch.errors[i]);
+		if(images[i])
+			numRead++;
+	}
+	rwFree(batch.numAllocated);
+	rwFree(batch.errors);
+	return numRead;
+}
+
 bool32
 Image::registerFileFormat(const char *ext, fileRead read, fileWrite write)
 {
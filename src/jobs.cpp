@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef RW_PS2
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#endif
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwengine.h"
+
+#define PLUGIN_ID 0
+
+// A very simple worker pool. The calling thread takes part in the work
+// and only one batch of jobs is running at any time.
+
+namespace rw {
+
+#ifndef RW_PS2
+
+struct JobBatch
+{
+	JobFunc func;
+	void *data;
+	int32 n;
+	std::atomic<int32> next;
+	std::atomic<int32> done;
+};
+
+struct JobGlobals
+{
+	std::mutex mutex;
+	std::condition_variable workCond;
+	std::condition_variable doneCond;
+	std::thread *threads;
+	int32 numThreads;	// running worker threads
+	int32 wantThreads;	// including the caller, 0 = one per core
+	JobBatch *batch;
+	uint32 serial;
+	int32 busy;
+	bool quit;
+};
+// Never destroyed: destroying the condition variables while workers
+// wait on them would hang at exit if Engine::close wasn't called.
+static JobGlobals &jobGlobals = *new JobGlobals();
+static thread_local bool inJob;
+
+static void
+doJobs(JobBatch *b)
+{
+	int32 i;
+	inJob = true;
+	while(i = b->next++, i < b->n){
+		b->func(i, b->data);
+		b->done++;
+	}
+	inJob = false;
+}
+
+static void
+workerMain(void)
+{
+	JobGlobals *g = &jobGlobals;
+	uint32 seen = 0;
+	for(;;){
+		std::unique_lock<std::mutex> lock(g->mutex);
+		g->workCond.wait(lock, [&]{ return g->quit || g->serial != seen; });
+		if(g->quit)
+			return;
+		seen = g->serial;
+		JobBatch *b = g->batch;
+		if(b == nil)
+			continue;
+		g->busy++;
+		lock.unlock();
+
+		doJobs(b);
+
+		lock.lock();
+		g->busy--;
+		g->doneCond.notify_all();
+	}
+}
+
+static void
+stopThreads(void)
+{
+	JobGlobals *g = &jobGlobals;
+	if(g->threads == nil)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(g->mutex);
+		g->quit = true;
+	}
+	g->workCond.notify_all();
+	for(int32 i = 0; i < g->numThreads; i++)
+		g->threads[i].join();
+	delete[] g->threads;
+	g->threads = nil;
+	g->numThreads = 0;
+	g->quit = false;
+}
+
+static void
+startThreads(void)
+{
+	JobGlobals *g = &jobGlobals;
+	int32 n = g->wantThreads;
+	if(n == 0)
+		n = (int32)std::thread::hardware_concurrency();
+	// the calling thread does work too
+	n--;
+	if(n <= 0)
+		return;
+	g->threads = new std::thread[n];
+	for(int32 i = 0; i < n; i++)
+		g->threads[i] = std::thread(workerMain);
+	g->numThreads = n;
+}
+
+void
+runJobs(JobFunc func, int32 n, void *data)
+{
+	JobGlobals *g = &jobGlobals;
+	int32 i;
+
+	// Run serially if there is nothing to gain or if it's not safe:
+	// managed memory is not thread safe and jobs can't start jobs.
+	if(n <= 1 || inJob || Engine::memfuncs.rwmalloc == managedMemfuncs.rwmalloc){
+		for(i = 0; i < n; i++)
+			func(i, data);
+		return;
+	}
+	if(g->threads == nil)
+		startThreads();
+	if(g->numThreads == 0){
+		for(i = 0; i < n; i++)
+			func(i, data);
+		return;
+	}
+
+	JobBatch b;
+	b.func = func;
+	b.data = data;
+	b.n = n;
+	b.next = 0;
+	b.done = 0;
+	{
+		std::lock_guard<std::mutex> lock(g->mutex);
+		g->batch = &b;
+		g->serial++;
+	}
+	g->workCond.notify_all();
+
+	doJobs(&b);
+
+	std::unique_lock<std::mutex> lock(g->mutex);
+	g->doneCond.wait(lock, [&]{ return b.done == n && g->busy == 0; });
+	g->batch = nil;
+}
+
+void
+setNumJobThreads(int32 n)
+{
+	stopThreads();
+	jobGlobals.wantThreads = n;
+}
+
+int32
+getNumJobThreads(void)
+{
+	JobGlobals *g = &jobGlobals;
+	if(g->threads == nil)
+		startThreads();
+	return g->numThreads + 1;
+}
+
+void
+closeJobs(void)
+{
+	stopThreads();
+}
+
+#else
+
+// no threads here
+void
+runJobs(JobFunc func, int32 n, void *data)
+{
+	for(int32 i = 0; i < n; i++)
+		func(i, data);
+}
+
+void setNumJobThreads(int32) {}
+int32 getNumJobThreads(void) { return 1; }
+void closeJobs(void) {}
+
+#endif
+
+}
@@ -0,0 +1,645 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwanim.h"
+#include "rwengine.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID ID_LODATOMIC
+
+// Mesh simplification by half edge collapses ordered by quadric error,
+// after Garland and Heckbert's "Surface Simplification Using Quadric
+// Error Metrics". A vertex collapses onto one of its neighbours and
+// takes over all of its attributes, so nothing has to be interpolated.
+// Vertices on seams (the same position with different normals, UVs
+// or colors) and on material boundaries never move, vertices on
+// open borders only along the border.
+
+namespace rw {
+
+// Every vertex's quadric is relative to its own position, which
+// never changes with half edge collapses. That keeps the float
+// precision where the errors are, not at the mesh's distance to the origin.
+struct Quadric
+{
+	float32 a00, a11, a22, a01, a02, a12;
+	float32 b0, b1, b2;
+	float32 c;
+
+	// plane n.p + d = 0
+	void addPlane(const V3d &n, float32 d, float32 w){
+		a00 += w*n.x*n.x; a11 += w*n.y*n.y; a22 += w*n.z*n.z;
+		a01 += w*n.x*n.y; a02 += w*n.x*n.z; a12 += w*n.y*n.z;
+		b0 += w*n.x*d; b1 += w*n.y*d; b2 += w*n.z*d;
+		c += w*d*d;
+	}
+	// add q whose origin is at -t from this one's
+	void add(const Quadric &q, const V3d &t){
+		a00 += q.a00; a11 += q.a11; a22 += q.a22;
+		a01 += q.a01; a02 += q.a02; a12 += q.a12;
+		b0 += q.b0 + q.a00*t.x + q.a01*t.y + q.a02*t.z;
+		b1 += q.b1 + q.a01*t.x + q.a11*t.y + q.a12*t.z;
+		b2 += q.b2 + q.a02*t.x + q.a12*t.y + q.a22*t.z;
+		c += q.eval(t);
+	}
+	// squared distance to the planes
+	float32 eval(const V3d &p) const {
+		float32 x = p.x, y = p.y, z = p.z;
+		float32 e = a00*x*x + a11*y*y + a22*z*z +
+			2.0f*(a01*x*y + a02*x*z + a12*y*z) +
+			2.0f*(b0*x + b1*y + b2*z) + c;
+		return e < 0.0f ? 0.0f : e;
+	}
+};
+
+enum {
+	VERT_MANIFOLD,
+	VERT_BORDER,
+	VERT_LOCKED
+};
+
+// border edges weigh more than triangles so the outline stays in place
+#define BORDERWEIGHT 10.0f
+// minimum cosine between a triangle's normal before and after a collapse
+#define MINFLIPCOS 0.2f
+
+struct Collapse
+{
+	float32 cost;
+	int32 u, v;	// move u to v
+};
+
+static int
+collapseCmp(const void *a, const void *b)
+{
+	float32 ca = ((Collapse*)a)->cost;
+	float32 cb = ((Collapse*)b)->cost;
+	return ca < cb ? -1 : ca > cb ? 1 : 0;
+}
+
+struct Simplifier
+{
+	int32 numVertices;
+	int32 numTriangles;
+	uint32 *tris;
+	uint16 *matIds;
+	V3d *pos;
+	Quadric *quadrics;
+	bool32 unweighted;	// every plane counts at least once, for a distance bound
+	uint8 *locked;
+	uint8 *kind;
+	int32 *bones;	// dominant skin bone per vertex, or nil
+	int32 *adjOffsets;
+	int32 *adjTris;
+
+	void buildAdjacency(void);
+	bool32 hasEdge(int32 u, int32 v);
+	void classify(void);
+	void initQuadrics(void);
+	bool32 flips(int32 u, int32 v);
+	int32 findCollapses(Collapse *collapses, float32 maxCost);
+	int32 collapse(Collapse *collapses, int32 numCollapses, int32 target, int32 *remap, uint8 *touched);
+};
+
+// triangles around each vertex
+void
+Simplifier::buildAdjacency(void)
+{
+	int32 i, j;
+	memset(this->adjOffsets, 0, (this->numVertices+1)*sizeof(int32));
+	for(i = 0; i < this->numTriangles*3; i++)
+		this->adjOffsets[this->tris[i]+1]++;
+	for(i = 0; i < this->numVertices; i++)
+		this->adjOffsets[i+1] += this->adjOffsets[i];
+	for(i = 0; i < this->numTriangles; i++)
+		for(j = 0; j < 3; j++)
+			this->adjTris[this->adjOffsets[this->tris[i*3+j]]++] = i;
+	// the fill moved every offset to the next vertex
+	for(i = this->numVertices; i > 0; i--)
+		this->adjOffsets[i] = this->adjOffsets[i-1];
+	this->adjOffsets[0] = 0;
+}
+
+// is there a triangle with the directed edge u->v?
+bool32
+Simplifier::hasEdge(int32 u, int32 v)
+{
+	for(int32 i = this->adjOffsets[u]; i < this->adjOffsets[u+1]; i++){
+		uint32 *t = &this->tris[this->adjTris[i]*3];
+		if((t[0] == (uint32)u && t[1] == (uint32)v) ||
+		   (t[1] == (uint32)u && t[2] == (uint32)v) ||
+		   (t[2] == (uint32)u && t[0] == (uint32)v))
+			return 1;
+	}
+	return 0;
+}
+
+// A vertex with exactly one open edge going in and
+// one going out is on a border, more than that is locked.
+void
+Simplifier::classify(void)
+{
+	for(int32 v = 0; v < this->numVertices; v++){
+		if(this->locked[v]){
+			this->kind[v] = VERT_LOCKED;
+			continue;
+		}
+		int32 numOpen = 0;
+		for(int32 i = this->adjOffsets[v]; i < this->adjOffsets[v+1]; i++){
+			uint32 *t = &this->tris[this->adjTris[i]*3];
+			int32 k = t[0] == (uint32)v ? 0 : t[1] == (uint32)v ? 1 : 2;
+			if(!this->hasEdge(t[(k+1)%3], v))
+				numOpen++;
+			if(!this->hasEdge(v, t[(k+2)%3]))
+				numOpen++;
+		}
+		this->kind[v] = numOpen == 0 ? VERT_MANIFOLD :
+		                numOpen == 2 ? VERT_BORDER : VERT_LOCKED;
+	}
+}
+
+void
+Simplifier::initQuadrics(void)
+{
+	memset(this->quadrics, 0, this->numVertices*sizeof(Quadric));
+	for(int32 i = 0; i < this->numTriangles; i++){
+		uint32 *t = &this->tris[i*3];
+		V3d p0 = this->pos[t[0]];
+		V3d n = cross(sub(this->pos[t[1]], p0), sub(this->pos[t[2]], p0));
+		float32 area = length(n);
+		if(area == 0.0f)
+			continue;
+		n = scale(n, 1.0f/area);
+		float32 w = this->unweighted ? 1.0f : area*0.5f;
+		for(int32 j = 0; j < 3; j++)
+			this->quadrics[t[j]].addPlane(n, -dot(n, sub(p0, this->pos[t[j]])), w);
+
+		// a plane through open edges, perpendicular to the triangle
+		for(int32 j = 0; j < 3; j++){
+			uint32 a = t[j], b = t[(j+1)%3];
+			if(this->hasEdge(b, a))
+				continue;
+			V3d e = sub(this->pos[b], this->pos[a]);
+			float32 len = length(e);
+			if(len == 0.0f)
+				continue;
+			V3d en = normalize(cross(e, n));
+			float32 ew = this->unweighted ? BORDERWEIGHT : len*len*BORDERWEIGHT;
+			this->quadrics[a].addPlane(en, 0.0f, ew);
+			this->quadrics[b].addPlane(en, dot(en, e), ew);
+		}
+	}
+}
+
+// would moving u to v fold over any of u's triangles?
+bool32
+Simplifier::flips(int32 u, int32 v)
+{
+	for(int32 i = this->adjOffsets[u]; i < this->adjOffsets[u+1]; i++){
+		uint32 *t = &this->tris[this->adjTris[i]*3];
+		if(t[0] == (uint32)v || t[1] == (uint32)v || t[2] == (uint32)v)
+			continue;	// collapses
+		int32 k = t[0] == (uint32)u ? 0 : t[1] == (uint32)u ? 1 : 2;
+		V3d p1 = this->pos[t[(k+1)%3]];
+		V3d p2 = this->pos[t[(k+2)%3]];
+		V3d n0 = cross(sub(p1, this->pos[u]), sub(p2, this->pos[u]));
+		V3d n1 = cross(sub(p1, this->pos[v]), sub(p2, this->pos[v]));
+		float32 d = dot(n0, n1);
+		if(d <= 0.0f || d*d < MINFLIPCOS*MINFLIPCOS*dot(n0, n0)*dot(n1, n1))
+			return 1;
+	}
+	return 0;
+}
+
+// cheapest collapse of every vertex that can move
+int32
+Simplifier::findCollapses(Collapse *collapses, float32 maxCost)
+{
+	int32 n = 0;
+	for(int32 u = 0; u < this->numVertices; u++){
+		if(this->kind[u] == VERT_LOCKED)
+			continue;
+		Collapse best;
+		best.cost = maxCost;
+		best.v = -1;
+		for(int32 i = this->adjOffsets[u]; i < this->adjOffsets[u+1]; i++){
+			uint32 *t = &this->tris[this->adjTris[i]*3];
+			for(int32 j = 0; j < 3; j++){
+				int32 v = t[j];
+				if(v == u)
+					continue;
+				// border vertices must stay on the border
+				if(this->kind[u] == VERT_BORDER &&
+				   (this->kind[v] == VERT_MANIFOLD ||
+				    this->hasEdge(u, v) == this->hasEdge(v, u)))
+					continue;
+				if(this->bones && this->bones[u] != this->bones[v])
+					continue;
+				float32 cost = this->quadrics[u].eval(sub(this->pos[v], this->pos[u])) +
+				               this->quadrics[v].c;
+				if(cost <= best.cost){
+					best.cost = cost;
+					best.v = v;
+				}
+			}
+		}
+		if(best.v >= 0){
+			best.u = u;
+			collapses[n++] = best;
+		}
+	}
+	return n;
+}
+
+// Do the collapses in order of cost until target triangles are left,
+// every vertex takes part in at most one per pass so the adjacency stays valid.
+// Returns the triangles left.
+int32
+Simplifier::collapse(Collapse *collapses, int32 numCollapses, int32 target, int32 *remap, uint8 *touched)
+{
+	int32 i, j;
+	int32 numTris = this->numTriangles;
+	memset(touched, 0, this->numVertices);
+	for(i = 0; i < this->numVertices; i++)
+		remap[i] = i;
+	for(i = 0; i < numCollapses && numTris > target; i++){
+		int32 u = collapses[i].u;
+		int32 v = collapses[i].v;
+		if(touched[u] || touched[v] || this->flips(u, v))
+			continue;
+		remap[u] = v;
+		this->quadrics[v].add(this->quadrics[u], sub(this->pos[v], this->pos[u]));
+		for(j = this->adjOffsets[u]; j < this->adjOffsets[u+1]; j++){
+			uint32 *t = &this->tris[this->adjTris[j]*3];
+			if(t[0] == (uint32)v || t[1] == (uint32)v || t[2] == (uint32)v)
+				numTris--;
+			touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+		}
+	}
+
+	// apply and remove collapsed triangles
+	int32 n = 0;
+	for(i = 0; i < this->numTriangles; i++){
+		uint32 a = remap[this->tris[i*3+0]];
+		uint32 b = remap[this->tris[i*3+1]];
+		uint32 c = remap[this->tris[i*3+2]];
+		if(a == b || a == c || b == c)
+			continue;
+		this->tris[n*3+0] = a;
+		this->tris[n*3+1] = b;
+		this->tris[n*3+2] = c;
+		this->matIds[n] = this->matIds[i];
+		n++;
+	}
+	return n;
+}
+
+// Lock vertices that share their position with others
+// and vertices between triangles of different materials.
+static void
+findLockedVertices(Simplifier *s)
+{
+	int32 i, j;
+	uint32 size = 16;
+	while(size < (uint32)s->numVertices*2)
+		size *= 2;
+	int32 *hash = rwNewT(int32, size + s->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	int32 *next = hash + size;
+	memset(hash, 0xFF, size*sizeof(int32));
+	memset(s->locked, 0, s->numVertices);
+	for(i = 0; i < s->numVertices; i++){
+		uint32 h = 0x811C9DC5;
+		uint8 *p = (uint8*)&s->pos[i];
+		for(j = 0; j < (int32)sizeof(V3d); j++)
+			h = (h ^ p[j]) * 0x01000193;
+		h &= size-1;
+		for(j = hash[h]; j >= 0; j = next[j])
+			if(memcmp(&s->pos[i], &s->pos[j], sizeof(V3d)) == 0)
+				s->locked[i] = s->locked[j] = 1;
+		next[i] = hash[h];
+		hash[h] = i;
+	}
+	rwFree(hash);
+
+	for(i = 0; i < s->numVertices; i++){
+		int32 first = s->adjOffsets[i];
+		for(j = first+1; j < s->adjOffsets[i+1]; j++)
+			if(s->matIds[s->adjTris[j]] != s->matIds[s->adjTris[first]]){
+				s->locked[i] = 1;
+				break;
+			}
+	}
+}
+
+// Returns a new geometry with about numTriangles triangles that keeps
+// the materials, vertex attributes and skin. Collapses that move a vertex
+// farther than maxError from the planes of the triangles it replaces
+// are not done, 0 means no limit. Planes aren't weighted by area then,
+// so the sum of squared distances bounds every single one.
+Geometry*
+Geometry::simplify(int32 targetTriangles, float32 maxError)
+{
+	int32 i, j;
+	Simplifier s;
+
+	if(this->flags & Geometry::NATIVE || this->numTriangles == 0)
+		return nil;
+
+	int32 nv = this->numVertices;
+	s.numVertices = nv;
+	s.numTriangles = this->numTriangles;
+	s.pos = this->morphTargets[0].vertices;
+	s.tris = rwNewT(uint32, this->numTriangles*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	s.matIds = rwNewT(uint16, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < this->numTriangles; i++){
+		for(j = 0; j < 3; j++)
+			s.tris[i*3+j] = this->flags & INDEX32 ?
+				this->triangles32[i].v[j] : this->triangles[i].v[j];
+		s.matIds[i] = this->flags & INDEX32 ?
+			this->triangles32[i].matId : this->triangles[i].matId;
+	}
+	s.quadrics = rwNewT(Quadric, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	s.locked = rwNewT(uint8, nv*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	s.kind = s.locked + nv;
+	uint8 *touched = s.kind + nv;
+	s.adjOffsets = rwNewT(int32, nv+1 + this->numTriangles*3 + nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+	s.adjTris = s.adjOffsets + nv+1;
+	int32 *remap = s.adjTris + this->numTriangles*3;
+	Collapse *collapses = rwNewT(Collapse, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+
+	// don't blend between bones
+	Skin *skin = skinGlobals.geoOffset ? Skin::get(this) : nil;
+	s.bones = nil;
+	if(skin){
+		s.bones = rwNewT(int32, nv, MEMDUR_FUNCTION | ID_GEOMETRY);
+		for(i = 0; i < nv; i++){
+			float *w = &skin->weights[i*4];
+			int32 k = 0;
+			for(j = 1; j < 4; j++)
+				if(w[j] > w[k])
+					k = j;
+			s.bones[i] = skin->indices[i*4+k];
+		}
+	}
+
+	s.buildAdjacency();
+	findLockedVertices(&s);
+	s.classify();
+	s.unweighted = maxError > 0.0f;
+	s.initQuadrics();
+
+	float32 maxCost = maxError > 0.0f ? maxError*maxError : 3.0e38f;
+	while(s.numTriangles > targetTriangles){
+		int32 n = s.findCollapses(collapses, maxCost);
+		if(n == 0)
+			break;
+		qsort(collapses, n, sizeof(Collapse), collapseCmp);
+		int32 numTris = s.collapse(collapses, n, targetTriangles, remap, touched);
+		if(numTris == s.numTriangles)
+			break;
+		s.numTriangles = numTris;
+		s.buildAdjacency();
+		s.classify();
+	}
+
+	// only keep the vertices that are still used
+	for(i = 0; i < nv; i++)
+		remap[i] = -1;
+	int32 numVerts = 0;
+	for(i = 0; i < s.numTriangles*3; i++)
+		if(remap[s.tris[i]] < 0)
+			remap[s.tris[i]] = numVerts++;
+
+	Geometry *geo = Geometry::create(numVerts, s.numTriangles,
+		this->flags | this->numTexCoordSets<<16);
+	geo->addMorphTargets(this->numMorphTargets-1);
+	for(i = 0; i < nv; i++){
+		int32 v = remap[i];
+		if(v < 0)
+			continue;
+		for(j = 0; j < this->numMorphTargets; j++){
+			geo->morphTargets[j].vertices[v] = this->morphTargets[j].vertices[i];
+			if(this->flags & NORMALS)
+				geo->morphTargets[j].normals[v] = this->morphTargets[j].normals[i];
+		}
+		if(this->colors)
+			geo->colors[v] = this->colors[i];
+		for(j = 0; j < this->numTexCoordSets; j++)
+			geo->texCoords[j][v] = this->texCoords[j][i];
+	}
+	for(i = 0; i < s.numTriangles; i++){
+		if(geo->flags & INDEX32){
+			for(j = 0; j < 3; j++)
+				geo->triangles32[i].v[j] = remap[s.tris[i*3+j]];
+			geo->triangles32[i].matId = s.matIds[i];
+		}else{
+			for(j = 0; j < 3; j++)
+				geo->triangles[i].v[j] = remap[s.tris[i*3+j]];
+			geo->triangles[i].matId = s.matIds[i];
+		}
+	}
+	for(i = 0; i < this->matList.numMaterials; i++)
+		geo->matList.appendMaterial(this->matList.materials[i]);
+
+	if(skin){
+		Skin *newskin = rwNewT(Skin, 1, MEMDUR_EVENT | ID_SKIN);
+		newskin->init(skin->numBones, skin->numUsedBones, numVerts);
+		newskin->numWeights = skin->numWeights;
+		memcpy(newskin->usedBones, skin->usedBones, skin->numUsedBones);
+		memcpy(newskin->inverseMatrices, skin->inverseMatrices, skin->numBones*64);
+		for(i = 0; i < nv; i++)
+			if(remap[i] >= 0){
+				memcpy(&newskin->indices[remap[i]*4], &skin->indices[i*4], 4);
+				memcpy(&newskin->weights[remap[i]*4], &skin->weights[i*4], 16);
+			}
+		Skin::set(geo, newskin);
+	}
+
+	geo->calculateBoundingSphere();
+	geo->buildMeshes();
+
+	rwFree(s.tris);
+	rwFree(s.matIds);
+	rwFree(s.quadrics);
+	rwFree(s.locked);
+	rwFree(s.adjOffsets);
+	rwFree(s.bones);
+	rwFree(collapses);
+	return geo;
+}
+
+//
+// LOD atomics
+//
+
+int32 lodAtomicOffset;
+float32 LODAtomic::range;
+
+static void*
+createLODAtomic(void *object, int32 offset, int32)
+{
+	LODAtomic *lod = PLUGINOFFSET(LODAtomic, object, offset);
+	memset(lod, 0, sizeof(*lod));
+	return object;
+}
+
+static void*
+destroyLODAtomic(void *object, int32 offset, int32)
+{
+	LODAtomic *lod = PLUGINOFFSET(LODAtomic, object, offset);
+	for(int32 i = 0; i < LODAtomic::MAXLODS; i++)
+		if(lod->lods[i])
+			lod->lods[i]->destroy();
+	return object;
+}
+
+static void*
+copyLODAtomic(void *dst, void *src, int32 offset, int32)
+{
+	LODAtomic *dstlod = PLUGINOFFSET(LODAtomic, dst, offset);
+	LODAtomic *srclod = PLUGINOFFSET(LODAtomic, src, offset);
+	*dstlod = *srclod;
+	for(int32 i = 0; i < LODAtomic::MAXLODS; i++)
+		if(dstlod->lods[i])
+			dstlod->lods[i]->addRef();
+	return dst;
+}
+
+void
+registerLODAtomicPlugin(void)
+{
+	lodAtomicOffset = Atomic::registerPlugin(sizeof(LODAtomic), ID_LODATOMIC,
+		createLODAtomic, destroyLODAtomic, copyLODAtomic);
+}
+
+LODAtomic*
+LODAtomic::get(Atomic *atomic)
+{
+	return PLUGINOFFSET(LODAtomic, atomic, lodAtomicOffset);
+}
+
+void
+LODAtomic::setGeometry(Atomic *atomic, int32 lod, Geometry *geo)
+{
+	LODAtomic *l = LODAtomic::get(atomic);
+	assert(lod >= 0 && lod < MAXLODS);
+	if(geo)
+		geo->addRef();
+	if(l->lods[lod])
+		l->lods[lod]->destroy();
+	l->lods[lod] = geo;
+}
+
+// Fill LODs 1 to numLODs-1 by simplifying the atomic's geometry,
+// every one has reduction times the triangles of the one before.
+void
+LODAtomic::generateLODs(Atomic *atomic, int32 numLODs, float32 reduction)
+{
+	LODAtomic *l = LODAtomic::get(atomic);
+	if(numLODs > MAXLODS)
+		numLODs = MAXLODS;
+	if(l->lods[0] == nil)
+		LODAtomic::setGeometry(atomic, 0, atomic->geometry);
+	for(int32 i = 1; i < numLODs; i++){
+		Geometry *prev = l->lods[i-1];
+		Geometry *geo = prev->simplify(prev->numTriangles*reduction);
+		if(geo == nil)
+			break;
+		LODAtomic::setGeometry(atomic, i, geo);
+		geo->destroy();
+	}
+}
+
+// Use the highest LOD up to lod that has a geometry
+void
+LODAtomic::setCurrentLOD(Atomic *atomic, int32 lod)
+{
+	LODAtomic *l = LODAtomic::get(atomic);
+	if(lod >= MAXLODS)
+		lod = MAXLODS-1;
+	while(lod > 0 && l->lods[lod] == nil)
+		lod--;
+	if(lod < 0 || l->lods[lod] == nil)
+		return;
+	l->currentLOD = lod;
+	if(atomic->geometry != l->lods[lod])
+		atomic->setGeometry(l->lods[lod], Atomic::SAMEBOUNDINGSPHERE);
+}
+
+void
+LODAtomic::setSelectCB(Atomic *atomic, SelectCB cb)
+{
+	LODAtomic::get(atomic)->selectCB = cb;
+}
+
+// One equal step from the camera to range (or the far plane)
+// for every LOD the atomic has
+int32
+LODAtomic::defaultSelectLOD(Atomic *atomic)
+{
+	int32 i, n, last;
+	LODAtomic *l = LODAtomic::get(atomic);
+	Camera *cam = (Camera*)engine->currentCamera;
+	if(cam == nil)
+		return 0;
+	n = 0;
+	last = 0;
+	for(i = 0; i < MAXLODS; i++)
+		if(l->lods[i]){
+			n++;
+			last = i;
+		}
+	if(n == 0)
+		return 0;
+	Sphere *s = atomic->getWorldBoundingSphere();
+	float32 dist = length(sub(s->center, cam->getFrame()->getLTM()->pos));
+	float32 r = LODAtomic::range > 0.0f ? LODAtomic::range : cam->farPlane;
+	int32 step = dist*n/r;
+	// the step'th LOD that is there, or the last one
+	for(i = 0; i < last; i++)
+		if(l->lods[i] && step-- <= 0)
+			return i;
+	return last;
+}
+
+static void
+lodRenderCB(Atomic *atomic)
+{
+	LODAtomic *l = LODAtomic::get(atomic);
+	LODAtomic::setCurrentLOD(atomic,
+		l->selectCB ? l->selectCB(atomic) : LODAtomic::defaultSelectLOD(atomic));
+	l->renderCB(atomic);
+}
+
+// Select the LOD whenever the atomic is rendered
+void
+LODAtomic::hookRender(Atomic *atomic)
+{
+	LODAtomic *l = LODAtomic::get(atomic);
+	if(atomic->renderCB == lodRenderCB)
+		return;
+	if(l->lods[0] == nil)
+		LODAtomic::setGeometry(atomic, 0, atomic->geometry);
+	l->renderCB = atomic->renderCB;
+	atomic->renderCB = lodRenderCB;
+}
+
+void
+LODAtomic::unhookRender(Atomic *atomic)
+{
+	LODAtomic *l = LODAtomic::get(atomic);
+	if(atomic->renderCB != lodRenderCB)
+		return;
+	atomic->renderCB = l->renderCB;
+	l->renderCB = nil;
+}
+
+}
@@ -0,0 +1,603 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwanim.h"
+#include "rwengine.h"
+#include "rwplugins.h"
+
+#define PLUGIN_ID 2
+
+// Vertex cache and overdraw optimization of triangle lists.
+// Triangle order follows Tom Forsyth's "Linear-Speed Vertex Cache
+// Optimisation", clusters are ordered like in Sander et al.'s
+// "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw".
+
+namespace rw {
+
+int32 buildMeshesCacheSize = 0;
+bool32 buildMeshesOverdraw = 0;
+
+enum {
+	MAXCACHE = 64,
+	MAXVALENCE = 32
+};
+
+struct CacheOpt
+{
+	int32 cacheSize;
+	float32 cacheScore[MAXCACHE];
+	float32 valenceScore[MAXVALENCE];
+
+	// per vertex
+	int32 *valence;		// triangles not emitted yet
+	int32 *triStart;	// into triList
+	int32 *triList;		// active triangles first
+	int32 *cachePos;
+	float32 *vertScore;
+	// per triangle
+	float32 *triScore;
+	uint8 *emitted;
+
+	float32 scoreVertex(int32 v);
+};
+
+float32
+CacheOpt::scoreVertex(int32 v)
+{
+	int32 n = this->valence[v];
+	if(n == 0)
+		return -1.0f;
+	float32 score = 0.0f;
+	if(this->cachePos[v] >= 0)
+		score = this->cacheScore[this->cachePos[v]];
+	return score + this->valenceScore[n < MAXVALENCE ? n : MAXVALENCE-1];
+}
+
+// Reorder numTris triangles in place. Triangles that had to be picked
+// without help of the cache start a new cluster and are marked in restart.
+template <typename T> static void
+optimizeCache(CacheOpt *opt, T *tris, int32 numTris, int32 numVerts, uint8 *restart)
+{
+	int32 i, j, k;
+	int32 cacheSize = opt->cacheSize;
+
+	memset(opt->valence, 0, numVerts*sizeof(int32));
+	for(i = 0; i < numTris; i++)
+		for(j = 0; j < 3; j++)
+			opt->valence[tris[i].v[j]]++;
+	int32 n = 0;
+	for(i = 0; i < numVerts; i++){
+		opt->triStart[i] = n;
+		n += opt->valence[i];
+		opt->valence[i] = 0;
+		opt->cachePos[i] = -1;
+	}
+	for(i = 0; i < numTris; i++)
+		for(j = 0; j < 3; j++){
+			int32 v = tris[i].v[j];
+			opt->triList[opt->triStart[v] + opt->valence[v]++] = i;
+		}
+	for(i = 0; i < numVerts; i++)
+		opt->vertScore[i] = opt->scoreVertex(i);
+	for(i = 0; i < numTris; i++){
+		opt->emitted[i] = 0;
+		opt->triScore[i] = opt->vertScore[tris[i].v[0]] +
+			opt->vertScore[tris[i].v[1]] +
+			opt->vertScore[tris[i].v[2]];
+	}
+
+	T *out = rwNewT(T, numTris, MEMDUR_FUNCTION | ID_GEOMETRY);
+	int32 cache[MAXCACHE+3], newCache[MAXCACHE+3];
+	int32 cacheLen = 0;
+	int32 cursor = 0;
+	int32 best = -1;
+	for(int32 numOut = 0; numOut < numTris; numOut++){
+		if(best < 0){
+			// dead end, take the best of what's left
+			float32 bestScore = -1.0f;
+			while(opt->emitted[cursor])
+				cursor++;
+			for(i = cursor; i < numTris; i++)
+				if(!opt->emitted[i] && opt->triScore[i] > bestScore){
+					bestScore = opt->triScore[i];
+					best = i;
+				}
+			restart[numOut] = 1;
+		}else
+			restart[numOut] = 0;
+
+		T *t = &tris[best];
+		out[numOut] = *t;
+		opt->emitted[best] = 1;
+
+		// new cache has the triangle's vertices in front
+		int32 newLen = 0;
+		for(j = 0; j < 3; j++){
+			int32 v = t->v[j];
+			// remove triangle from the active list
+			int32 *list = &opt->triList[opt->triStart[v]];
+			for(k = 0; k < opt->valence[v]; k++)
+				if(list[k] == best){
+					list[k] = list[opt->valence[v]-1];
+					list[opt->valence[v]-1] = best;
+					break;
+				}
+			opt->valence[v]--;
+			if(opt->cachePos[v] != -2){
+				newCache[newLen++] = v;
+				opt->cachePos[v] = -2;	// mark as added
+			}
+		}
+		for(i = 0; i < cacheLen; i++){
+			int32 v = cache[i];
+			if(opt->cachePos[v] == -2)
+				continue;
+			newCache[newLen++] = v;
+			opt->cachePos[v] = -2;
+		}
+		if(newLen > cacheSize+3)
+			newLen = cacheSize+3;
+		for(i = 0; i < cacheLen; i++)
+			opt->cachePos[cache[i]] = -1;
+		for(i = 0; i < newLen; i++)
+			opt->cachePos[newCache[i]] = i < cacheSize ? i : -1;
+
+		// rescore everything the cache touched
+		for(i = 0; i < newLen; i++){
+			int32 v = newCache[i];
+			opt->vertScore[v] = opt->scoreVertex(v);
+		}
+		for(i = 0; i < cacheLen; i++){
+			int32 v = cache[i];
+			if(opt->cachePos[v] == -1)
+				opt->vertScore[v] = opt->scoreVertex(v);
+		}
+		best = -1;
+		float32 bestScore = -1.0f;
+		for(i = 0; i < newLen; i++){
+			int32 v = newCache[i];
+			int32 *list = &opt->triList[opt->triStart[v]];
+			for(k = 0; k < opt->valence[v]; k++){
+				int32 ti = list[k];
+				T *tt = &tris[ti];
+				float32 s = opt->vertScore[tt->v[0]] +
+					opt->vertScore[tt->v[1]] +
+					opt->vertScore[tt->v[2]];
+				opt->triScore[ti] = s;
+				if(s > bestScore){
+					bestScore = s;
+					best = ti;
+				}
+			}
+		}
+		memcpy(cache, newCache, newLen*sizeof(int32));
+		cacheLen = newLen;
+	}
+	memcpy(tris, out, numTris*sizeof(T));
+	rwFree(out);
+}
+
+struct Cluster
+{
+	int32 start, num;
+	float32 sortKey;
+};
+
+static int
+clusterCmp(const void *a, const void *b)
+{
+	const Cluster *ca = (const Cluster*)a;
+	const Cluster *cb = (const Cluster*)b;
+	if(ca->sortKey != cb->sortKey)
+		return ca->sortKey > cb->sortKey ? -1 : 1;
+	return ca->start - cb->start;
+}
+
+// Draw clusters that face away from the center first,
+// they are the most likely to occlude the rest.
+template <typename T> static void
+optimizeOverdraw(T *tris, int32 numTris, V3d *verts, uint8 *restart)
+{
+	int32 i, j;
+	int32 numClusters = 0;
+	for(i = 0; i < numTris; i++)
+		if(restart[i])
+			numClusters++;
+	if(numClusters < 2)
+		return;
+
+	Cluster *clusters = rwNewT(Cluster, numClusters, MEMDUR_FUNCTION | ID_GEOMETRY);
+	V3d *centers = rwNewT(V3d, numClusters*2, MEMDUR_FUNCTION | ID_GEOMETRY);
+	V3d *normals = centers + numClusters;
+	V3d meshCenter = { 0.0f, 0.0f, 0.0f };
+	float32 meshArea = 0.0f;
+	Cluster *c = nil;
+	float32 area = 0.0f;
+	for(i = 0; i < numTris; i++){
+		if(restart[i]){
+			c = c ? c+1 : clusters;
+			c->start = i;
+			c->num = 0;
+			j = c - clusters;
+			centers[j].set(0.0f, 0.0f, 0.0f);
+			normals[j].set(0.0f, 0.0f, 0.0f);
+			area = 0.0f;
+		}
+		j = c - clusters;
+		V3d a = verts[tris[i].v[0]];
+		V3d b = verts[tris[i].v[1]];
+		V3d d = verts[tris[i].v[2]];
+		V3d n = cross(sub(b, a), sub(d, a));
+		float32 triArea = length(n);
+		V3d center = scale(add(add(a, b), d), 1.0f/3.0f);
+		centers[j] = add(centers[j], scale(center, triArea));
+		normals[j] = add(normals[j], n);
+		meshCenter = add(meshCenter, scale(center, triArea));
+		meshArea += triArea;
+		c->num++;
+		area += triArea;
+		if(i+1 == numTris || restart[i+1])
+			centers[j] = area > 0.0f ? scale(centers[j], 1.0f/area) : a;
+	}
+	if(meshArea > 0.0f)
+		meshCenter = scale(meshCenter, 1.0f/meshArea);
+	for(i = 0; i < numClusters; i++){
+		float32 len = length(normals[i]);
+		clusters[i].sortKey = len > 0.0f ?
+			dot(sub(centers[i], meshCenter), normals[i])/len : 0.0f;
+	}
+	qsort(clusters, numClusters, sizeof(Cluster), clusterCmp);
+
+	T *out = rwNewT(T, numTris, MEMDUR_FUNCTION | ID_GEOMETRY);
+	T *t = out;
+	for(i = 0; i < numClusters; i++){
+		memcpy(t, &tris[clusters[i].start], clusters[i].num*sizeof(T));
+		t += clusters[i].num;
+	}
+	memcpy(tris, out, numTris*sizeof(T));
+	rwFree(out);
+	rwFree(centers);
+	rwFree(clusters);
+}
+
+// Sort by material, keeping the order otherwise, and optimize the
+// triangles of every material. Overdraw is optimized if verts are given.
+template <typename T> static void
+optimizeMaterials(CacheOpt *opt, T *tris, int32 nt, int32 nv, int32 numMats, V3d *verts, uint8 *restart)
+{
+	int32 i;
+	int32 *matStart = rwNewT(int32, numMats+1, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(matStart, 0, (numMats+1)*sizeof(int32));
+	for(i = 0; i < nt; i++){
+		assert(tris[i].matId < numMats);
+		matStart[tris[i].matId+1]++;
+	}
+	for(i = 0; i < numMats; i++)
+		matStart[i+1] += matStart[i];
+	T *sorted = rwNewT(T, nt, MEMDUR_FUNCTION | ID_GEOMETRY);
+	int32 *fill = rwNewT(int32, numMats, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memcpy(fill, matStart, numMats*sizeof(int32));
+	for(i = 0; i < nt; i++)
+		sorted[fill[tris[i].matId]++] = tris[i];
+	memcpy(tris, sorted, nt*sizeof(T));
+	rwFree(fill);
+	rwFree(sorted);
+
+	for(i = 0; i < numMats; i++){
+		int32 n = matStart[i+1] - matStart[i];
+		if(n == 0)
+			continue;
+		optimizeCache(opt, &tris[matStart[i]], n, nv, restart);
+		if(verts)
+			optimizeOverdraw(&tris[matStart[i]], n, verts, restart);
+	}
+	rwFree(matStart);
+}
+
+// Reorder the triangles of every material for post-transform vertex
+// cache hits, optionally ordering clusters of them to reduce overdraw.
+// Triangles end up sorted by material.
+void
+Geometry::optimizeTriangleOrder(int32 cacheSize, bool32 overdraw)
+{
+	int32 i;
+
+	if(this->flags & Geometry::NATIVE || this->numTriangles == 0)
+		return;
+	if(cacheSize < 4)
+		cacheSize = 4;
+	if(cacheSize > MAXCACHE)
+		cacheSize = MAXCACHE;
+
+	CacheOpt opt;
+	opt.cacheSize = cacheSize;
+	for(i = 0; i < cacheSize; i++){
+		// the last triangle's vertices are all equally good
+		if(i < 3)
+			opt.cacheScore[i] = 0.75f;
+		else
+			opt.cacheScore[i] = powf(1.0f - (i-3)/(float32)(cacheSize-3), 1.5f);
+	}
+	opt.valenceScore[0] = 0.0f;
+	for(i = 1; i < MAXVALENCE; i++)
+		opt.valenceScore[i] = 2.0f/sqrtf((float32)i);
+
+	int32 nv = this->numVertices;
+	int32 nt = this->numTriangles;
+	opt.valence = rwNewT(int32, nv*4 + nt*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	opt.triStart = opt.valence + nv;
+	opt.cachePos = opt.triStart + nv;
+	opt.vertScore = (float32*)(opt.cachePos + nv);
+	opt.triList = (int32*)(opt.vertScore + nv);
+	opt.triScore = rwNewT(float32, nt, MEMDUR_FUNCTION | ID_GEOMETRY);
+	opt.emitted = rwNewT(uint8, nt*2, MEMDUR_FUNCTION | ID_GEOMETRY);
+	uint8 *restart = opt.emitted + nt;
+
+	V3d *verts = overdraw && this->numMorphTargets > 0 ?
+		this->morphTargets[0].vertices : nil;
+	if(this->flags & INDEX32)
+		optimizeMaterials(&opt, this->triangles32, nt, nv,
+			this->matList.numMaterials, verts, restart);
+	else
+		optimizeMaterials(&opt, this->triangles, nt, nv,
+			this->matList.numMaterials, verts, restart);
+
+	rwFree(opt.emitted);
+	rwFree(opt.triScore);
+	rwFree(opt.valence);
+
+	if(this->meshHeader && ((this->flags & TRISTRIP) == 0 || this->flags & INDEX32)){
+		this->lock(Geometry::LOCKPOLYGONS);
+		this->buildMeshes();
+	}
+}
+
+// Put vertices in the order they are first used by the triangles
+// so the vertex fetch walks through memory linearly.
+void
+Geometry::optimizeVertexOrder(void)
+{
+	int32 i, j;
+
+	if(this->flags & Geometry::NATIVE || this->numVertices == 0)
+		return;
+	int32 *map = rwNewT(int32, this->numVertices, MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < this->numVertices; i++)
+		map[i] = -1;
+	int32 n = 0;
+	for(i = 0; i < this->numTriangles; i++)
+		for(j = 0; j < 3; j++){
+			int32 v = this->flags & INDEX32 ?
+				this->triangles32[i].v[j] : this->triangles[i].v[j];
+			if(map[v] < 0)
+				map[v] = n++;
+		}
+	// keep the unused ones at the end
+	for(i = 0; i < this->numVertices; i++)
+		if(map[i] < 0)
+			map[i] = n++;
+	bool32 hadMeshes = this->meshHeader != nil;
+	this->remapVertices(map, n);
+	if(hadMeshes)
+		this->buildMeshes();
+	rwFree(map);
+}
+
+template <typename T> static void
+remapArray(T *data, int32 *map, int32 numVertices, int32 stride)
+{
+	if(data == nil)
+		return;
+	T *tmp = rwNewT(T, numVertices*stride, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memcpy(tmp, data, numVertices*stride*sizeof(T));
+	for(int32 i = 0; i < numVertices; i++)
+		memcpy(&data[map[i]*stride], &tmp[i*stride], stride*sizeof(T));
+	rwFree(tmp);
+}
+
+template <typename T> static void
+remapTriangles(T *tris, int32 numTris, int32 *map)
+{
+	for(int32 i = 0; i < numTris; i++){
+		tris[i].v[0] = map[tris[i].v[0]];
+		tris[i].v[1] = map[tris[i].v[1]];
+		tris[i].v[2] = map[tris[i].v[2]];
+	}
+}
+
+// Move vertex i to map[i]. Several vertices can map to the same one,
+// which leaves numVertices vertices.
+// Skin weights are remapped too. The meshes are freed,
+// the caller rebuilds them when the triangles are final.
+void
+Geometry::remapVertices(int32 *map, int32 numVertices)
+{
+	int32 i;
+
+	if(this->flags & Geometry::NATIVE)
+		return;
+	assert(numVertices <= this->numVertices);
+	int32 n = this->numVertices;
+	for(i = 0; i < this->numMorphTargets; i++){
+		remapArray(this->morphTargets[i].vertices, map, n, 1);
+		remapArray(this->morphTargets[i].normals, map, n, 1);
+	}
+	remapArray(this->colors, map, n, 1);
+	for(i = 0; i < this->numTexCoordSets; i++)
+		remapArray(this->texCoords[i], map, n, 1);
+	if(skinGlobals.geoOffset){
+		Skin *skin = Skin::get(this);
+		if(skin){
+			remapArray(skin->indices, map, n, 4);
+			remapArray(skin->weights, map, n, 4);
+		}
+	}
+	if(this->flags & INDEX32)
+		remapTriangles(this->triangles32, this->numTriangles, map);
+	else
+		remapTriangles(this->triangles, this->numTriangles, map);
+	this->numVertices = numVertices;
+	this->lock(Geometry::LOCKALL);
+}
+
+struct WeldAttrib
+{
+	uint8 *data;
+	int32 size;	// per vertex
+};
+
+static bool32
+sameVertex(WeldAttrib *attribs, int32 numAttribs, int32 a, int32 b)
+{
+	for(int32 i = 0; i < numAttribs; i++)
+		if(memcmp(attribs[i].data + a*attribs[i].size,
+		          attribs[i].data + b*attribs[i].size, attribs[i].size) != 0)
+			return 0;
+	return 1;
+}
+
+template <typename T> static int32
+removeDegenerate(T *tris, int32 numTris)
+{
+	int32 n = 0;
+	for(int32 i = 0; i < numTris; i++){
+		T *t = &tris[i];
+		if(t->v[0] == t->v[1] || t->v[0] == t->v[2] || t->v[1] == t->v[2])
+			continue;
+		tris[n++] = *t;
+	}
+	return n;
+}
+
+// Merge vertices whose attributes are all identical and drop the
+// triangles that collapse. Returns the number of vertices removed.
+int32
+Geometry::weldVertices(void)
+{
+	int32 i, j;
+	WeldAttrib *attribs;
+	int32 numAttribs = 0;
+
+	if(this->flags & Geometry::NATIVE || this->numVertices == 0)
+		return 0;
+
+	attribs = rwNewT(WeldAttrib, this->numMorphTargets*2 + 1 + this->numTexCoordSets + 2,
+		MEMDUR_FUNCTION | ID_GEOMETRY);
+	for(i = 0; i < this->numMorphTargets; i++){
+		MorphTarget *mt = &this->morphTargets[i];
+		if(mt->vertices){
+			attribs[numAttribs].data = (uint8*)mt->vertices;
+			attribs[numAttribs++].size = sizeof(V3d);
+		}
+		if(mt->normals){
+			attribs[numAttribs].data = (uint8*)mt->normals;
+			attribs[numAttribs++].size = sizeof(V3d);
+		}
+	}
+	if(this->colors){
+		attribs[numAttribs].data = (uint8*)this->colors;
+		attribs[numAttribs++].size = sizeof(RGBA);
+	}
+	for(i = 0; i < this->numTexCoordSets; i++){
+		attribs[numAttribs].data = (uint8*)this->texCoords[i];
+		attribs[numAttribs++].size = sizeof(TexCoords);
+	}
+	if(skinGlobals.geoOffset){
+		Skin *skin = Skin::get(this);
+		if(skin){
+			attribs[numAttribs].data = skin->indices;
+			attribs[numAttribs++].size = 4;
+			attribs[numAttribs].data = (uint8*)skin->weights;
+			attribs[numAttribs++].size = 4*sizeof(float);
+		}
+	}
+
+	// hash all attributes and look for earlier vertices that are the same
+	uint32 size = 16;
+	while(size < (uint32)this->numVertices*2)
+		size *= 2;
+	int32 *hash = rwNewT(int32, size + this->numVertices*2, MEMDUR_FUNCTION | ID_GEOMETRY);
+	int32 *next = hash + size;
+	int32 *map = next + this->numVertices;
+	memset(hash, 0xFF, size*sizeof(int32));
+	int32 n = 0;
+	for(i = 0; i < this->numVertices; i++){
+		uint32 h = 0x811C9DC5;
+		for(j = 0; j < numAttribs; j++){
+			uint8 *p = attribs[j].data + i*attribs[j].size;
+			for(int32 k = 0; k < attribs[j].size; k++)
+				h = (h ^ p[k]) * 0x01000193;
+		}
+		h &= size-1;
+		for(j = hash[h]; j >= 0; j = next[j])
+			if(sameVertex(attribs, numAttribs, i, j))
+				break;
+		if(j >= 0)
+			map[i] = map[j];
+		else{
+			map[i] = n++;
+			next[i] = hash[h];
+			hash[h] = i;
+		}
+	}
+	int32 removed = this->numVertices - n;
+	if(removed){
+		bool32 hadMeshes = this->meshHeader != nil;
+		this->remapVertices(map, n);
+		// welding can collapse triangles, drop them before making meshes
+		this->numTriangles = this->flags & INDEX32 ?
+			removeDegenerate(this->triangles32, this->numTriangles) :
+			removeDegenerate(this->triangles, this->numTriangles);
+		if(hadMeshes)
+			this->buildMeshes();
+	}
+	rwFree(hash);
+	rwFree(attribs);
+	return removed;
+}
+
+// Average cache misses per triangle with a FIFO cache
+float32
+MeshHeader::calculateACMR(int32 cacheSize)
+{
+	uint32 i, j;
+	int32 k;
+	int32 cache[MAXCACHE];
+	int32 misses = 0;
+
+	if(cacheSize > MAXCACHE)
+		cacheSize = MAXCACHE;
+	uint32 numTris = this->guessNumTriangles();
+	if(numTris == 0)
+		return 0.0f;
+	Mesh *mesh = this->getMeshes();
+	for(i = 0; i < this->numMeshes; i++){
+		if(mesh[i].indices == nil)
+			continue;
+		int32 pos = 0;
+		for(k = 0; k < cacheSize; k++)
+			cache[k] = -1;
+		for(j = 0; j < mesh[i].numIndices; j++){
+			int32 v = this->index32 ? mesh[i].indices32[j] : mesh[i].indices[j];
+			for(k = 0; k < cacheSize; k++)
+				if(cache[k] == v)
+					break;
+			if(k == cacheSize){
+				cache[pos] = v;
+				pos = (pos+1) % cacheSize;
+				misses++;
+			}
+		}
+	}
+	return (float32)misses/numTris;
+}
+
+}
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwanim.h"
+#include "rwengine.h"
+#include "rwplugins.h"
+#include "gl/rwgl3.h"
+#include "gl/rwgl3plg.h"
+
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
+#define PLUGIN_ID ID_MORPH
+
+namespace rw {
+
+MorphGlobals morphGlobals = { 0, { nil } };
+
+// dst = start + (end-start)*t, dst may be the same as start or end
+void
+blendMorphTargets(V3d *dst, V3d *start, V3d *end, float32 t, int32 n)
+{
+	// vertices are just a stream of floats here
+	float32 *d = (float32*)dst;
+	float32 *a = (float32*)start;
+	float32 *b = (float32*)end;
+	int32 num = n*3;
+	int32 i = 0;
+#if defined(RW_SSE2)
+	__m128 vt = _mm_set1_ps(t);
+	for(; i+8 <= num; i += 8){
+		__m128 a0 = _mm_loadu_ps(a+i);
+		__m128 a1 = _mm_loadu_ps(a+i+4);
+		__m128 b0 = _mm_loadu_ps(b+i);
+		__m128 b1 = _mm_loadu_ps(b+i+4);
+		_mm_storeu_ps(d+i, _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(b0, a0), vt)));
+		_mm_storeu_ps(d+i+4, _mm_add_ps(a1, _mm_mul_ps(_mm_sub_ps(b1, a1), vt)));
+	}
+#elif defined(RW_NEON)
+	float32x4_t vt = vdupq_n_f32(t);
+	for(; i+8 <= num; i += 8){
+		float32x4_t a0 = vld1q_f32(a+i);
+		float32x4_t a1 = vld1q_f32(a+i+4);
+		float32x4_t b0 = vld1q_f32(b+i);
+		float32x4_t b1 = vld1q_f32(b+i+4);
+		vst1q_f32(d+i, vaddq_f32(a0, vmulq_f32(vsubq_f32(b0, a0), vt)));
+		vst1q_f32(d+i+4, vaddq_f32(a1, vmulq_f32(vsubq_f32(b1, a1), vt)));
+	}
+#endif
+	for(; i < num; i++)
+		d[i] = a[i] + (b[i] - a[i])*t;
+}
+
+//
+// Morph animation
+//
+
+static void
+morphAnimStreamRead(Stream *stream, Animation *anim)
+{
+	MorphKeyFrame *frames = (MorphKeyFrame*)anim->keyframes;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		frames[i].time = stream->readF32();
+		frames[i].target = stream->readI32();
+		int32 prev = stream->readI32();
+		frames[i].prev = prev < 0 ? nil : &frames[prev];
+	}
+}
+
+static void
+morphAnimStreamWrite(Stream *stream, Animation *anim)
+{
+	MorphKeyFrame *frames = (MorphKeyFrame*)anim->keyframes;
+	for(int32 i = 0; i < anim->numFrames; i++){
+		stream->writeF32(frames[i].time);
+		stream->writeI32(frames[i].target);
+		stream->writeI32(frames[i].prev ? frames[i].prev - frames : -1);
+	}
+}
+
+static uint32
+morphAnimStreamGetSize(Animation *anim)
+{
+	return anim->numFrames*(4 + 4 + 4);
+}
+
+static void
+morphApplyCB(void *result, void *frame)
+{
+	Morph *morph = (Morph*)result;
+	MorphInterpFrame *f = (MorphInterpFrame*)frame;
+	morph->startTarget = f->startTarget;
+	morph->endTarget = f->endTarget;
+	morph->factor = f->factor;
+}
+
+static void
+morphInterpCB(void *out, void *in1, void *in2, float32 t, void*)
+{
+	MorphInterpFrame *intf = (MorphInterpFrame*)out;
+	MorphKeyFrame *kf1 = (MorphKeyFrame*)in1;
+	MorphKeyFrame *kf2 = (MorphKeyFrame*)in2;
+	intf->startTarget = kf1->target;
+	intf->endTarget = kf2->target;
+	if(kf2->time > kf1->time)
+		intf->factor = (t - kf1->time) / (kf2->time - kf1->time);
+	else
+		intf->factor = 0.0f;
+}
+
+//
+// Atomic plugin
+//
+
+static void*
+createMorph(void *object, int32 offset, int32)
+{
+	Morph *morph = PLUGINOFFSET(Morph, object, offset);
+	morph->startTarget = 0;
+	morph->endTarget = 0;
+	morph->factor = 0.0f;
+	morph->interp = nil;
+	return object;
+}
+
+static void*
+destroyMorph(void *object, int32 offset, int32)
+{
+	Morph *morph = PLUGINOFFSET(Morph, object, offset);
+	if(morph->interp)
+		morph->interp->destroy();
+	return object;
+}
+
+static void*
+copyMorph(void *dst, void *src, int32 offset, int32)
+{
+	Morph *dstmorph = PLUGINOFFSET(Morph, dst, offset);
+	Morph *srcmorph = PLUGINOFFSET(Morph, src, offset);
+	dstmorph->startTarget = srcmorph->startTarget;
+	dstmorph->endTarget = srcmorph->endTarget;
+	dstmorph->factor = srcmorph->factor;
+	dstmorph->interp = nil;
+	if(srcmorph->interp){
+		Morph::setAnimation((Atomic*)dst, srcmorph->interp->currentAnim);
+		dstmorph->interp->setCurrentTime(srcmorph->interp->currentTime);
+		Morph::applyUpdate((Atomic*)dst);
+	}
+	return dst;
+}
+
+static void*
+morphOpen(void *object, int32, int32)
+{
+	AnimInterpolatorInfo *info = rwNewT(AnimInterpolatorInfo, 1, MEMDUR_GLOBAL | ID_MORPH);
+	info->id = Morph::ANIMTYPE;
+	info->interpKeyFrameSize = sizeof(MorphInterpFrame);
+	info->animKeyFrameSize = sizeof(MorphKeyFrame);
+	info->customDataSize = 0;
+	info->applyCB = morphApplyCB;
+	info->blendCB = nil;
+	info->interpCB = morphInterpCB;
+	info->addCB = nil;
+	info->mulRecipCB = nil;
+	info->streamRead = morphAnimStreamRead;
+	info->streamWrite = morphAnimStreamWrite;
+	info->streamGetSize = morphAnimStreamGetSize;
+	AnimInterpolatorInfo::registerInterp(info);
+	return object;
+}
+
+static void*
+morphClose(void *object, int32, int32)
+{
+	AnimInterpolatorInfo::unregisterInterp(AnimInterpolatorInfo::find(Morph::ANIMTYPE));
+	return object;
+}
+
+void
+registerMorphPlugin(void)
+{
+	Engine::registerPlugin(0, ID_MORPH, morphOpen, morphClose);
+	gl3::initMorph();
+
+	morphGlobals.atomicOffset =
+		Atomic::registerPlugin(sizeof(Morph), ID_MORPH,
+		                       createMorph, destroyMorph, copyMorph);
+}
+
+Morph*
+Morph::get(const Atomic *atomic)
+{
+	return PLUGINOFFSET(Morph, atomic, morphGlobals.atomicOffset);
+}
+
+void
+Morph::setTargets(Atomic *atomic, int32 start, int32 end, float32 factor)
+{
+	Morph *morph = Morph::get(atomic);
+	morph->startTarget = start;
+	morph->endTarget = end;
+	morph->factor = factor;
+}
+
+// Animate the atomic's morph targets, nil stops the animation
+void
+Morph::setAnimation(Atomic *atomic, Animation *anim)
+{
+	Morph *morph = Morph::get(atomic);
+	if(morph->interp){
+		morph->interp->destroy();
+		morph->interp = nil;
+	}
+	if(anim == nil)
+		return;
+	assert(anim->interpInfo->id == Morph::ANIMTYPE);
+	morph->interp = AnimInterpolator::create(anim->getNumNodes(),
+		anim->interpInfo->interpKeyFrameSize);
+	morph->interp->setCurrentAnim(anim);
+	Morph::applyUpdate(atomic);
+}
+
+void
+Morph::addTime(Atomic *atomic, float32 t)
+{
+	Morph *morph = Morph::get(atomic);
+	if(morph->interp == nil)
+		return;
+	morph->interp->addTime(t);
+	Morph::applyUpdate(atomic);
+}
+
+void
+Morph::applyUpdate(Atomic *atomic)
+{
+	Morph *morph = Morph::get(atomic);
+	if(morph->interp)
+		morph->interp->applyCB(morph, morph->interp->getInterpFrame(0));
+}
+
+// Blend the atomic's current morph targets on the CPU,
+// for platforms that can't do it while rendering.
+// normals may be nil.
+void
+Morph::interpolate(Atomic *atomic, V3d *vertices, V3d *normals)
+{
+	Morph *morph = Morph::get(atomic);
+	Geometry *geo = atomic->geometry;
+	MorphTarget *start = &geo->morphTargets[morph->getStartTarget(geo)];
+	MorphTarget *end = &geo->morphTargets[morph->getEndTarget(geo)];
+	blendMorphTargets(vertices, start->vertices, end->vertices,
+	                  morph->factor, geo->numVertices);
+	if(normals && geo->flags & Geometry::NORMALS)
+		blendMorphTargets(normals, start->normals, end->normals,
+		                  morph->factor, geo->numVertices);
+}
+
+// Platforms without a morph pipeline render morph target 0
+void
+Morph::setPipeline(Atomic *atomic)
+{
+	atomic->pipeline = morphGlobals.pipelines[rw::platform];
+}
+
+}
@@ -41,8 +41,8 @@ ObjPipeline::destroy(void)
 
 // helper functions
 
-void
-findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
+template <typename T> static void
+findMinVertAndNumVerticesT(T *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
 {
 	uint32 min = 0xFFFFFFFF;
 	uint32 max = 0;
@@ -65,6 +65,91 @@ findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, i
 		*numVertices = num;
 }
 
+void
+findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
+{
+	findMinVertAndNumVerticesT(indices, numIndices, minVert, numVertices);
+}
+
+void
+findMinVertAndNumVertices(uint32 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices)
+{
+	findMinVertAndNumVerticesT(indices, numIndices, minVert, numVertices);
+}
+
+// Vertices [*first, *first+n) of the attributes in lockFlags that
+// have to be instanced, returns n. That's all of them the first time
+// and only the ones locked since then on reinstance.
+int32
+getInstanceRange(Geometry *geo, int32 lockFlags, bool32 reinstance, int32 numVertices, int32 *first)
+{
+	if(!reinstance){
+		*first = 0;
+		return numVertices;
+	}
+	int32 n = geo->getLockedRange(lockFlags, first);
+	if(*first + n > numVertices)
+		n = *first < numVertices ? numVertices - *first : 0;
+	return n;
+}
+
+static uint16
+floatToHalf(float32 f)
+{
+	union { float32 f; uint32 u; } fu;
+	fu.f = f;
+	uint32 sign = (fu.u >> 16) & 0x8000;
+	int32 exp = ((fu.u >> 23) & 0xFF) - 127 + 15;
+	uint32 mant = fu.u & 0x7FFFFF;
+	if(exp >= 31)
+		return sign | 0x7C00;	// too big or NaN, make infinity
+	if(exp <= 0){
+		// denormal or zero
+		if(exp < -10)
+			return sign;
+		mant |= 0x800000;
+		uint32 shift = 14 - exp;
+		return sign | ((mant + (1 << (shift-1))) >> shift);
+	}
+	// round to nearest, may carry into the exponent
+	return sign | ((exp << 10) + ((mant + 0x1000) >> 13));
+}
+
+static float32
+halfToFloat(uint16 h)
+{
+	union { float32 f; uint32 u; } fu;
+	uint32 sign = (h & 0x8000) << 16;
+	uint32 exp = (h >> 10) & 0x1F;
+	uint32 mant = h & 0x3FF;
+	if(exp == 0){
+		fu.f = mant / 16777216.0f;	// 2^-24
+		fu.u |= sign;
+	}else if(exp == 31)
+		fu.u = sign | 0x7F800000 | mant << 13;
+	else
+		fu.u = sign | (exp - 15 + 127) << 23 | mant << 13;
+	return fu.f;
+}
+
+static uint32
+packComponent(float32 f, float32 scale, uint32 mask)
+{
+	if(f > 1.0f) f = 1.0f;
+	if(f < -1.0f) f = -1.0f;
+	f *= scale;
+	return (uint32)(int32)(f < 0.0f ? f - 0.5f : f + 0.5f) & mask;
+}
+
+static float32
+unpackComponent(uint32 n, int32 bits, float32 scale)
+{
+	// sign extend
+	int32 i = (int32)(n << (32-bits)) >> (32-bits);
+	float32 f = i / scale;
+	return f < -1.0f ? -1.0f : f;
+}
+
 void
 instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride)
 {
@@ -74,6 +159,27 @@ instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride)
 			dst += stride;
 			src++;
 		}
+	else if(type == VERT_NORMUBYTE4)
+		// The rounding error goes to the largest component
+		// so weights that sum to 1 still do.
+		for(uint32 i = 0; i < numVertices; i++){
+			float32 *f = (float32*)src;
+			int32 sum = 0, maxj = 0;
+			float32 fsum = 0.0f;
+			for(int32 j = 0; j < 4; j++){
+				float32 c = f[j] < 0.0f ? 0.0f : f[j] > 1.0f ? 1.0f : f[j];
+				dst[j] = (uint8)(c*255.0f + 0.5f);
+				sum += dst[j];
+				fsum += c;
+				if(f[j] > f[maxj])
+					maxj = j;
+			}
+			int32 target = (int32)(fsum*255.0f + 0.5f);
+			int32 c = dst[maxj] + target - sum;
+			dst[maxj] = c < 0 ? 0 : c > 255 ? 255 : c;
+			dst += stride;
+			src++;
+		}
 	else
 		assert(0 && "unsupported instV4d type");
 }
@@ -96,6 +202,14 @@ instV3d(int type, uint8 *dst, V3d *src, uint32 numVertices, uint32 stride)
 			dst += stride;
 			src++;
 		}
+	else if(type == VERT_PACKEDNORM)
+		for(uint32 i = 0; i < numVertices; i++){
+			*(uint32*)dst = packComponent(src->x, 511.0f, 0x3FF) |
+				packComponent(src->y, 511.0f, 0x3FF) << 10 |
+				packComponent(src->z, 511.0f, 0x3FF) << 20;
+			dst += stride;
+			src++;
+		}
 	else
 		assert(0 && "unsupported instV3d type");
 }
@@ -126,6 +240,15 @@ uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
 			src += stride;
 			dst++;
 		}
+	else if(type == VERT_PACKEDNORM)
+		for(uint32 i = 0; i < numVertices; i++){
+			uint32 n = *(uint32*)src;
+			dst->x = unpackComponent(n, 10, 511.0f);
+			dst->y = unpackComponent(n >> 10, 10, 511.0f);
+			dst->z = unpackComponent(n >> 20, 10, 511.0f);
+			src += stride;
+			dst++;
+		}
 	else
 		assert(0 && "unsupported uninstV3d type");
 }
@@ -133,22 +256,40 @@ uninstV3d(int type, V3d *dst, uint8 *src, uint32 numVertices, uint32 stride)
 void
 instTexCoords(int type, uint8 *dst, TexCoords *src, uint32 numVertices, uint32 stride)
 {
-	assert(type == VERT_FLOAT2);
-	for(uint32 i = 0; i < numVertices; i++){
-		memcpy(dst, src, 8);
-		dst += stride;
-		src++;
+	if(type == VERT_HALF2)
+		for(uint32 i = 0; i < numVertices; i++){
+			((uint16*)dst)[0] = floatToHalf(src->u);
+			((uint16*)dst)[1] = floatToHalf(src->v);
+			dst += stride;
+			src++;
+		}
+	else{
+		assert(type == VERT_FLOAT2);
+		for(uint32 i = 0; i < numVertices; i++){
+			memcpy(dst, src, 8);
+			dst += stride;
+			src++;
+		}
 	}
 }
 
 void
 uninstTexCoords(int type, TexCoords *dst, uint8 *src, uint32 numVertices, uint32 stride)
 {
-	assert(type == VERT_FLOAT2);
-	for(uint32 i = 0; i < numVertices; i++){
-		memcpy(dst, src, 8);
-		src += stride;
-		dst++;
+	if(type == VERT_HALF2)
+		for(uint32 i = 0; i < numVertices; i++){
+			dst->u = halfToFloat(((uint16*)src)[0]);
+			dst->v = halfToFloat(((uint16*)src)[1]);
+			src += stride;
+			dst++;
+		}
+	else{
+		assert(type == VERT_FLOAT2);
+		for(uint32 i = 0; i < numVertices; i++){
+			memcpy(dst, src, 8);
+			src += stride;
+			dst++;
+		}
 	}
 }
 
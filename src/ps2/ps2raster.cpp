@@ -1367,16 +1367,123 @@ swizzle(uint32 x, uint32 y, uint32 logw)
 	return n | nx<<2 | ny<<(logw-1+2);
 }
 
+// Within a group of four rows the masked swizzled address only
+// depends on x and the lower three bits of y, so eight rows of
+// addresses are all we need.
+struct SwizzleJob
+{
+	uint8 *px;
+	int32 w;
+	int32 logw;
+	uint16 *tab;
+};
+
+static void
+makeSwizzleTable(SwizzleJob *job)
+{
+	int32 x, y;
+	uint32 mask = (1<<(job->logw+2))-1;
+	job->tab = rwNewT(uint16, 8*job->w, MEMDUR_FUNCTION | ID_RASTERPS2);
+	for(y = 0; y < 8; y++)
+		for(x = 0; x < job->w; x++)
+			job->tab[y*job->w + x] = swizzle(x, y, job->logw)&mask;
+}
+
+static void
+runSwizzleJobs(JobFunc func, SwizzleJob *job, int32 h)
+{
+	int32 n = (h+3)/4;
+	// not worth waking up threads for small rasters,
+	// and rows can overlap if the raster is narrower than the transfer
+	if(job->w*h >= 256*256 && job->w == 1<<job->logw)
+		runJobs(func, n, job);
+	else
+		for(int32 i = 0; i < n; i++)
+			func(i, job);
+}
+
+static void
+unswizzle4Rows(int32 j, void *data)
+{
+	SwizzleJob *job = (SwizzleJob*)data;
+	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
+	int32 x, i, y = j*4;
+	int32 w = job->w;
+
+	memcpy(tmpbuf, &job->px[y<<(job->logw-1)], 2*w);
+	for(i = 0; i < 4; i++){
+		uint16 *s = &job->tab[((y&4)|i)*w];
+		uint8 *dst = &job->px[((y+i)<<job->logw)>>1];
+		for(x = 0; x < w; x += 2){
+			uint8 c0 = s[x] & 1 ? tmpbuf[s[x]>>1] >> 4 : tmpbuf[s[x]>>1] & 0xF;
+			uint8 c1 = s[x+1] & 1 ? tmpbuf[s[x+1]>>1] >> 4 : tmpbuf[s[x+1]>>1] & 0xF;
+			dst[x>>1] = c0 | c1<<4;
+		}
+	}
+}
+
+static void
+unswizzle8Rows(int32 j, void *data)
+{
+	SwizzleJob *job = (SwizzleJob*)data;
+	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
+	int32 x, i, y = j*4;
+	int32 w = job->w;
+
+	memcpy(tmpbuf, &job->px[y<<job->logw], 4*w);
+	for(i = 0; i < 4; i++){
+		uint16 *s = &job->tab[((y&4)|i)*w];
+		uint8 *dst = &job->px[(y+i)<<job->logw];
+		for(x = 0; x < w; x++)
+			dst[x] = tmpbuf[s[x]];
+	}
+}
+
+static void
+swizzle4Rows(int32 j, void *data)
+{
+	SwizzleJob *job = (SwizzleJob*)data;
+	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
+	int32 x, i, y = j*4;
+	int32 w = job->w;
+
+	for(i = 0; i < 4; i++){
+		uint16 *s = &job->tab[((y&4)|i)*w];
+		uint8 *src = &job->px[((y+i)<<job->logw)>>1];
+		for(x = 0; x < w; x += 2){
+			uint8 c0 = src[x>>1] & 0xF;
+			uint8 c1 = src[x>>1] >> 4;
+			tmpbuf[s[x]>>1] = s[x] & 1 ? (tmpbuf[s[x]>>1]&0xF) | c0<<4 : (tmpbuf[s[x]>>1]&0xF0) | c0;
+			tmpbuf[s[x+1]>>1] = s[x+1] & 1 ? (tmpbuf[s[x+1]>>1]&0xF) | c1<<4 : (tmpbuf[s[x+1]>>1]&0xF0) | c1;
+		}
+	}
+	memcpy(&job->px[y<<(job->logw-1)], tmpbuf, 2*w);
+}
+
+static void
+swizzle8Rows(int32 j, void *data)
+{
+	SwizzleJob *job = (SwizzleJob*)data;
+	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
+	int32 x, i, y = j*4;
+	int32 w = job->w;
+
+	for(i = 0; i < 4; i++){
+		uint16 *s = &job->tab[((y&4)|i)*w];
+		uint8 *src = &job->px[(y+i)<<job->logw];
+		for(x = 0; x < w; x++)
+			tmpbuf[s[x]] = src[x];
+	}
+	memcpy(&job->px[y<<job->logw], tmpbuf, 4*w);
+}
+
 void
 unswizzleRaster(Raster *raster)
 {
-	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
-	uint32 mask;
-	int32 x, y, w, h;
+	int32 w, h;
 	int32 i;
-	int32 logw;
 	Ps2Raster *natras = GETPS2RASTEREXT(raster);
-	uint8 *px;
+	SwizzleJob job;
 
 	if((raster->format & (Raster::PAL4|Raster::PAL8)) == 0)
 		return;
@@ -1385,45 +1492,29 @@ unswizzleRaster(Raster *raster)
 	transferMinSize(raster->format & Raster::PAL4 ? PSMT4 : PSMT8, natras->flags, &minw, &minh);
 	w = max(raster->width, minw);
 	h = max(raster->height, minh);
-	px = raster->pixels;
-	logw = 0;
-	for(i = 1; i < w; i *= 2) logw++;
-	mask = (1<<(logw+2))-1;
+	job.px = raster->pixels;
+	job.w = w;
+	job.logw = 0;
+	for(i = 1; i < w; i *= 2) job.logw++;
 
 	if(raster->format & Raster::PAL4 && natras->flags & Ps2Raster::SWIZZLED4){
-		for(y = 0; y < h; y += 4){
-			memcpy(tmpbuf, &px[y<<(logw-1)], 2*w);
-			for(i = 0; i < 4; i++)
-				for(x = 0; x < w; x++){
-					uint32 a = ((y+i)<<logw)+x;
-					uint32 s = swizzle(x, y+i, logw)&mask;
-					uint8 c = s & 1 ? tmpbuf[s>>1] >> 4 : tmpbuf[s>>1] & 0xF;
-					px[a>>1] = a & 1 ? (px[a>>1]&0xF) | c<<4 : (px[a>>1]&0xF0) | c;
-				}
-		}
+		makeSwizzleTable(&job);
+		runSwizzleJobs(unswizzle4Rows, &job, h);
+		rwFree(job.tab);
 	}else if(raster->format & Raster::PAL8 && natras->flags & Ps2Raster::SWIZZLED8){
-		for(y = 0; y < h; y += 4){
-			memcpy(tmpbuf, &px[y<<logw], 4*w);
-			for(i = 0; i < 4; i++)
-				for(x = 0; x < w; x++){
-					uint32 a = ((y+i)<<logw)+x;
-					uint32 s = swizzle(x, y+i, logw)&mask;
-					px[a] = tmpbuf[s];
-				}
-		}
+		makeSwizzleTable(&job);
+		runSwizzleJobs(unswizzle8Rows, &job, h);
+		rwFree(job.tab);
 	}
 }
 
 void
 swizzleRaster(Raster *raster)
 {
-	uint8 tmpbuf[1024*4];	// 1024x4px, maximum possible width
-	uint32 mask;
-	int32 x, y, w, h;
+	int32 w, h;
 	int32 i;
-	int32 logw;
 	Ps2Raster *natras = GETPS2RASTEREXT(raster);
-	uint8 *px;
+	SwizzleJob job;
 
 	if((raster->format & (Raster::PAL4|Raster::PAL8)) == 0)
 		return;
@@ -1432,32 +1523,19 @@ swizzleRaster(Raster *raster)
 	transferMinSize(raster->format & Raster::PAL4 ? PSMT4 : PSMT8, natras->flags, &minw, &minh);
 	w = max(raster->width, minw);
 	h = max(raster->height, minh);
-	px = raster->pixels;
-	logw = 0;
-	for(i = 1; i < raster->width; i *= 2) logw++;
-	mask = (1<<(logw+2))-1;
+	job.px = raster->pixels;
+	job.w = w;
+	job.logw = 0;
+	for(i = 1; i < raster->width; i *= 2) job.logw++;
 
 	if(raster->format & Raster::PAL4 && natras->flags & Ps2Raster::SWIZZLED4){
-		for(y = 0; y < h; y += 4){
-			for(i = 0; i < 4; i++)
-				for(x = 0; x < w; x++){
-					uint32 a = ((y+i)<<logw)+x;
-					uint32 s = swizzle(x, y+i, logw)&mask;
-					uint8 c = a & 1 ? px[a>>1] >> 4 : px[a>>1] & 0xF;
-					tmpbuf[s>>1] = s & 1 ? (tmpbuf[s>>1]&0xF) | c<<4 : (tmpbuf[s>>1]&0xF0) | c;
-				}
-			memcpy(&px[y<<(logw-1)], tmpbuf, 2*w);
-		}
+		makeSwizzleTable(&job);
+		runSwizzleJobs(swizzle4Rows, &job, h);
+		rwFree(job.tab);
 	}else if(raster->format & Raster::PAL8 && natras->flags & Ps2Raster::SWIZZLED8){
-		for(y = 0; y < h; y += 4){
-			for(i = 0; i < 4; i++)
-				for(x = 0; x < w; x++){
-					uint32 a = ((y+i)<<logw)+x;
-					uint32 s = swizzle(x, y+i, logw)&mask;
-					tmpbuf[s] = px[a];
-				}
-			memcpy(&px[y<<logw], tmpbuf, 4*w);
-		}
+		makeSwizzleTable(&job);
+		runSwizzleJobs(swizzle8Rows, &job, h);
+		rwFree(job.tab);
 	}
 }
 
@@ -1618,22 +1696,23 @@ rasterFromImage(Raster *raster, Image *image)
 	Ps2Raster *natras = GETPS2RASTEREXT(raster);
 
 	int32 pallength = 0;
+	int32 format = raster->format & (Raster::PAL4 | Raster::PAL8 | 0xF00);
 	switch(image->depth){
 	case 24:
 	case 32:
-		if(raster->format != Raster::C8888 &&
-		   raster->format != Raster::C888)	// unsafe already
+		if(format != Raster::C8888 &&
+		   format != Raster::C888)	// unsafe already
 			goto err;
 		break;
 	case 16:
-		if(raster->format != Raster::C1555) goto err;
+		if(format != Raster::C1555) goto err;
 		break;
 	case 8:
-		if(raster->format != (Raster::PAL8 | Raster::C8888)) goto err;
+		if(format != (Raster::PAL8 | Raster::C8888)) goto err;
 		pallength = 256;
 		break;
 	case 4:
-		if(raster->format != (Raster::PAL4 | Raster::C8888)) goto err;
+		if(format != (Raster::PAL4 | Raster::C8888)) goto err;
 		pallength = 16;
 		break;
 	default:
@@ -1665,7 +1744,14 @@ rasterFromImage(Raster *raster, Image *image)
 	transferMinSize(image->depth == 4 ? PSMT4 : PSMT8, natras->flags, &minw, &minh);
 	tw = max(image->width, minw);
 	uint8 *src = image->pixels;
-	out = raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+	// write to the locked level if there is one
+	bool unlock = false;
+	if(raster->privateFlags & Raster::PRIVATELOCK_WRITE)
+		out = raster->pixels;
+	else{
+		out = raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
 	if(image->depth == 4){
 		compressPal4(out, tw/2, src, image->stride, image->width, image->height);
 	}else if(image->depth == 8){
@@ -1699,7 +1785,8 @@ rasterFromImage(Raster *raster, Image *image)
 			src += image->stride;
 		}
 	}
-	raster->unlock(0);
+	if(unlock)
+		raster->unlock(0);
 	return 1;
 }
 
@@ -4,12 +4,18 @@
 #include <assert.h>
 
 #include "rwbase.h"
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
 #include "rwerror.h"
 #include "rwplg.h"
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
-//#include "ps2/rwps2.h"
+#include "ps2/rwps2.h"
 #include "d3d/rwd3d.h"
 #include "d3d/rwxbox.h"
 //#include "d3d/rwd3d8.h"
@@ -26,6 +32,7 @@ struct RasterGlobals
 {
 	int32 sp;
 	Raster *stack[32];
+	char *cacheDir;		// converted rasters, nil if disabled
 };
 int32 rasterModuleOffset;
 
@@ -39,12 +46,15 @@ rasterOpen(void *object, int32 offset, int32 size)
 	RASTERGLOBAL(sp) = -1;
 	for(i = 0; i < (int)nelem(RASTERGLOBAL(stack)); i++)
 		RASTERGLOBAL(stack)[i] = nil;
+	RASTERGLOBAL(cacheDir) = nil;
 	return object;
 }
 
 static void*
 rasterClose(void *object, int32 offset, int32 size)
 {
+	rwFree(RASTERGLOBAL(cacheDir));
+	RASTERGLOBAL(cacheDir) = nil;
 	return object;
 }
 
@@ -160,9 +170,102 @@ Raster::imageFindRasterFormat(Image *image, int32 type,
 Raster*
 Raster::setFromImage(Image *image, int32 platform)
 {
-	if(engine->driver[platform ? platform : rw::platform]->rasterFromImage(this, image))
-		return this;
-	return nil;
+	// when setting a single locked level we don't touch the others
+	bool32 locked = this->privateFlags & (PRIVATELOCK_READ|PRIVATELOCK_WRITE);
+	if(!engine->driver[platform ? platform : rw::platform]->rasterFromImage(this, image))
+		return nil;
+	if(!locked && (this->format & (MIPMAP|AUTOMIPMAP)) == (MIPMAP|AUTOMIPMAP))
+		this->generateMipmaps(image);
+	return this;
+}
+
+// find closest palette entry, for palettized mipmaps
+static uint8
+matchPaletteColor(uint8 *palette, int32 pallength, uint8 *c)
+{
+	int32 i, d, dr, dg, db, da;
+	int32 best = 0;
+	int32 bestDist = 0x7FFFFFFF;
+	for(i = 0; i < pallength; i++){
+		dr = palette[i*4+0] - c[0];
+		dg = palette[i*4+1] - c[1];
+		db = palette[i*4+2] - c[2];
+		da = palette[i*4+3] - c[3];
+		d = dr*dr + dg*dg + db*db + da*da;
+		if(d < bestDist){
+			bestDist = d;
+			best = i;
+			if(d == 0)
+				break;
+		}
+	}
+	return best;
+}
+
+// Fill all levels after the first one from the image.
+// Only done for rasters that have the levels allocated, that is
+// if the driver doesn't generate them itself.
+void
+Raster::generateMipmaps(Image *image, int32 alphaRef)
+{
+	int32 numLevels = this->getNumLevels();
+	if(numLevels <= 1)
+		return;
+
+	Driver *drv = engine->driver[this->platform];
+	int32 pallength = 0;
+	if(this->format & PAL4)
+		pallength = 16;
+	else if(this->format & PAL8)
+		pallength = 256;
+	if(pallength && image->palette == nil)
+		return;
+
+	// work on a truecolor copy of the image, but don't change the original
+	Image *img = Image::create(image->width, image->height, image->depth);
+	img->pixels = image->pixels;
+	img->stride = image->stride;
+	img->palette = image->palette;
+	img->convertTo32();
+
+	float32 coverage = 0.0f;
+	bool32 keepCoverage = alphaRef > 0 && img->hasAlpha();
+	if(keepCoverage)
+		coverage = img->getAlphaCoverage(alphaRef);
+
+	Image *palimg = nil;
+	for(int32 i = 1; i < numLevels; i++){
+		Image *mip = img->createMipmap();
+		img->destroy();
+		img = mip;
+		if(keepCoverage)
+			img->scaleAlphaToCoverage(coverage, alphaRef);
+
+		Image *levelimg = img;
+		if(pallength){
+			// all levels share the palette
+			palimg = Image::create(img->width, img->height, pallength == 16 ? 4 : 8);
+			palimg->allocate();
+			memcpy(palimg->palette, image->palette, pallength*4);
+			for(int32 y = 0; y < img->height; y++){
+				uint8 *src = img->pixels + y*img->stride;
+				uint8 *dst = palimg->pixels + y*palimg->stride;
+				for(int32 x = 0; x < img->width; x++)
+					dst[x] = matchPaletteColor(image->palette, pallength, &src[x*4]);
+			}
+			levelimg = palimg;
+		}
+
+		if(this->lock(i, LOCKWRITE|LOCKNOFETCH)){
+			drv->rasterFromImage(this, levelimg);
+			this->unlock(i);
+		}
+		if(palimg){
+			palimg->destroy();
+			palimg = nil;
+		}
+	}
+	img->destroy();
 }
 
 Raster*
@@ -337,6 +440,370 @@ conv_ABGR1555_from_ARGB1555(uint8 *out, uint8 *in)
 	out[0] = (in[0]&0xE0) | r;
 }
 
+static void
+conv_ARGB1555_from_RGBA8888(uint8 *out, uint8 *in)
+{
+	uint32 r, g, b, a;
+	r = in[0]>>3;
+	g = in[1]>>3;
+	b = in[2]>>3;
+	a = in[3]>>7;
+	out[0] = b | g<<5;
+	out[1] = g>>3 | r<<2 | a<<7;
+}
+
+/*
+ * Row converters. These do the same as the conv_ functions
+ * but for a whole row, with SIMD where it's easy.
+ * Pixels are never converted in place.
+ */
+
+static int32 pixelLayoutSizes[NUM_PIXELLAYOUTS] = {
+	1,	// PIXEL_8
+	4, 4,	// PIXEL_RGBA8888, PIXEL_BGRA8888
+	3, 3,	// PIXEL_RGB888, PIXEL_BGR888
+	2, 2, 2, 2	// PIXEL_ARGB1555, PIXEL_RGB555, PIXEL_RGBA5551, PIXEL_ABGR1555
+};
+
+int32
+pixelLayoutSize(int32 layout)
+{
+	if(layout < 0 || layout >= NUM_PIXELLAYOUTS)
+		return 0;
+	return pixelLayoutSizes[layout];
+}
+
+static void row_copy8(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n); }
+static void row_copy16(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*2); }
+static void row_copy24(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*3); }
+static void row_copy32(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*4); }
+
+// RGBA8888 <-> BGRA8888
+static void
+row_swap8888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	__m128i ga = _mm_set1_epi32((int32)0xFF00FF00);
+	for(; i+4 <= n; i += 4){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*4));
+		__m128i rb = _mm_andnot_si128(ga, v);
+		rb = _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_slli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i*)(out + i*4), _mm_or_si128(_mm_and_si128(v, ga), rb));
+	}
+#elif defined(RW_NEON)
+	for(; i+16 <= n; i += 16){
+		uint8x16x4_t v = vld4q_u8(in + i*4);
+		uint8x16_t t = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = t;
+		vst4q_u8(out + i*4, v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGRA8888_from_RGBA8888(out + i*4, in + i*4);
+}
+
+#ifdef RW_SSE2
+// 4 pixels of 3 bytes in the low 24 bits of every lane,
+// the top byte is the first of the next pixel
+static inline __m128i
+expand888(uint8 *in)
+{
+	__m128i v = _mm_loadu_si128((__m128i*)in);
+	__m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+	__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+	return _mm_unpacklo_epi64(p01, p23);
+}
+#endif
+
+// RGB888 -> RGBA8888 and BGR888 -> BGRA8888
+static void
+row_expand888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	__m128i a = _mm_set1_epi32((int32)0xFF000000);
+	// 16 bytes are read for 4 pixels
+	for(; i+6 <= n; i += 4){
+		__m128i v = expand888(in + i*3);
+		_mm_storeu_si128((__m128i*)(out + i*4), _mm_or_si128(v, a));
+	}
+#elif defined(RW_NEON)
+	for(; i+16 <= n; i += 16){
+		uint8x16x3_t v = vld3q_u8(in + i*3);
+		uint8x16x4_t o;
+		o.val[0] = v.val[0];
+		o.val[1] = v.val[1];
+		o.val[2] = v.val[2];
+		o.val[3] = vdupq_n_u8(0xFF);
+		vst4q_u8(out + i*4, o);
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGBA8888_from_RGB888(out + i*4, in + i*3);
+}
+
+// RGB888 -> BGRA8888 and BGR888 -> RGBA8888
+static void
+row_expandSwap888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	__m128i ga = _mm_set1_epi32((int32)0xFF00FF00);
+	__m128i a = _mm_set1_epi32((int32)0xFF000000);
+	for(; i+6 <= n; i += 4){
+		__m128i v = expand888(in + i*3);
+		__m128i rb = _mm_andnot_si128(ga, v);
+		rb = _mm_or_si128(_mm_srli_epi32(rb, 16), _mm_slli_epi32(rb, 16));
+		v = _mm_or_si128(_mm_and_si128(v, ga), rb);
+		_mm_storeu_si128((__m128i*)(out + i*4), _mm_or_si128(v, a));
+	}
+#elif defined(RW_NEON)
+	for(; i+16 <= n; i += 16){
+		uint8x16x3_t v = vld3q_u8(in + i*3);
+		uint8x16x4_t o;
+		o.val[0] = v.val[2];
+		o.val[1] = v.val[1];
+		o.val[2] = v.val[0];
+		o.val[3] = vdupq_n_u8(0xFF);
+		vst4q_u8(out + i*4, o);
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGRA8888_from_RGB888(out + i*4, in + i*3);
+}
+
+// RGBA8888 -> RGB888 and BGRA8888 -> BGR888
+static void
+row_shrink8888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_NEON)
+	for(; i+16 <= n; i += 16){
+		uint8x16x4_t v = vld4q_u8(in + i*4);
+		uint8x16x3_t o;
+		o.val[0] = v.val[0];
+		o.val[1] = v.val[1];
+		o.val[2] = v.val[2];
+		vst3q_u8(out + i*3, o);
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGB888_from_RGB888(out + i*3, in + i*4);
+}
+
+// RGBA8888 -> BGR888 and BGRA8888 -> RGB888
+static void
+row_shrinkSwap8888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_NEON)
+	for(; i+16 <= n; i += 16){
+		uint8x16x4_t v = vld4q_u8(in + i*4);
+		uint8x16x3_t o;
+		o.val[0] = v.val[2];
+		o.val[1] = v.val[1];
+		o.val[2] = v.val[0];
+		vst3q_u8(out + i*3, o);
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGR888_from_RGB888(out + i*3, in + i*4);
+}
+
+// RGB888 <-> BGR888
+static void
+row_swap888(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_NEON)
+	for(; i+16 <= n; i += 16){
+		uint8x16x3_t v = vld3q_u8(in + i*3);
+		uint8x16_t t = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = t;
+		vst3q_u8(out + i*3, v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGR888_from_RGB888(out + i*3, in + i*3);
+}
+
+// 16 bit pixels are little endian words in the SIMD paths
+
+static void
+row_ARGB1555_from_RGB555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	__m128i a = _mm_set1_epi16((int16)0x8000);
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		_mm_storeu_si128((__m128i*)(out + i*2), _mm_or_si128(v, a));
+	}
+#elif defined(RW_NEON)
+	uint16x8_t a = vdupq_n_u16(0x8000);
+	for(; i+8 <= n; i += 8){
+		uint16x8_t v = vld1q_u16((uint16*)(in + i*2));
+		vst1q_u16((uint16*)(out + i*2), vorrq_u16(v, a));
+	}
+#endif
+	for(; i < n; i++)
+		conv_ARGB1555_from_RGB555(out + i*2, in + i*2);
+}
+
+static void
+row_RGBA5551_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 1), _mm_srli_epi16(v, 15));
+		_mm_storeu_si128((__m128i*)(out + i*2), v);
+	}
+#elif defined(RW_NEON)
+	for(; i+8 <= n; i += 8){
+		uint16x8_t v = vld1q_u16((uint16*)(in + i*2));
+		v = vorrq_u16(vshlq_n_u16(v, 1), vshrq_n_u16(v, 15));
+		vst1q_u16((uint16*)(out + i*2), v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGBA5551_from_ARGB1555(out + i*2, in + i*2);
+}
+
+static void
+row_ARGB1555_from_RGBA5551(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		v = _mm_or_si128(_mm_srli_epi16(v, 1), _mm_slli_epi16(v, 15));
+		_mm_storeu_si128((__m128i*)(out + i*2), v);
+	}
+#elif defined(RW_NEON)
+	for(; i+8 <= n; i += 8){
+		uint16x8_t v = vld1q_u16((uint16*)(in + i*2));
+		v = vorrq_u16(vshrq_n_u16(v, 1), vshlq_n_u16(v, 15));
+		vst1q_u16((uint16*)(out + i*2), v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_ARGB1555_from_RGBA5551(out + i*2, in + i*2);
+}
+
+// ARGB1555 <-> ABGR1555
+static void
+row_swap1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#if defined(RW_SSE2)
+	__m128i ag = _mm_set1_epi16((int16)0x83E0);
+	__m128i c = _mm_set1_epi16(0x1F);
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		__m128i rb = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 10), c),
+		                          _mm_slli_epi16(_mm_and_si128(v, c), 10));
+		_mm_storeu_si128((__m128i*)(out + i*2), _mm_or_si128(_mm_and_si128(v, ag), rb));
+	}
+#elif defined(RW_NEON)
+	uint16x8_t ag = vdupq_n_u16(0x83E0);
+	uint16x8_t c = vdupq_n_u16(0x1F);
+	for(; i+8 <= n; i += 8){
+		uint16x8_t v = vld1q_u16((uint16*)(in + i*2));
+		uint16x8_t rb = vorrq_u16(vandq_u16(vshrq_n_u16(v, 10), c),
+		                          vshlq_n_u16(vandq_u16(v, c), 10));
+		vst1q_u16((uint16*)(out + i*2), vorrq_u16(vandq_u16(v, ag), rb));
+	}
+#endif
+	for(; i < n; i++)
+		conv_ABGR1555_from_ARGB1555(out + i*2, in + i*2);
+}
+
+static void
+row_RGBA8888_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++)
+		conv_RGBA8888_from_ARGB1555(out + i*4, in + i*2);
+}
+
+static void
+row_ARGB1555_from_RGBA8888(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++)
+		conv_ARGB1555_from_RGBA8888(out + i*2, in + i*4);
+}
+
+struct ConvRowEntry
+{
+	int32 dst, src;
+	ConvRowFunc func;
+};
+static ConvRowEntry convRowTable[] = {
+	{ PIXEL_BGRA8888, PIXEL_RGBA8888, row_swap8888 },
+	{ PIXEL_RGBA8888, PIXEL_BGRA8888, row_swap8888 },
+	{ PIXEL_RGBA8888, PIXEL_RGB888, row_expand888 },
+	{ PIXEL_BGRA8888, PIXEL_BGR888, row_expand888 },
+	{ PIXEL_BGRA8888, PIXEL_RGB888, row_expandSwap888 },
+	{ PIXEL_RGBA8888, PIXEL_BGR888, row_expandSwap888 },
+	{ PIXEL_RGB888, PIXEL_RGBA8888, row_shrink8888 },
+	{ PIXEL_BGR888, PIXEL_BGRA8888, row_shrink8888 },
+	{ PIXEL_BGR888, PIXEL_RGBA8888, row_shrinkSwap8888 },
+	{ PIXEL_RGB888, PIXEL_BGRA8888, row_shrinkSwap8888 },
+	{ PIXEL_BGR888, PIXEL_RGB888, row_swap888 },
+	{ PIXEL_RGB888, PIXEL_BGR888, row_swap888 },
+	{ PIXEL_ARGB1555, PIXEL_RGB555, row_ARGB1555_from_RGB555 },
+	{ PIXEL_RGB555, PIXEL_ARGB1555, row_copy16 },
+	{ PIXEL_RGBA5551, PIXEL_ARGB1555, row_RGBA5551_from_ARGB1555 },
+	{ PIXEL_ARGB1555, PIXEL_RGBA5551, row_ARGB1555_from_RGBA5551 },
+	{ PIXEL_ABGR1555, PIXEL_ARGB1555, row_swap1555 },
+	{ PIXEL_ARGB1555, PIXEL_ABGR1555, row_swap1555 },
+	{ PIXEL_RGBA8888, PIXEL_ARGB1555, row_RGBA8888_from_ARGB1555 },
+	{ PIXEL_ARGB1555, PIXEL_RGBA8888, row_ARGB1555_from_RGBA8888 },
+};
+
+ConvRowFunc
+findConvRow(int32 dstLayout, int32 srcLayout)
+{
+	if(dstLayout == srcLayout)
+		switch(pixelLayoutSize(dstLayout)){
+		case 1: return row_copy8;
+		case 2: return row_copy16;
+		case 3: return row_copy24;
+		case 4: return row_copy32;
+		default: return nil;
+		}
+	for(int32 i = 0; i < (int32)nelem(convRowTable); i++)
+		if(convRowTable[i].dst == dstLayout && convRowTable[i].src == srcLayout)
+			return convRowTable[i].func;
+	return nil;
+}
+
+bool32
+convertPixels(uint8 *dst, int32 dstStride, int32 dstLayout,
+              uint8 *src, int32 srcStride, int32 srcLayout,
+              int32 width, int32 height)
+{
+	ConvRowFunc conv = findConvRow(dstLayout, srcLayout);
+	if(conv == nil)
+		return 0;
+	// no padding, convert everything as one row
+	if(dstStride == width*pixelLayoutSize(dstLayout) &&
+	   srcStride == width*pixelLayoutSize(srcLayout)){
+		conv(dst, src, width*height);
+		return 1;
+	}
+	for(int32 y = 0; y < height; y++){
+		conv(dst, src, width);
+		dst += dstStride;
+		src += srcStride;
+	}
+	return 1;
+}
+
 void
 expandPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
@@ -496,6 +963,200 @@ xbox_to_gl3(rw::Raster *ras)
 #endif
 }
 
+// Conversion cache
+//
+// Rasters that have to go through Image to reach the current platform
+// are stored in the cache directory after conversion, keyed by a hash
+// of their native data. Loading them again is then a plain read.
+
+#define RASCACHE_MAGIC 0x43534152	// "RASC"
+#define RASCACHE_VERSION 1
+
+void
+Raster::setConversionCacheDir(const char *dir)
+{
+	rwFree(RASTERGLOBAL(cacheDir));
+	RASTERGLOBAL(cacheDir) = dir && *dir ? rwStrdup(dir, MEMDUR_EVENT) : nil;
+}
+
+static uint64
+hashData(uint64 h, const void *data, uint32 size)
+{
+	const uint8 *p = (const uint8*)data;
+	uint64 w;
+	// FNV-1a on whole words, then the tail
+	for(; size >= 8; size -= 8, p += 8){
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0x100000001B3ULL;
+		h ^= h >> 29;
+	}
+	for(; size > 0; size--)
+		h = (h ^ *p++) * 0x100000001B3ULL;
+	return h;
+}
+
+static uint64
+hashRasterLevels(uint64 h, RasterLevels *levels)
+{
+	for(int32 i = 0; i < levels->numlevels; i++)
+		h = hashData(h, levels->levels[i].data, levels->levels[i].size);
+	return h;
+}
+
+// Hash the native data of a texture without touching the pixels
+// through lock(), which would decode them first.
+static bool32
+hashNativeRaster(Raster *ras, uint64 *hash)
+{
+	using namespace rw;
+
+	int32 header[7];
+	header[0] = RASCACHE_VERSION;
+	header[1] = ras->platform;
+	header[2] = rw::platform;
+	header[3] = ras->width;
+	header[4] = ras->height;
+	header[5] = ras->depth;
+	header[6] = ras->format | ras->type | ras->flags;
+	uint64 h = hashData(0xCBF29CE484222325ULL, header, sizeof(header));
+
+	int32 palSize = ras->format & Raster::PAL8 ? 256*4 :
+	                ras->format & Raster::PAL4 ? 16*4 : 0;
+	switch(ras->platform){
+	case PLATFORM_PS2: {
+		ps2::Ps2Raster *natras = GETPS2RASTEREXT(ras);
+		if(natras->data == nil)
+			return 0;
+		if(natras->flags & ps2::Ps2Raster::NEWSTYLE){
+			// skip the DMA chain, it has pointers in it
+			h = hashData(h, ((ps2::Ps2Raster::PixelPtr*)ras->originalPixels)->pixels, natras->pixelSize);
+			if(natras->paletteSize)
+				h = hashData(h, ras->palette-0x50, natras->paletteSize);
+		}else
+			h = hashData(h, natras->data, natras->dataSize);
+		break;
+	}
+	case PLATFORM_XBOX: {
+		xbox::XboxRaster *natras = GETXBOXRASTEREXT(ras);
+		if(natras->texture == nil)
+			return 0;
+		h = hashRasterLevels(h, (RasterLevels*)natras->texture);
+		if(natras->palette && palSize)
+			h = hashData(h, natras->palette, palSize);
+		break;
+	}
+#ifndef RW_D3D9
+	case PLATFORM_D3D8:
+	case PLATFORM_D3D9: {
+		d3d::D3dRaster *natras = GETD3DRASTEREXT(ras);
+		if(natras->texture == nil)
+			return 0;
+		h = hashRasterLevels(h, (RasterLevels*)natras->texture);
+		if(natras->palette && palSize)
+			h = hashData(h, natras->palette, palSize);
+		break;
+	}
+#endif
+	default:
+		return 0;
+	}
+	*hash = h;
+	return 1;
+}
+
+static void
+cachePath(char *path, size_t len, uint64 hash)
+{
+	snprintf(path, len, "%s/%08x%08x.ras", RASTERGLOBAL(cacheDir),
+		(uint32)(hash>>32), (uint32)hash);
+}
+
+static Raster*
+readCachedRaster(uint64 hash)
+{
+	char path[1024];
+	StreamFile stream;
+	int32 i;
+
+	cachePath(path, sizeof(path), hash);
+	// not StreamFile::open, a miss is not an error
+	stream.file = fopen(path, "rb");
+	if(stream.file == nil)
+		return nil;
+	int32 width, height, depth, format, numLevels;
+	Raster *ras = nil;
+	if(stream.readU32() != RASCACHE_MAGIC ||
+	   stream.readI32() != RASCACHE_VERSION ||
+	   stream.readI32() != rw::platform)
+		goto fail;
+	width = stream.readI32();
+	height = stream.readI32();
+	depth = stream.readI32();
+	format = stream.readI32();
+	numLevels = stream.readI32();
+	ras = Raster::create(width, height, depth, format);
+	if(ras == nil || ras->getNumLevels() != numLevels)
+		goto fail;
+	for(i = 0; i < numLevels; i++){
+		uint8 *px = ras->lock(i, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		uint32 size = stream.readU32();
+		bool32 ok = px && size == (uint32)(ras->stride*ras->height) &&
+			stream.read8(px, size) == size;
+		ras->unlock(i);
+		if(!ok)
+			goto fail;
+	}
+	stream.close();
+	return ras;
+
+fail:
+	if(ras)
+		ras->destroy();
+	stream.close();
+	return nil;
+}
+
+static void
+writeCachedRaster(uint64 hash, Raster *ras)
+{
+	char path[1024], tmppath[1024+8];
+	StreamFile stream;
+	bool32 ok = 1;
+
+	cachePath(path, sizeof(path), hash);
+	// write to a temporary so nobody reads a half-written file
+	snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	stream.file = fopen(tmppath, "wb");
+	if(stream.file == nil)
+		return;
+	int32 numLevels = ras->getNumLevels();
+	stream.writeU32(RASCACHE_MAGIC);
+	stream.writeI32(RASCACHE_VERSION);
+	stream.writeI32(ras->platform);
+	stream.writeI32(ras->width);
+	stream.writeI32(ras->height);
+	stream.writeI32(ras->depth);
+	stream.writeI32(ras->format | ras->type | ras->flags);
+	stream.writeI32(numLevels);
+	for(int32 i = 0; i < numLevels && ok; i++){
+		uint8 *px = ras->lock(i, Raster::LOCKREAD);
+		if(px){
+			uint32 size = ras->stride*ras->height;
+			stream.writeU32(size);
+			ok = stream.write8(px, size) == size;
+		}else
+			ok = 0;
+		ras->unlock(i);
+	}
+	stream.close();
+	if(ok){
+		remove(path);
+		ok = rename(tmppath, path) == 0;
+	}
+	if(!ok)
+		remove(tmppath);
+}
+
 rw::Raster*
 Raster::convertTexToCurrentPlatform(rw::Raster *ras)
 {
@@ -529,7 +1190,17 @@ Raster::convertTexToCurrentPlatform(rw::Raster *ras)
 		}
 	}
 
-	// fall back to going through Image directly
+	// fall back to going through Image directly, unless we did that before
+	uint64 hash;
+	bool32 cache = RASTERGLOBAL(cacheDir) && hashNativeRaster(ras, &hash);
+	if(cache){
+		Raster *newras = readCachedRaster(hash);
+		if(newras){
+			ras->destroy();
+			return newras;
+		}
+	}
+
 	int32 width, height, depth, format;
 	Image *img = ras->toImage();
 	// TODO: maybe don't *always* do this?
@@ -552,6 +1223,8 @@ Raster::convertTexToCurrentPlatform(rw::Raster *ras)
 	}
 	ras->destroy();
 	ras = newras;
+	if(cache)
+		writeCachedRaster(hash, ras);
 	return ras;
 }
 
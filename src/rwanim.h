@@ -58,11 +58,17 @@ struct Animation
 	float32  duration;
 	void    *keyframes;
 	void    *customData;
+	// built on first use
+	int32   *nodeMap;	// node of every keyframe
+	int32   *nodeKeys;	// keyframes of every node in time order
+	int32   *nodeKeyOffsets;	// first of every node in nodeKeys
 
 	static Animation *create(AnimInterpolatorInfo*, int32 numFrames,
 	                         int32 flags, float duration);
 	void destroy(void);
 	int32 getNumNodes(void);
+	void makeDelta(int32 numNodes, float32 time);
+	void buildKeyFrameIndex(int32 numNodes);
 	KeyFrameHeader *getAnimFrame(int32 n){
 		return (KeyFrameHeader*)((uint8*)this->keyframes +
 		                         n*this->interpInfo->animKeyFrameSize);
@@ -83,7 +89,9 @@ struct AnimInterpolator
 	int32      currentInterpKeyFrameSize;
 	int32      currentAnimKeyFrameSize;
 	int32      numNodes;
-	// TODO some callbacks, parent/sub
+	// sub interpolators animate numNodes nodes of the parent from offsetInParent
+	AnimInterpolator *parentInterp;
+	int32      offsetInParent;
 	// cached from the InterpolatorInfo
 	AnimInterpolatorInfo::ApplyCB    applyCB;
 	AnimInterpolatorInfo::BlendCB    blendCB;
@@ -92,9 +100,16 @@ struct AnimInterpolator
 	// after this interpolated frames
 
 	static AnimInterpolator *create(int32 numNodes, int32 maxKeyFrameSize);
+	AnimInterpolator *createSubInterpolator(int32 startNode, int32 numNodes, int32 maxKeyFrameSize);
 	void destroy(void);
 	bool32 setCurrentAnim(Animation *anim);
 	void addTime(float32 t);
+	void subTime(float32 t);
+	void setCurrentTime(float32 t);
+	bool32 blend(AnimInterpolator *in1, AnimInterpolator *in2, float32 alpha);
+	bool32 addTogether(AnimInterpolator *in1, AnimInterpolator *in2);
+	void updateParent(void);
+	void takeCallbacks(AnimInterpolator *src);
 	void *getFrames(void){ return this+1;}
 	InterpFrameHeader *getInterpFrame(int32 n){
 		return (InterpFrameHeader*)((uint8*)getFrames() +
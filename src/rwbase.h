@@ -84,6 +84,13 @@ typedef uint32 uint;
 #endif
 #endif
 
+// SIMD paths for CPU-heavy code, always with a plain C fallback
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RW_SSE2
+#elif (defined(__ARM_NEON) || defined(_M_ARM64)) && !defined(BIGENDIAN)
+#define RW_NEON
+#endif
+
 // Lists
 
 struct LLLink
@@ -557,7 +564,9 @@ enum VendorID
 	// Used for rasters (platform-specific)
 	VEND_RASTER         = 10,
 	// Used for driver/device allocation tags
-	VEND_DRIVER         = 11
+	VEND_DRIVER         = 11,
+	// librw extensions
+	VEND_LIBRW          = 12
 };
 
 // TODO: modules (VEND_CRITERIONINT)
@@ -589,7 +598,9 @@ enum PluginID
 	ID_UVANIMDICT    = MAKEPLUGINID(VEND_CORE, 0x2B),
 
 	// Toolkit
+	ID_MORPH         = MAKEPLUGINID(VEND_CRITERIONTK, 0x05),
 	ID_SKYMIPMAP     = MAKEPLUGINID(VEND_CRITERIONTK, 0x10),
+	ID_LODATOMIC     = MAKEPLUGINID(VEND_CRITERIONTK, 0x12),
 	ID_SKIN          = MAKEPLUGINID(VEND_CRITERIONTK, 0x16),
 	ID_HANIM         = MAKEPLUGINID(VEND_CRITERIONTK, 0x1E),
 	ID_USERDATA      = MAKEPLUGINID(VEND_CRITERIONTK, 0x1F),
@@ -614,7 +625,10 @@ enum PluginID
 	ID_RASTERGL3     = MAKEPLUGINID(VEND_RASTER, PLATFORM_GL3),
 
 	// anything driver/device related (only as allocation tag)
-	ID_DRIVER        = MAKEPLUGINID(VEND_DRIVER, 0)
+	ID_DRIVER        = MAKEPLUGINID(VEND_DRIVER, 0),
+
+	// librw
+	ID_INDEX32       = MAKEPLUGINID(VEND_LIBRW, 0x01)
 };
 
 enum CoreModuleID
@@ -654,6 +668,10 @@ extern int32 version;
 extern int32 build;
 extern int32 platform;
 extern bool32 streamAppendFrames;
+extern bool32 streamWeldVertices;	// merge identical vertices of geometries read
+extern int32 buildMeshesCacheSize;	// optimize triangle order in buildMeshes if > 0
+extern bool32 buildMeshesOverdraw;	// and order clusters for less overdraw
+extern int32 tristripTunnelBudget;	// search steps for improving tristrips, 0 to disable
 extern char *debugFile;
 
 int strcmp_ci(const char *s1, const char *s2);
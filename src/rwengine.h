@@ -224,6 +224,16 @@ extern MemoryFunctions defaultMemfuncs;
 extern MemoryFunctions managedMemfuncs;
 void printleaks(void);	// when using managed mem funcs
 
+// Worker threads for data parallel work.
+// func is called for every 0 <= i < n, runJobs returns when all are done.
+// Memory functions have to be thread safe, with managed memory
+// jobs run serially.
+typedef void (*JobFunc)(int32 i, void *data);
+void runJobs(JobFunc func, int32 n, void *data);
+void setNumJobThreads(int32 n);	// including caller, 0 = one per core
+int32 getNumJobThreads(void);
+void closeJobs(void);
+
 namespace null {
 	void beginUpdate(Camera*);
 	void endUpdate(Camera*);
@@ -150,12 +150,17 @@ struct Image
 	void applyMask(Image *mask);
 	void removeMask(void);
 	Image *extractMask(void);
+	// gamma correct half size RGBA8888 copy
+	Image *createMipmap(void);
+	float32 getAlphaCoverage(int32 alphaRef);
+	void scaleAlphaToCoverage(float32 coverage, int32 alphaRef);
 
 	static void setSearchPath(const char*);
 	static void printSearchPath(void);
 	static char *getFilename(const char*);
 	static Image *read(const char *imageName);
 	static Image *readMasked(const char *imageName, const char *maskName);
+	static int32 readBatch(const char **imageNames, int32 n, Image **images);
 
 
 	typedef Image *(*fileRead)(const char *afilename);
@@ -252,6 +257,7 @@ struct Raster
 		int32 *pWidth, int32 *pHeight, int32 *pDepth, int32 *pFormat, int32 platform = 0);
 	Raster *setFromImage(Image *image, int32 platform = 0);
 	static Raster *createFromImage(Image *image, int32 platform = 0);
+	void generateMipmaps(Image *image, int32 alphaRef = 128);
 	Image *toImage(void);
 	uint8 *lock(int32 level, int32 lockMode);
 	void unlock(int32 level);
@@ -269,6 +275,7 @@ struct Raster
 	bool32 renderFast(int32 x, int32 y);
 
 	static Raster *convertTexToCurrentPlatform(Raster *ras);
+	static void setConversionCacheDir(const char *dir);
 #ifndef RWPUBLIC
 	static void registerModule(void);
 #endif
@@ -333,6 +340,31 @@ inline void conv_RGBA8888_from_BGRA8888(uint8 *out, uint8 *in) { conv_BGRA8888_f
 inline void conv_RGB888_from_BGR888(uint8 *out, uint8 *in) { conv_BGR888_from_RGB888(out, in); }
 inline void conv_ARGB1555_from_ABGR1555(uint8 *out, uint8 *in) { conv_ABGR1555_from_ARGB1555(out, in); }
 
+// Pixel layouts in memory for the row converters.
+// X8R8G8B8 style formats use the layout with alpha.
+enum PixelLayout
+{
+	PIXEL_8,	// palette index or single channel
+	PIXEL_RGBA8888,
+	PIXEL_BGRA8888,
+	PIXEL_RGB888,
+	PIXEL_BGR888,
+	PIXEL_ARGB1555,
+	PIXEL_RGB555,	// ARGB1555 with undefined alpha
+	PIXEL_RGBA5551,
+	PIXEL_ABGR1555,
+
+	NUM_PIXELLAYOUTS
+};
+// convert a row of n pixels
+typedef void (*ConvRowFunc)(uint8 *out, uint8 *in, int32 n);
+ConvRowFunc findConvRow(int32 dstLayout, int32 srcLayout);
+int32 pixelLayoutSize(int32 layout);
+// convert a whole image, strides can be negative. false if unsupported
+bool32 convertPixels(uint8 *dst, int32 dstStride, int32 dstLayout,
+                     uint8 *src, int32 srcStride, int32 srcLayout,
+                     int32 width, int32 height);
+
 void expandPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 void compressPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 void expandPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
@@ -449,7 +481,10 @@ void registerMaterialRightsPlugin(void);
 
 struct Mesh
 {
-	uint16 *indices;
+	union {
+		uint16 *indices;
+		uint32 *indices32;	// when MeshHeader::index32 is set
+	};
 	uint32 numIndices;
 	Material *material;
 };
@@ -463,12 +498,14 @@ struct MeshHeader
 	uint16 numMeshes;
 	uint16 serialNum;
 	uint32 totalIndices;
-	uint32 pad;	// needed for alignment of Meshes
+	uint32 index32;	// indices are uint32, also needed for alignment of Meshes
 	// after this the meshes
 
 	Mesh *getMeshes(void) { return (Mesh*)(this+1); }
+	uint32 indexSize(void) { return this->index32 ? 4 : 2; }
 	void setupIndices(void);
 	uint32 guessNumTriangles(void);
+	float32 calculateACMR(int32 cacheSize = 16);
 };
 
 struct Geometry;
@@ -480,7 +517,8 @@ struct MorphTarget
 	V3d *vertices;
 	V3d *normals;
 
-	Sphere calculateBoundingSphere(void) const;
+	// refineSteps passes over the vertices tighten the sphere
+	Sphere calculateBoundingSphere(int32 refineSteps = 16) const;
 };
 
 struct InstanceDataHeader
@@ -494,6 +532,13 @@ struct Triangle
 	uint16 matId;
 };
 
+// Triangles of Geometry::INDEX32 geometries
+struct Triangle32
+{
+	uint32 v[3];
+	uint16 matId;
+};
+
 struct MaterialList
 {
 	Material **materials;
@@ -516,12 +561,16 @@ struct Geometry
 	Object object;
 	uint32 flags;
 	uint16 lockedSinceInst;
+	// vertices [first, end) of each attribute locked since
+	// instancing, indexed by the bit of its lock flag
+	struct LockedRange { int32 first, end; } lockedRanges[12];
 	int32 numTriangles;
 	int32 numVertices;
 	int32 numMorphTargets;
 	int32 numTexCoordSets;
 
 	Triangle *triangles;
+	Triangle32 *triangles32;	// instead of triangles with INDEX32
 	RGBA *colors;
 	TexCoords *texCoords[8];
 
@@ -539,17 +588,24 @@ struct Geometry
 	void addRef(void) { this->refCount++; }
 	void destroy(void);
 	void lock(int32 lockFlags);
+	void lockRange(int32 lockFlags, int32 first, int32 num);
+	int32 getLockedRange(int32 lockFlags, int32 *first);
 	void unlock(void);
 	void addMorphTargets(int32 n);
 	void calculateBoundingSphere(void);
 	bool32 hasColoredMaterial(void);
 	void allocateData(void);
-	MeshHeader *allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices);
+	MeshHeader *allocateMeshes(int32 numMeshes, uint32 numIndices, bool32 noIndices, bool32 index32 = 0);
 	void generateTriangles(int8 *adc = nil);
 	void buildMeshes(void);
 	void buildTristrips(void);	// private, used by buildMeshes
 	void correctTristripWinding(void);
 	void removeUnusedMaterials(void);
+	void optimizeTriangleOrder(int32 cacheSize = 16, bool32 overdraw = 0);
+	void optimizeVertexOrder(void);
+	Geometry *simplify(int32 targetTriangles, float32 maxError = 0.0f);
+	void remapVertices(int32 *map, int32 numVertices);
+	int32 weldVertices(void);
 	static Geometry *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
@@ -573,7 +629,12 @@ struct Geometry
 		// to prevent rendering when executing a pipeline,
 		// so only instancing will occur.
 		// librw's pipelines are different so it's unused here.
-		NATIVEINSTANCE = 0x02000000
+		NATIVEINSTANCE = 0x02000000,
+		// librw extension: triangles are in triangles32
+		// and meshes have 32 bit indices, so there can
+		// be more than 65536 vertices. The triangles
+		// are only streamed by the Index32 plugin.
+		INDEX32        = 0x04000000
 	};
 
 	enum LockFlags
@@ -600,6 +661,7 @@ struct Geometry
 
 void registerMeshPlugin(void);
 void registerNativeDataPlugin(void);
+void registerIndex32Plugin(void);
 
 struct Clump;
 struct World;
@@ -901,4 +963,15 @@ struct TexDictionary
 	static TexDictionary *getCurrent(void);
 };
 
+struct AtlasParams
+{
+	int32 maxSize;		// max width and height of an atlas
+	int32 maxTexSize;	// bigger textures are left alone
+	int32 padding;		// texels around each texture
+};
+// Pack small textures of the clump into atlases and remap texture coordinates.
+// Meshes that end up with the same material are merged.
+// New textures are added to txd if not nil, returns number of atlases.
+int32 buildAtlases(Clump *clump, TexDictionary *txd, const AtlasParams *params = nil);
+
 }
@@ -1,6 +1,7 @@
 namespace rw {
 
 struct Atomic;
+struct Geometry;
 
 class Pipeline
 {
@@ -37,6 +38,8 @@ public:
 };
 
 void findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices);
+void findMinVertAndNumVertices(uint32 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices);
+int32 getInstanceRange(Geometry *geo, int32 lockFlags, bool32 reinstance, int32 numVertices, int32 *first);
 
 // everything xbox, d3d8 and d3d9 may want to use
 enum {
@@ -51,7 +54,10 @@ enum {
 	VERT_FLOAT4,
 	VERT_ARGB,
 	VERT_RGBA,
-	VERT_COMPNORM
+	VERT_COMPNORM,
+	VERT_PACKEDNORM,	// signed normalized 10:10:10:2, x in the low bits
+	VERT_HALF2,
+	VERT_NORMUBYTE4
 };
 
 void instV4d(int type, uint8 *dst, V4d *src, uint32 numVertices, uint32 stride);
@@ -20,6 +20,44 @@ struct HAnimInterpFrame
 	V3d            t;
 };
 
+// Keyframes with 16 bit smallest three quaternions and translations
+// quantized to the range of the animation, interpolated to HAnimInterpFrames
+struct HAnimCompressedKeyFrame
+{
+	HAnimCompressedKeyFrame *prev;
+	float32        time;
+	uint16         q[3];	// top bits of q[0] and q[1]: index of the largest component
+	uint16         t[3];
+
+	enum { ANIMTYPE = 0x1B9 };
+};
+
+struct HAnimCompressedCustomData
+{
+	V3d offset;
+	V3d scale;
+};
+
+// Keyframes sampled at a fixed rate, numNodes of them for every sample.
+// Interpolation finds the two samples from the time alone.
+// Same layout as HAnimKeyFrame.
+struct HAnimBakedKeyFrame
+{
+	HAnimBakedKeyFrame *prev;
+	float32        time;
+	Quat           q;
+	V3d            t;
+
+	enum { ANIMTYPE = 0x1BA };
+};
+
+struct HAnimBakedCustomData
+{
+	float32 rate;	// samples per second
+	int32 numNodes;
+	int32 numSamples;
+};
+
 struct HAnimNodeInfo
 {
 	int32 id;
@@ -28,6 +66,8 @@ struct HAnimNodeInfo
 	Frame *frame;
 };
 
+struct Skin;
+
 struct HAnimHierarchy
 {
 	int32 flags;
@@ -38,6 +78,15 @@ struct HAnimHierarchy
 	Frame *parentFrame;
 	HAnimHierarchy *parentHierarchy;	// mostly unused
 	AnimInterpolator *interpolator;
+	uint32 serial;	// incremented by updateMatrices, or call invalidatePalette when changing matrices
+	int32 *idMap;	// hash of node ids, built on demand
+
+	// see Skin::getPalette: the bone matrices times the inverse atomic LTM,
+	// then the skinning matrices last made from them for paletteSkin
+	Matrix *palette;	// 2*numNodes
+	Matrix paletteLTM;
+	uint32 paletteSerial;
+	Skin *paletteSkin;
 
 	static HAnimHierarchy *create(int32 numNodes, int32 *nodeFlags,
 			int32 *nodeIDs, int32 flags, int32 maxKeySize);
@@ -46,7 +95,14 @@ struct HAnimHierarchy
 	void attach(void);
 	int32 getIndex(int32 id);
 	int32 getIndex(Frame *f);
+	void buildIdMap(void);
 	void updateMatrices(void);
+	// make Skin::getPalette rebuild the palette, after changing
+	// matrices or a skin's inverse bind matrices by hand
+	void invalidatePalette(void) {
+		this->paletteSerial = this->serial-1;
+		this->paletteSkin = nil; }
+	static void updateBatch(HAnimHierarchy **hierarchies, float32 *times, int32 n);
 
 	static HAnimHierarchy *get(Frame *f);
 	static HAnimHierarchy *get(Clump *c){
@@ -78,6 +134,9 @@ struct HAnimData
 extern int32 hAnimOffset;
 extern bool32 hAnimDoStream;
 void registerHAnimPlugin(void);
+Animation *compressHAnimAnimation(Animation *anim);
+Animation *decompressHAnimAnimation(Animation *anim);
+Animation *bakeHAnimAnimation(Animation *anim, float32 rate);
 
 
 /*
@@ -225,6 +284,8 @@ struct Skin
 	void findUsedBones(int32 numVertices);
 
 	static void setPipeline(Atomic *a, int32 type);
+	static Matrix *getPalette(Atomic *atomic);
+	static void skinVertices(Atomic *atomic, V3d *vertices, V3d *normals);
 	static Skin *get(const Geometry *geo){
 		return *PLUGINOFFSET(Skin*, geo, skinGlobals.geoOffset);
 	}
@@ -246,4 +307,89 @@ Stream *writeSkinSplitData(Stream *stream, Skin *skin);
 int32 skinSplitDataSize(Skin *skin);
 void registerSkinPlugin(void);
 
+/*
+ * Morph
+ */
+
+struct MorphKeyFrame
+{
+	MorphKeyFrame *prev;
+	float32        time;
+	int32          target;
+};
+
+struct MorphInterpFrame
+{
+	MorphKeyFrame *keyFrame1;
+	MorphKeyFrame *keyFrame2;
+	int32          startTarget;
+	int32          endTarget;
+	float32        factor;
+};
+
+// Atomic plugin, blends two morph targets of the geometry
+struct Morph
+{
+	int32 startTarget;
+	int32 endTarget;
+	float32 factor;	// 0.0 is startTarget, 1.0 endTarget
+	AnimInterpolator *interp;
+
+	enum { ANIMTYPE = 0x105 };
+
+	// clamped to the morph targets the geometry has
+	int32 getStartTarget(const Geometry *geo) const {
+		return startTarget < 0 ? 0 : startTarget < geo->numMorphTargets ? startTarget : geo->numMorphTargets-1; }
+	int32 getEndTarget(const Geometry *geo) const {
+		return endTarget < 0 ? 0 : endTarget < geo->numMorphTargets ? endTarget : geo->numMorphTargets-1; }
+
+	static Morph *get(const Atomic *atomic);
+	static void setTargets(Atomic *atomic, int32 start, int32 end, float32 factor);
+	static void setAnimation(Atomic *atomic, Animation *anim);
+	static void addTime(Atomic *atomic, float32 t);
+	static void applyUpdate(Atomic *atomic);
+	static void interpolate(Atomic *atomic, V3d *vertices, V3d *normals);
+	static void setPipeline(Atomic *atomic);
+};
+
+struct MorphGlobals
+{
+	int32 atomicOffset;
+	ObjPipeline *pipelines[NUM_PLATFORMS];
+};
+extern MorphGlobals morphGlobals;
+
+void blendMorphTargets(V3d *dst, V3d *start, V3d *end, float32 t, int32 n);
+void registerMorphPlugin(void);
+
+/*
+ * LOD atomics
+ */
+
+// Atomic plugin, switches between geometries of different detail
+struct LODAtomic
+{
+	enum { MAXLODS = 10 };
+	typedef int32 (*SelectCB)(Atomic *atomic);
+
+	Geometry *lods[MAXLODS];	// 0 is the most detailed
+	int32 currentLOD;
+	SelectCB selectCB;	// nil uses defaultSelectLOD
+	Atomic::RenderCB renderCB;	// called after selecting the LOD
+
+	// distance at which the last LOD is used, 0 is the camera's far plane
+	static float32 range;
+
+	static LODAtomic *get(Atomic *atomic);
+	static void setGeometry(Atomic *atomic, int32 lod, Geometry *geo);
+	static void generateLODs(Atomic *atomic, int32 numLODs, float32 reduction = 0.5f);
+	static void setCurrentLOD(Atomic *atomic, int32 lod);
+	static void setSelectCB(Atomic *atomic, SelectCB cb);
+	static void hookRender(Atomic *atomic);
+	static void unhookRender(Atomic *atomic);
+	static int32 defaultSelectLOD(Atomic *atomic);
+};
+
+void registerLODAtomicPlugin(void);
+
 }
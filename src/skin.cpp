@@ -20,6 +20,13 @@
 #include "gl/rwgl3.h"
 #include "gl/rwgl3plg.h"
 
+#ifdef RW_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef RW_NEON
+#include <arm_neon.h>
+#endif
+
 #define PLUGIN_ID ID_SKIN
 
 namespace rw {
@@ -483,4 +490,223 @@ Skin::setPipeline(Atomic *a, int32 type)
 	a->pipeline = skinGlobals.pipelines[rw::platform];
 }
 
+// dst[i] = src1[i] * src2[i] for n matrices, src2 is the same
+// for all if src2stride is 0. dst may be src2, its flags are 0.
+static void
+multMatrices(Matrix *dst, const Matrix *src1, const Matrix *src2, int32 src2stride, int32 n)
+{
+	int32 i, j;
+#if defined(RW_SSE2)
+	// the fourth lanes hold flags and padding
+	const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	for(i = 0; i < n; i++){
+		const float32 *a = (const float32*)&src1[i];
+		const float32 *b = (const float32*)&src2[i*src2stride];
+		__m128 r = _mm_and_ps(_mm_loadu_ps(b), mask);
+		__m128 u = _mm_and_ps(_mm_loadu_ps(b+4), mask);
+		__m128 t = _mm_and_ps(_mm_loadu_ps(b+8), mask);
+		__m128 p = _mm_and_ps(_mm_loadu_ps(b+12), mask);
+		float32 *d = (float32*)&dst[i];
+		for(j = 0; j < 4; j++){
+			__m128 v = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(a[j*4+0]), r),
+				_mm_mul_ps(_mm_set1_ps(a[j*4+1]), u)),
+				_mm_mul_ps(_mm_set1_ps(a[j*4+2]), t));
+			if(j == 3)
+				v = _mm_add_ps(v, p);
+			_mm_storeu_ps(d + j*4, v);
+		}
+	}
+#elif defined(RW_NEON)
+	static const uint32 maskbits[4] = { ~0u, ~0u, ~0u, 0 };
+	const uint32x4_t mask = vld1q_u32(maskbits);
+	for(i = 0; i < n; i++){
+		const float32 *a = (const float32*)&src1[i];
+		const float32 *b = (const float32*)&src2[i*src2stride];
+		float32x4_t r = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vld1q_f32(b)), mask));
+		float32x4_t u = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vld1q_f32(b+4)), mask));
+		float32x4_t t = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vld1q_f32(b+8)), mask));
+		float32x4_t p = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vld1q_f32(b+12)), mask));
+		float32 *d = (float32*)&dst[i];
+		for(j = 0; j < 4; j++){
+			float32x4_t v = vmulq_n_f32(r, a[j*4+0]);
+			v = vmlaq_n_f32(v, u, a[j*4+1]);
+			v = vmlaq_n_f32(v, t, a[j*4+2]);
+			if(j == 3)
+				v = vaddq_f32(v, p);
+			vst1q_f32(d + j*4, v);
+		}
+	}
+#else
+	Matrix tmp;
+	for(i = 0; i < n; i++){
+		// dst may be src2
+		Matrix::mult_(&tmp, &src1[i], &src2[i*src2stride]);
+		tmp.flags = 0;
+		tmp.pad1 = 0;
+		tmp.pad2 = 0;
+		tmp.pad3 = 0;
+		dst[i] = tmp;
+	}
+	(void)j;
+#endif
+}
+
+// Matrices from skin to skinned space: inverse bind matrix * bone matrix,
+// times the inverse atomic LTM unless the hierarchy is in local space.
+// The part without the skin is kept in the hierarchy for all atomics
+// on it with the same LTM, like the LODs or body parts of a character,
+// and rendering the same skin again doesn't redo the rest either.
+// Changes the cache can't see need HAnimHierarchy::invalidatePalette.
+// nil without a hierarchy.
+Matrix*
+Skin::getPalette(Atomic *atomic)
+{
+	Skin *skin = Skin::get(atomic->geometry);
+	HAnimHierarchy *hier = Skin::getHierarchy(atomic);
+	if(hier == nil)
+		return nil;
+	assert(skin->numBones == hier->numNodes);
+
+	int32 n = hier->numNodes;
+	bool32 local = hier->flags & HAnimHierarchy::LOCALSPACEMATRICES;
+	Matrix *ltm = local ? nil : atomic->getFrame()->getLTM();
+	if(hier->palette == nil)
+		hier->palette = rwNewT(Matrix, n*2, MEMDUR_EVENT | ID_SKIN);
+	if(hier->paletteSerial != hier->serial ||
+	   (!local && memcmp(&hier->paletteLTM, ltm, sizeof(Matrix)) != 0)){
+		if(!local){
+			Matrix invAtmMat;
+			Matrix::invert(&invAtmMat, ltm);
+			multMatrices(hier->palette, hier->matrices, &invAtmMat, 0, n);
+			hier->paletteLTM = *ltm;
+		}
+		hier->paletteSerial = hier->serial;
+		hier->paletteSkin = nil;
+	}
+
+	Matrix *palette = &hier->palette[n];
+	if(hier->paletteSkin != skin){
+		multMatrices(palette, (Matrix*)skin->inverseMatrices,
+			local ? hier->matrices : hier->palette, 1, n);
+		hier->paletteSkin = skin;
+	}
+	return palette;
+}
+
+// Skin morph target 0 on the CPU into the atomic's space,
+// what the skin pipelines do in the vertex shader.
+// normals may be nil, they are not renormalized.
+// Without a hierarchy the vertices are copied unskinned.
+void
+Skin::skinVertices(Atomic *atomic, V3d *vertices, V3d *normals)
+{
+	Geometry *geo = atomic->geometry;
+	Skin *skin = Skin::get(geo);
+	MorphTarget *mt = &geo->morphTargets[0];
+	V3d *srcVerts = mt->vertices;
+	V3d *srcNorms = geo->flags & Geometry::NORMALS ? mt->normals : nil;
+	if(srcNorms == nil)
+		normals = nil;
+
+	Matrix *palette = Skin::getPalette(atomic);
+	if(palette == nil){
+		memcpy(vertices, srcVerts, geo->numVertices*sizeof(V3d));
+		if(normals)
+			memcpy(normals, srcNorms, geo->numVertices*sizeof(V3d));
+		return;
+	}
+
+	uint8 *indices = skin->indices;
+	float32 *weights = skin->weights;
+	int32 numWeights = skin->numWeights;
+	for(int32 i = 0; i < geo->numVertices; i++){
+		// blend the bone matrices, then transform once
+#if defined(RW_SSE2)
+		__m128 r = _mm_setzero_ps();
+		__m128 u = _mm_setzero_ps();
+		__m128 t = _mm_setzero_ps();
+		__m128 p = _mm_setzero_ps();
+		for(int32 j = 0; j < numWeights; j++){
+			if(weights[j] == 0.0f)
+				continue;
+			const float32 *m = (const float32*)&palette[indices[j]];
+			__m128 w = _mm_set1_ps(weights[j]);
+			r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m), w));
+			u = _mm_add_ps(u, _mm_mul_ps(_mm_loadu_ps(m+4), w));
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(m+8), w));
+			p = _mm_add_ps(p, _mm_mul_ps(_mm_loadu_ps(m+12), w));
+		}
+		V3d *v = &srcVerts[i];
+		__m128 res = _mm_add_ps(_mm_add_ps(
+			_mm_mul_ps(r, _mm_set1_ps(v->x)),
+			_mm_mul_ps(u, _mm_set1_ps(v->y))),
+			_mm_add_ps(_mm_mul_ps(t, _mm_set1_ps(v->z)), p));
+		// only write 12 bytes
+		_mm_storel_pi((__m64*)&vertices[i], res);
+		_mm_store_ss(&vertices[i].z, _mm_movehl_ps(res, res));
+		if(normals){
+			v = &srcNorms[i];
+			res = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(r, _mm_set1_ps(v->x)),
+				_mm_mul_ps(u, _mm_set1_ps(v->y))),
+				_mm_mul_ps(t, _mm_set1_ps(v->z)));
+			_mm_storel_pi((__m64*)&normals[i], res);
+			_mm_store_ss(&normals[i].z, _mm_movehl_ps(res, res));
+		}
+#elif defined(RW_NEON)
+		float32x4_t r = vdupq_n_f32(0.0f);
+		float32x4_t u = r;
+		float32x4_t t = r;
+		float32x4_t p = r;
+		for(int32 j = 0; j < numWeights; j++){
+			if(weights[j] == 0.0f)
+				continue;
+			const float32 *m = (const float32*)&palette[indices[j]];
+			r = vmlaq_n_f32(r, vld1q_f32(m), weights[j]);
+			u = vmlaq_n_f32(u, vld1q_f32(m+4), weights[j]);
+			t = vmlaq_n_f32(t, vld1q_f32(m+8), weights[j]);
+			p = vmlaq_n_f32(p, vld1q_f32(m+12), weights[j]);
+		}
+		V3d *v = &srcVerts[i];
+		float32x4_t res = vmlaq_n_f32(p, r, v->x);
+		res = vmlaq_n_f32(res, u, v->y);
+		res = vmlaq_n_f32(res, t, v->z);
+		vst1_f32(&vertices[i].x, vget_low_f32(res));
+		vertices[i].z = vgetq_lane_f32(res, 2);
+		if(normals){
+			v = &srcNorms[i];
+			res = vmulq_n_f32(r, v->x);
+			res = vmlaq_n_f32(res, u, v->y);
+			res = vmlaq_n_f32(res, t, v->z);
+			vst1_f32(&normals[i].x, vget_low_f32(res));
+			normals[i].z = vgetq_lane_f32(res, 2);
+		}
+#else
+		Matrix m;
+		memset(&m, 0, sizeof(m));
+		for(int32 j = 0; j < numWeights; j++){
+			if(weights[j] == 0.0f)
+				continue;
+			Matrix *b = &palette[indices[j]];
+			float32 w = weights[j];
+			m.right = add(m.right, scale(b->right, w));
+			m.up = add(m.up, scale(b->up, w));
+			m.at = add(m.at, scale(b->at, w));
+			m.pos = add(m.pos, scale(b->pos, w));
+		}
+		V3d v = srcVerts[i];
+		vertices[i] = add(add(scale(m.right, v.x), scale(m.up, v.y)),
+		                  add(scale(m.at, v.z), m.pos));
+		if(normals){
+			v = srcNorms[i];
+			normals[i] = add(add(scale(m.right, v.x), scale(m.up, v.y)),
+			                 scale(m.at, v.z));
+		}
+#endif
+		indices += 4;
+		weights += 4;
+	}
+}
+
 }
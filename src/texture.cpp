@@ -315,10 +315,27 @@ defaultReadCB(const char *name, const char *mask)
 {
 	Texture *tex;
 	Image *img;
+	Raster *raster;
+	int32 width, height, depth, format;
+	int32 type;
 
 	img = Image::readMasked(name, mask);
 	if(img){
-		tex = Texture::create(Raster::createFromImage(img));
+		type = Raster::TEXTURE;
+		if(TEXTUREGLOBAL(mipmapping)){
+			type |= Raster::MIPMAP;
+			if(TEXTUREGLOBAL(autoMipmapping))
+				type |= Raster::AUTOMIPMAP;
+		}
+		raster = nil;
+		if(Raster::imageFindRasterFormat(img, type, &width, &height, &depth, &format)){
+			raster = Raster::create(width, height, depth, format);
+			if(raster && raster->setFromImage(img) == nil){
+				raster->destroy();
+				raster = nil;
+			}
+		}
+		tex = Texture::create(raster);
 		strncpy(tex->name, name, 32);
 		if(mask)
 			strncpy(tex->mask, mask, 32);
@@ -35,12 +35,33 @@ struct StripNode
 	LLLink inlist;
 };
 
+struct EdgeEntry
+{
+	uint32 key;	/* v0<<16 | v1 */
+	int32 node;
+	int32 edge;
+	int32 next;	/* in hash chain */
+};
+
 struct StripMesh
 {
 	int32 numNodes;
 	StripNode *nodes;
 	LinkList loneNodes;	/* nodes not connected to any others */
 	LinkList endNodes;	/* strip start/end nodes */
+
+	/* directed edge -> node lookup */
+	EdgeEntry *edges;
+	int32 *edgeHash;
+	uint32 hashMask;
+
+	/* nodes touched by the tunnel search, to reset them quickly */
+	StripNode **visited;
+	int32 numVisited;
+	StripNode **path;	/* of the tunnel being applied */
+	StripNode **ends;	/* of the strips going through the path */
+	int32 numEnds;
+	int32 budget;	/* tunnel search steps left */
 };
 
 //#define trace(...) printf(__VA_ARGS__)
@@ -85,14 +106,14 @@ printSmesh(StripMesh *sm)
 }
 
 static void
-collectFaces(Geometry *geo, StripMesh *sm, uint16 m)
+collectFaces(Geometry *geo, StripMesh *sm, int32 *tris, int32 numTris)
 {
 	StripNode *n;
 	Triangle *t;
 	sm->numNodes = 0;
-	for(int32 i = 0; i < geo->numTriangles; i++){
-		t = &geo->triangles[i];
-		if(t->matId == m){
+	for(int32 i = 0; i < numTris; i++){
+		t = &geo->triangles[tris[i]];
+		{
 			n = &sm->nodes[sm->numNodes++];
 			n->v[0] = t->v[0];
 			n->v[1] = t->v[1];
@@ -119,26 +140,55 @@ collectFaces(Geometry *geo, StripMesh *sm, uint16 m)
 	}
 }
 
+static uint32
+hashEdge(uint32 key)
+{
+	key *= 0x9E3779B1;
+	return key ^ key>>16;
+}
+
+/* Hash all directed edges. Chains are in node order
+ * so lookups find the same node a linear search would. */
+static void
+hashEdges(StripMesh *sm)
+{
+	int32 i, j;
+	uint32 size = 16;
+	while(size < (uint32)sm->numNodes*3*2)
+		size *= 2;
+	sm->hashMask = size-1;
+	sm->edgeHash = rwNewT(int32, size, MEMDUR_FUNCTION | ID_GEOMETRY);
+	sm->edges = rwNewT(EdgeEntry, sm->numNodes*3, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(sm->edgeHash, 0xFF, size*sizeof(int32));
+	for(i = sm->numNodes-1; i >= 0; i--)
+		for(j = 2; j >= 0; j--){
+			StripNode *n = &sm->nodes[i];
+			EdgeEntry *e = &sm->edges[i*3 + j];
+			e->key = n->v[j]<<16 | n->v[(j+1) % 3];
+			e->node = i;
+			e->edge = j;
+			uint32 h = hashEdge(e->key) & sm->hashMask;
+			e->next = sm->edgeHash[h];
+			sm->edgeHash[h] = i*3 + j;
+		}
+}
+
 /* Find Triangle that has edge e that is not connected yet. */
 static GraphEdge
 findEdge(StripMesh *sm, int32 e[2])
 {
-	StripNode *n;
 	GraphEdge ge = { 0, 0, 0, 0 };
-	for(int32 i = 0; i < sm->numNodes; i++){
-		n = &sm->nodes[i];
-		for(int32 j = 0; j < 3; j++){
-			if(n->e[j].isConnected)
-				continue;
-			if(e[0] == n->v[j] &&
-			   e[1] == n->v[(j+1) % 3]){
-				ge.node = i;
-				// signal success
-				ge.isConnected = 1;
-				ge.otherEdge = j;
-				return ge;
-			}
-		}
+	uint32 key = e[0]<<16 | e[1];
+	for(int32 i = sm->edgeHash[hashEdge(key) & sm->hashMask]; i >= 0; i = sm->edges[i].next){
+		EdgeEntry *ee = &sm->edges[i];
+		if(ee->key != key ||
+		   sm->nodes[ee->node].e[ee->edge].isConnected)
+			continue;
+		ge.node = ee->node;
+		// signal success
+		ge.isConnected = 1;
+		ge.otherEdge = ee->edge;
+		return ge;
 	}
 	return ge;
 }
@@ -150,6 +200,7 @@ connectNodesPreserve(StripMesh *sm)
 	StripNode *n, *nn;
 	int32 e[2];
 	GraphEdge ge;
+	hashEdges(sm);
 	for(int32 i = 0; i < sm->numNodes; i++){
 		n = &sm->nodes[i];
 		for(int32 j = 0; j < 3; j++){
@@ -174,6 +225,8 @@ connectNodesPreserve(StripMesh *sm)
 			}
 		}
 	}
+	rwFree(sm->edges);
+	rwFree(sm->edgeHash);
 }
 
 static int32
@@ -264,6 +317,9 @@ findTunnel(StripMesh *sm, StripNode *n)
 
 	searchNodes.init();
 	edgetype = 0;
+	/* don't come back to where we started */
+	n->visited = 1;
+	sm->visited[sm->numVisited++] = n;
 	for(;;){
 		for(int32 i = 0; i < 3; i++){
 			/* Find a node connected by the right edgetype */
@@ -294,6 +350,8 @@ findTunnel(StripMesh *sm, StripNode *n)
 			nn->parent = n->e[i].otherEdge;
 			nn->visited = 1;
 			sm->nodes[nn->stripId].stripVisited = 1;
+			sm->visited[sm->numVisited++] = nn;
+			sm->visited[sm->numVisited++] = &sm->nodes[nn->stripId];
 
 			/* Search complete. */
 			if(isEnd && edgetype == 0)
@@ -302,7 +360,7 @@ findTunnel(StripMesh *sm, StripNode *n)
 			/* Found a valid node. */
 			searchNodes.append(&nn->inlist);
 		}
-		if(searchNodes.isEmpty())
+		if(searchNodes.isEmpty() || --sm->budget <= 0)
 			return nil;
 		n = LLLinkGetData(searchNodes.link.next, StripNode, inlist);
 		n->inlist.remove();
@@ -314,11 +372,12 @@ static void
 resetGraph(StripMesh *sm)
 {
 	StripNode *n;
-	for(int32 i = 0; i < sm->numNodes; i++){
-		n = &sm->nodes[i];
+	for(int32 i = 0; i < sm->numVisited; i++){
+		n = sm->visited[i];
 		n->visited = 0;
 		n->stripVisited = 0;
 	}
+	sm->numVisited = 0;
 }
 
 static StripNode*
@@ -359,46 +418,137 @@ walkStrip(StripMesh *sm, StripNode *start)
 	}
 }
 
-static void
-applyTunnel(StripMesh *sm, StripNode *end, StripNode *start)
+/* Walk along a strip to one of its ends, nil if the strip is a loop. */
+static StripNode*
+findStripEnd(StripMesh *sm, StripNode *start)
 {
-	LinkList tmplist;
-	StripNode *n, *nn;
+	StripNode *n;
+	int32 i, last;
 
-	for(n = end; n != start; n = &sm->nodes[n->e[n->parent].node]){
-//trace("	");
-//printNode(sm, n);
+	n = start;
+	last = -1;
+	while(numStripEdges(n) == 2){
+		for(i = 0; i < 3; i++)
+			if(n->e[i].isStrip && i != last)
+				break;
+		last = n->e[i].otherEdge;
+		n = &sm->nodes[n->e[i].node];
+		sm->budget--;
+		if(n == start)
+			return nil;
+	}
+	return n;
+}
+
+static void
+complementPath(StripMesh *sm, StripNode *end, StripNode *start)
+{
+	StripNode *n;
+	for(n = end; n != start; n = &sm->nodes[n->e[n->parent].node])
 		complementEdge(sm, &n->e[n->parent]);
+}
+
+/* Estimate the number of indices a strip will need:
+ * one per triangle, swaps where turns don't alternate,
+ * two to start and two to stitch it to the previous one. */
+static int32
+stripCost(StripMesh *sm, StripNode *start, StripNode **other)
+{
+	StripNode *n;
+	int32 i, j, last;
+	int32 right, lastright;
+	int32 cost;
+
+	n = start;
+	last = -1;
+	lastright = -1;
+	cost = 4;
+	for(;;){
+		cost++;
+		for(j = 0; j < 3; j++)
+			if(n->e[j].isStrip && j != last)
+				break;
+		if(j == 3)
+			break;
+		if(last >= 0){
+			right = (last+1)%3 == j;
+			if(right == lastright)
+				cost++;
+			lastright = right;
+		}
+		i = j;
+		last = n->e[i].otherEdge;
+		n = &sm->nodes[n->e[i].node];
+		sm->budget--;
 	}
-//trace("	");
-//printNode(sm, start);
+	*other = n;
+	return cost;
+}
 
-//printSmesh(sm);
-//trace("-------\n");
-	tmplist.init();
-	while(!sm->endNodes.isEmpty()){
-		n = LLLinkGetData(sm->endNodes.link.next, StripNode, inlist);
-		/* take out of end list */
-		n->inlist.remove();
-		n->isEnd = 0;
-		/* no longer an end node */
-		if(!IsEnd(n))
+/* Cost of all strips going through the path, -1 if one is a loop.
+ * Their ends are put into sm->ends. */
+static int32
+pathCost(StripMesh *sm, int32 numPath)
+{
+	StripNode *e, *other;
+	int32 i, j, cost;
+
+	cost = 0;
+	sm->numEnds = 0;
+	for(i = 0; i < numPath; i++){
+		e = findStripEnd(sm, sm->path[i]);
+		if(e == nil)
+			return -1;
+		for(j = 0; j < sm->numEnds; j++)
+			if(sm->ends[j] == e)
+				break;
+		if(j < sm->numEnds)
 			continue;
-		// TODO: only walk strip if it was touched
-		/* set new id, walk strip and find other end */
-		n->stripId = n - sm->nodes;
-		nn = walkStrip(sm, n);
-		tmplist.append(&n->inlist);
-		n->isEnd = 1;
-		if(nn && n != nn){
-			tmplist.append(&nn->inlist);
+		cost += stripCost(sm, e, &other);
+		sm->ends[sm->numEnds++] = e;
+		sm->ends[sm->numEnds++] = other;
+	}
+	return cost;
+}
+
+/* Complement the edges along the path and fix up the strips it touched.
+ * Returns 0 and leaves everything alone if the tunnel would close
+ * a loop or not make the strips any shorter. */
+static bool32
+applyTunnel(StripMesh *sm, StripNode *end, StripNode *start)
+{
+	StripNode *n, *nn, *e;
+	int32 i, numPath, before, after;
+
+	numPath = 0;
+	for(n = end; n != start; n = &sm->nodes[n->e[n->parent].node])
+		sm->path[numPath++] = n;
+	sm->path[numPath++] = start;
+	sm->ends = sm->path + numPath;
+
+	before = pathCost(sm, numPath);
+	complementPath(sm, end, start);
+	after = pathCost(sm, numPath);
+	if(after < 0 || after >= before){
+		/* complementing again restores the old strips */
+		complementPath(sm, end, start);
+		return 0;
+	}
+
+	/* Every strip that changed goes through the path, renumber them.
+	 * walkStrip takes former ends out of the end list. */
+	for(i = 0; i < sm->numEnds; i += 2){
+		e = sm->ends[i];
+		e->stripId = e - sm->nodes;
+		nn = walkStrip(sm, e);
+		sm->endNodes.append(&e->inlist);
+		e->isEnd = 1;
+		if(nn && nn != e){
+			sm->endNodes.append(&nn->inlist);
 			nn->isEnd = 1;
 		}
 	}
-	/* Move new end nodes to the real list. */
-	sm->endNodes = tmplist;
-	sm->endNodes.link.next->prev = &sm->endNodes.link;
-	sm->endNodes.link.prev->next = &sm->endNodes.link;
+	return 1;
 }
 
 static void
@@ -408,13 +558,14 @@ tunnel(StripMesh *sm)
 
 again:
 	FORLIST(lnk, sm->endNodes){
+		if(sm->budget <= 0)
+			break;
 		n = LLLinkGetData(lnk, StripNode, inlist);
 //		trace("searching %p %d\n", n, numStripEdges(n));
 		nn = findTunnel(sm, n);
 //		trace("          %p %p\n", n, nn);
 
-		if(nn){
-			applyTunnel(sm, nn, n);
+		if(nn && applyTunnel(sm, nn, n)){
 			resetGraph(sm);
 			/* applyTunnel changes sm->endNodes, so we have to
 			 * jump out of the loop. */
@@ -553,12 +704,60 @@ trace("STITCH %d: %d %d\n", seam, m->indices[seam], m->indices[seam+1]);
 
 static void verifyMesh(Geometry *geo);
 
+int32 tristripTunnelBudget = 0;
+
+struct StripJob
+{
+	Geometry *geo;
+	int32 *tris;		/* triangle indices sorted by material */
+	int32 *matStart;	/* into tris */
+	StripNode *nodes;
+	Mesh *meshes;
+};
+
 /*
- * For each material:
+ * For one material:
  * 1. build dual graph (collectFaces, connectNodes)
  * 2. make some simple strip (buildStrips)
  * 3. apply tunnel operator (tunnel)
  */
+static void
+stripMaterial(int32 i, void *data)
+{
+	StripJob *job = (StripJob*)data;
+	StripMesh smesh;
+	int32 start = job->matStart[i];
+	int32 numTris = job->matStart[i+1] - start;
+
+	smesh.nodes = &job->nodes[start];
+	smesh.loneNodes.init();
+	smesh.endNodes.init();
+	collectFaces(job->geo, &smesh, &job->tris[start], numTris);
+	connectNodesPreserve(&smesh);
+	buildStrips(&smesh);
+printSmesh(&smesh);
+//trace("-------\n");
+//printLone(&smesh);
+//trace("-------\n");
+//printEnds(&smesh);
+//trace("-------\n");
+	if(tristripTunnelBudget > 0){
+		smesh.visited = rwNewT(StripNode*, smesh.numNodes*5+1, MEMDUR_FUNCTION | ID_GEOMETRY);
+		smesh.path = smesh.visited + smesh.numNodes*2+1;
+		smesh.numVisited = 0;
+		smesh.budget = tristripTunnelBudget;
+		tunnel(&smesh);
+		rwFree(smesh.visited);
+	}
+//trace("-------\n");
+//printEnds(&smesh);
+
+	job->meshes[i].material = job->geo->matList.materials[i];
+	job->meshes[i].numIndices = 0;
+	makeMesh(&smesh, &job->meshes[i]);
+}
+
+/* Materials are independent of each other, so strip them in parallel. */
 void
 Geometry::buildTristrips(void)
 {
@@ -566,36 +765,40 @@ Geometry::buildTristrips(void)
 	uint16 *indices;
 	MeshHeader *header;
 	Mesh *ms, *md;
-	StripMesh smesh;
+	StripJob job;
+	int32 numMats = this->matList.numMaterials;
 
 //	trace("%ld\n", sizeof(StripNode));
 
-	this->allocateMeshes(matList.numMaterials, 0, 1);
-
-	smesh.nodes = rwNewT(StripNode, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	this->allocateMeshes(numMats, 0, 1);
 	ms = this->meshHeader->getMeshes();
-	for(int32 i = 0; i < this->matList.numMaterials; i++){
-		smesh.loneNodes.init();
-		smesh.endNodes.init();
-		collectFaces(this, &smesh, i);
-		connectNodesPreserve(&smesh);
-		buildStrips(&smesh);
-printSmesh(&smesh);
-//trace("-------\n");
-//printLone(&smesh);
-//trace("-------\n");
-//printEnds(&smesh);
-//trace("-------\n");
-		// TODO: make this work
-//		tunnel(&smesh);
-//trace("-------\n");
-//printEnds(&smesh);
 
-		ms[i].material = this->matList.materials[i];
-		makeMesh(&smesh, &ms[i]);
+	/* bucket triangles by material */
+	job.geo = this;
+	job.meshes = ms;
+	job.tris = rwNewT(int32, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	job.matStart = rwNewT(int32, numMats+1, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memset(job.matStart, 0, (numMats+1)*sizeof(int32));
+	for(i = 0; i < this->numTriangles; i++)
+		if(this->triangles[i].matId < numMats)
+			job.matStart[this->triangles[i].matId+1]++;
+	for(i = 0; i < numMats; i++)
+		job.matStart[i+1] += job.matStart[i];
+	int32 *fill = rwNewT(int32, numMats, MEMDUR_FUNCTION | ID_GEOMETRY);
+	memcpy(fill, job.matStart, numMats*sizeof(int32));
+	for(i = 0; i < this->numTriangles; i++)
+		if(this->triangles[i].matId < numMats)
+			job.tris[fill[this->triangles[i].matId]++] = i;
+	rwFree(fill);
+	job.nodes = rwNewT(StripNode, this->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+
+	runJobs(stripMaterial, numMats, &job);
+
+	rwFree(job.nodes);
+	rwFree(job.matStart);
+	rwFree(job.tris);
+	for(i = 0; i < numMats; i++)
 		this->meshHeader->totalIndices += ms[i].numIndices;
-	}
-	rwFree(smesh.nodes);
 
 	/* Now re-allocate and copy data */
 	header = this->meshHeader;
@@ -617,6 +820,25 @@ printSmesh(&smesh);
 	verifyMesh(this);
 }
 
+/* Rotate triangle so the smallest index comes first, keeping winding */
+static void
+canonTri(int32 *v)
+{
+	int32 t;
+	while(v[0] > v[1] || v[0] > v[2]){
+		t = v[0];
+		v[0] = v[1];
+		v[1] = v[2];
+		v[2] = t;
+	}
+}
+
+static uint32
+hashTri(int32 m, int32 *v)
+{
+	return hashEdge(v[0]<<16 | v[1]) ^ hashEdge(v[2]<<16 | m);
+}
+
 /* Check that tristripped mesh and geometry triangles are actually the same. */
 static void
 verifyMesh(Geometry *geo)
@@ -624,40 +846,62 @@ verifyMesh(Geometry *geo)
 	int32 i, k;
 	uint32 j;
 	int32 x;
-	int32 a, b, c, m;
+	int32 v[3], m;
 	Mesh *mesh;
 	Triangle *t;
 	uint8 *seen;
+	int32 *hash, *next;
+	uint32 mask;
 
 	seen = rwNewT(uint8, geo->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
 	memset(seen, 0, geo->numTriangles);
 
+	/* hash geometry triangles for lookup */
+	mask = 16;
+	while(mask < (uint32)geo->numTriangles*2)
+		mask *= 2;
+	hash = rwNewT(int32, mask + geo->numTriangles, MEMDUR_FUNCTION | ID_GEOMETRY);
+	next = hash + mask;
+	mask--;
+	memset(hash, 0xFF, (mask+1)*sizeof(int32));
+	for(k = geo->numTriangles-1; k >= 0; k--){
+		t = &geo->triangles[k];
+		v[0] = t->v[0];
+		v[1] = t->v[1];
+		v[2] = t->v[2];
+		canonTri(v);
+		uint32 h = hashTri(t->matId, v) & mask;
+		next[k] = hash[h];
+		hash[h] = k;
+	}
+
 	mesh = geo->meshHeader->getMeshes();
 	for(i = 0; i < geo->meshHeader->numMeshes; i++){
 		m = geo->matList.findIndex(mesh->material);
 		x = 0;
-		for(j = 0; j < mesh->numIndices-2; j++){
-			a = mesh->indices[j+x];
+		for(j = 0; j+2 < mesh->numIndices; j++){
+			v[0] = mesh->indices[j+x];
 			x = !x;
-			b = mesh->indices[j+x];
-			c = mesh->indices[j+2];
-			if(a >= geo->numVertices ||
-			   b >= geo->numVertices ||
-			   c >= geo->numVertices){
-				fprintf(stderr, "triangle %d %d %d out of range (%d)\n", a, b, c, geo->numVertices);
+			v[1] = mesh->indices[j+x];
+			v[2] = mesh->indices[j+2];
+			if(v[0] >= geo->numVertices ||
+			   v[1] >= geo->numVertices ||
+			   v[2] >= geo->numVertices){
+				fprintf(stderr, "triangle %d %d %d out of range (%d)\n", v[0], v[1], v[2], geo->numVertices);
 				goto loss;
 			}
-			if(a == b || a == c || b == c)
+			if(v[0] == v[1] || v[0] == v[2] || v[1] == v[2])
 				continue;
-trace("%d %d %d\n", a, b, c);
+trace("%d %d %d\n", v[0], v[1], v[2]);
 
 			/* now that we have a triangle, try to find it */
-			for(k = 0; k < geo->numTriangles; k++){
+			canonTri(v);
+			for(k = hash[hashTri(m, v) & mask]; k >= 0; k = next[k]){
 				t = &geo->triangles[k];
 				if(seen[k] || t->matId != m) continue;
-				if((t->v[0] == a && t->v[1] == b && t->v[2] == c) ||
-				   (t->v[1] == a && t->v[2] == b && t->v[0] == c) ||
-				   (t->v[2] == a && t->v[0] == b && t->v[1] == c)){
+				int32 w[3] = { t->v[0], t->v[1], t->v[2] };
+				canonTri(w);
+				if(w[0] == v[0] && w[1] == v[1] && w[2] == v[2]){
 					seen[k] = 1;
 					goto found;
 				}
@@ -676,6 +920,7 @@ trace("%d %d %d\n", a, b, c);
 			exit(1);
 		}
 
+	rwFree(hash);
 	rwFree(seen);
 }
 
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <rw.h>
+#include <args.h>
+
+using namespace rw;
+
+char *argv0;
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-s maxsize] [-t maxtexsize] [-p padding] in.dff in.txd out.dff out.txd\n", argv0);
+	exit(1);
+}
+
+static bool32
+usesTexture(Clump *clump, Texture *tex)
+{
+	FORLIST(lnk, clump->atomics){
+		Geometry *geo = Atomic::fromClump(lnk)->geometry;
+		if(geo == nil)
+			continue;
+		for(int32 i = 0; i < geo->matList.numMaterials; i++)
+			if(geo->matList.materials[i]->texture == tex)
+				return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	AtlasParams params = { 1024, 256, 2 };
+
+	rw::Engine::init();
+	rw::registerMeshPlugin();
+	rw::registerNativeDataPlugin();
+	rw::registerAtomicRightsPlugin();
+	rw::registerMaterialRightsPlugin();
+	rw::xbox::registerVertexFormatPlugin();
+	rw::registerSkinPlugin();
+	rw::registerHAnimPlugin();
+	rw::registerMatFXPlugin();
+	rw::registerUVAnimPlugin();
+	rw::Engine::open(nil);
+	rw::Engine::start();
+
+	ARGBEGIN{
+	case 's':
+		params.maxSize = atoi(EARGF(usage()));
+		break;
+	case 't':
+		params.maxTexSize = atoi(EARGF(usage()));
+		break;
+	case 'p':
+		params.padding = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND;
+
+	if(argc < 4)
+		usage();
+
+	StreamFile stream;
+	if(!stream.open(argv[1], "rb")){
+		fprintf(stderr, "Error: couldn't open %s\n", argv[1]);
+		return 1;
+	}
+	TexDictionary *txd = nil;
+	if(findChunk(&stream, ID_TEXDICTIONARY, nil, nil))
+		txd = TexDictionary::streamRead(&stream);
+	stream.close();
+	if(txd == nil){
+		fprintf(stderr, "Error: couldn't read txd\n");
+		return 1;
+	}
+	TexDictionary::setCurrent(txd);
+
+	if(!stream.open(argv[0], "rb")){
+		fprintf(stderr, "Error: couldn't open %s\n", argv[0]);
+		return 1;
+	}
+	Clump *clump = nil;
+	if(findChunk(&stream, ID_CLUMP, nil, nil))
+		clump = Clump::streamRead(&stream);
+	stream.close();
+	if(clump == nil){
+		fprintf(stderr, "Error: couldn't read clump\n");
+		return 1;
+	}
+
+	// remember which textures were used so we can drop the packed ones
+	int32 numUsed = 0;
+	Texture **used = rwNewT(Texture*, txd->count(), MEMDUR_FUNCTION | ID_TEXTURE);
+	FORLIST(lnk, txd->textures){
+		Texture *tex = Texture::fromDict(lnk);
+		if(usesTexture(clump, tex))
+			used[numUsed++] = tex;
+	}
+
+	int32 numAtlases = buildAtlases(clump, txd, &params);
+	int32 numPacked = 0;
+	for(int32 i = 0; i < numUsed; i++)
+		if(!usesTexture(clump, used[i])){
+			txd->remove(used[i]);
+			used[i]->destroy();
+			numPacked++;
+		}
+	rwFree(used);
+	printf("packed %d textures into %d atlases\n", numPacked, numAtlases);
+
+	if(!stream.open(argv[2], "wb")){
+		fprintf(stderr, "Error: couldn't open %s\n", argv[2]);
+		return 1;
+	}
+	clump->streamWrite(&stream);
+	stream.close();
+
+	if(!stream.open(argv[3], "wb")){
+		fprintf(stderr, "Error: couldn't open %s\n", argv[3]);
+		return 1;
+	}
+	txd->streamWrite(&stream);
+	stream.close();
+
+	clump->destroy();
+	txd->destroy();
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <rw.h>
+#include <args.h>
+
+using namespace rw;
+
+char *argv0;
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-w] [-c cachesize] [-o] [-v] in.dff out.dff\n", argv0);
+	fprintf(stderr, "\t-w: weld identical vertices\n");
+	fprintf(stderr, "\t-c: reorder triangles for a vertex cache of this size\n");
+	fprintf(stderr, "\t-o: also reduce overdraw\n");
+	fprintf(stderr, "\t-v: reorder vertices for fetch\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bool32 weld = 0;
+	int32 cacheSize = 0;
+	bool32 overdraw = 0;
+	bool32 vertexOrder = 0;
+
+	rw::Engine::init();
+	rw::registerMeshPlugin();
+	rw::registerIndex32Plugin();
+	rw::registerNativeDataPlugin();
+	rw::registerAtomicRightsPlugin();
+	rw::registerMaterialRightsPlugin();
+	rw::xbox::registerVertexFormatPlugin();
+	rw::registerSkinPlugin();
+	rw::registerHAnimPlugin();
+	rw::registerMatFXPlugin();
+	rw::registerUVAnimPlugin();
+	rw::Engine::open(nil);
+	rw::Engine::start();
+
+	ARGBEGIN{
+	case 'w':
+		weld = 1;
+		break;
+	case 'c':
+		cacheSize = atoi(EARGF(usage()));
+		break;
+	case 'o':
+		overdraw = 1;
+		break;
+	case 'v':
+		vertexOrder = 1;
+		break;
+	default:
+		usage();
+	}ARGEND;
+
+	if(argc < 2)
+		usage();
+
+	StreamFile stream;
+	if(!stream.open(argv[0], "rb")){
+		fprintf(stderr, "Error: couldn't open %s\n", argv[0]);
+		return 1;
+	}
+	Clump *clump = nil;
+	if(findChunk(&stream, ID_CLUMP, nil, nil))
+		clump = Clump::streamRead(&stream);
+	stream.close();
+	if(clump == nil){
+		fprintf(stderr, "Error: couldn't read clump\n");
+		return 1;
+	}
+
+	int32 numGeos = 0;
+	Geometry **geos = rwNewT(Geometry*, clump->countAtomics(), MEMDUR_FUNCTION | ID_GEOMETRY);
+	FORLIST(lnk, clump->atomics){
+		Geometry *geo = Atomic::fromClump(lnk)->geometry;
+		int32 i;
+		if(geo == nil || geo->flags & Geometry::NATIVE)
+			continue;
+		// geometries can be shared
+		for(i = 0; i < numGeos; i++)
+			if(geos[i] == geo)
+				break;
+		if(i < numGeos)
+			continue;
+		geos[numGeos++] = geo;
+
+		int32 numVerts = geo->numVertices;
+		float32 acmr = geo->meshHeader ? geo->meshHeader->calculateACMR(cacheSize ? cacheSize : 16) : 0.0f;
+		if(weld)
+			geo->weldVertices();
+		if(cacheSize)
+			geo->optimizeTriangleOrder(cacheSize, overdraw);
+		if(vertexOrder)
+			geo->optimizeVertexOrder();
+		if(geo->meshHeader == nil)
+			geo->buildMeshes();
+		printf("geometry %d: %d -> %d vertices, ACMR %.3f -> %.3f\n", numGeos-1,
+			numVerts, geo->numVertices,
+			acmr, geo->meshHeader->calculateACMR(cacheSize ? cacheSize : 16));
+	}
+	rwFree(geos);
+
+	if(!stream.open(argv[1], "wb")){
+		fprintf(stderr, "Error: couldn't open %s\n", argv[1]);
+		return 1;
+	}
+	clump->streamWrite(&stream);
+	stream.close();
+
+	clump->destroy();
+
+	return 0;
+}
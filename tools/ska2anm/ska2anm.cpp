@@ -13,14 +13,18 @@ char *argv0;
 void
 usage(void)
 {
-	fprintf(stderr, "usage: %s in.ska [out.anm]\n", argv0);
+	fprintf(stderr, "usage: %s [-b rate] in.ska [out.anm]\n", argv0);
 	fprintf(stderr, "   or: %s in.anm [out.ska]\n", argv0);
+	fprintf(stderr, "   or: %s -b rate in.anm [out.anm]\n", argv0);
+	fprintf(stderr, "\t-b: bake to this many samples per second\n");
 	exit(1);
 }
 
 int
 main(int argc, char *argv[])
 {
+	float32 rate = 0.0f;
+
 	rw::Engine::init();
 	rw::registerHAnimPlugin();
 	rw::Engine::open(nil);
@@ -30,6 +34,11 @@ main(int argc, char *argv[])
 	case 'v':
 		sscanf(EARGF(usage()), "%x", &rw::version);
 		break;
+	case 'b':
+		rate = strtof(EARGF(usage()), nil);
+		if(rate <= 0.0f)
+			usage();
+		break;
 	default:
 		usage();
 	}ARGEND;
@@ -61,10 +70,26 @@ main(int argc, char *argv[])
 		return 1;
 	}
 
+	// baked animations can only be written as anm
+	bool32 toska = firstword == ID_ANIMANIMATION && rate == 0.0f;
+	if(toska && anim->interpInfo->id != 1){
+		fprintf(stderr, "Error: only plain HAnim animations can be written as ska\n");
+		return 1;
+	}
+	if(rate > 0.0f){
+		Animation *baked = bakeHAnimAnimation(anim, rate);
+		if(baked == nil){
+			fprintf(stderr, "Error: couldn't bake animation\n");
+			return 1;
+		}
+		anim->destroy();
+		anim = baked;
+	}
+
 	const char *file;
 	if(argc > 1)
 		file = argv[1];
-	else if(firstword == ID_ANIMANIMATION)
+	else if(toska)
 		file = "out.ska";
 	else
 		file = "out.anm";
@@ -72,7 +97,7 @@ main(int argc, char *argv[])
 		fprintf(stderr, "Error: couldn't open %s\n", file);
 		return 1;
 	}
-	if(firstword == ID_ANIMANIMATION)
+	if(toska)
 		anim->streamWriteLegacy(&stream);
 	else
 		anim->streamWrite(&stream);
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include <rw.h>
+#include <args.h>
+
+using namespace rw;
+
+char *argv0;
+
+void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-s gridsize] [-m materials] [-t tunnelbudget] [-j threads] [-r runs]\n", argv0);
+	exit(1);
+}
+
+// A sphere-ish grid with bands of materials and a few holes,
+// triangles in random order like they often come out of converters.
+static Geometry*
+makeMesh(int32 size, int32 numMaterials)
+{
+	int32 x, y, i;
+	int32 numVerts = (size+1)*(size+1);
+	Geometry *geo = Geometry::create(numVerts, size*size*2, Geometry::POSITIONS | Geometry::TRISTRIP);
+	V3d *verts = geo->morphTargets[0].vertices;
+	for(y = 0; y <= size; y++)
+		for(x = 0; x <= size; x++){
+			float32 u = x*2.0f*3.14159f/size;
+			float32 v = y*3.14159f/size;
+			verts[y*(size+1) + x].set(cosf(u)*sinf(v), sinf(u)*sinf(v), cosf(v));
+		}
+	for(i = 0; i < numMaterials; i++){
+		Material *mat = Material::create();
+		geo->matList.appendMaterial(mat);
+		mat->destroy();
+	}
+
+	srand(1234);
+	int32 n = 0;
+	for(y = 0; y < size; y++)
+		for(x = 0; x < size; x++){
+			if(rand() % 64 == 0)
+				continue;
+			int32 a = y*(size+1) + x;
+			int32 m = x*numMaterials/size;
+			Triangle *t = &geo->triangles[n++];
+			t->v[0] = a;
+			t->v[1] = a+1;
+			t->v[2] = a+size+1;
+			t->matId = m;
+			t = &geo->triangles[n++];
+			t->v[0] = a+1;
+			t->v[1] = a+size+2;
+			t->v[2] = a+size+1;
+			t->matId = m;
+		}
+	geo->numTriangles = n;
+	for(i = n-1; i > 0; i--){
+		int32 j = rand() % (i+1);
+		Triangle t = geo->triangles[i];
+		geo->triangles[i] = geo->triangles[j];
+		geo->triangles[j] = t;
+	}
+	return geo;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int32 size = 180;
+	int32 numMaterials = 4;
+	int32 runs = 3;
+
+	rw::Engine::init();
+	rw::Engine::open(nil);
+	rw::Engine::start();
+
+	ARGBEGIN{
+	case 's':
+		size = atoi(EARGF(usage()));
+		break;
+	case 'm':
+		numMaterials = atoi(EARGF(usage()));
+		break;
+	case 't':
+		tristripTunnelBudget = atoi(EARGF(usage()));
+		break;
+	case 'j':
+		setNumJobThreads(atoi(EARGF(usage())));
+		break;
+	case 'r':
+		runs = atoi(EARGF(usage()));
+		break;
+	default:
+		usage();
+	}ARGEND;
+
+	if(size < 1 || (size+1)*(size+1) > 0x10000 || numMaterials < 1)
+		usage();
+
+	Geometry *geo = makeMesh(size, numMaterials);
+	printf("%d triangles, %d vertices, %d materials, %d threads\n",
+		geo->numTriangles, geo->numVertices, numMaterials, getNumJobThreads());
+	for(int32 i = 0; i < runs; i++){
+		auto start = std::chrono::steady_clock::now();
+		geo->buildMeshes();
+		auto end = std::chrono::steady_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		MeshHeader *mh = geo->meshHeader;
+		printf("%8.2f ms  %u indices  %.3f indices/triangle\n",
+			ms, mh->totalIndices, (float32)mh->totalIndices/geo->numTriangles);
+	}
+	geo->destroy();
+
+	return 0;
+}